@@ -0,0 +1,369 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <cpu.h>
+#include <gpu.h>
+#include <gb_memory.h>
+#include <joypad.h>
+#include <timer.h>
+#include <scheduler.h>
+#include <boot.h>
+#include <state.h>
+#include <pacer.h>
+
+// Runs ROMs headless with scripted input and reports emulation speed.
+// Usage: gb_bench [options] [rom...], roms/tetris.gb if no ROM is given
+
+#define BENCH_DEFAULT_ROM "roms/tetris.gb"
+#define BENCH_DEFAULT_FRAMES 3600
+#define BENCH_DEFAULT_RUNS 5
+#define BENCH_MAX_RUNS 100
+
+// Cycles per second of the real hardware
+#define BENCH_CLOCK_HZ 4194304
+
+// Frames start is held for in the script, to get past title screens
+#define SCRIPT_START_FRAMES 180
+#define SCRIPT_PLAY_FRAME 480
+#define SCRIPT_STEP_FRAMES 20
+
+// Measurements of one run
+typedef struct {
+    uint64_t cycles;
+    uint64_t instructions;
+    uint32_t frames;
+    double seconds;
+} bench_run_t;
+
+// Mean and sample deviation of a measure over the runs
+typedef struct {
+    double mean;
+    double stdev;
+    double min;
+    double max;
+} bench_stat_t;
+
+static uint32_t frame_limit;
+static uint64_t cycle_limit;
+static uint32_t frames_run;
+static uint8_t last_buttons;
+
+/**
+ * Buttons held on a frame: start pressed twice to get into a game, then a
+ * repeating mix of moves and presses. Fixed, so every run does the same work
+ */
+static uint8_t script_buttons(uint32_t frame) {
+    static const uint8_t steps[] = {
+        JOYPAD_LEFT, 0, JOYPAD_A, 0, JOYPAD_RIGHT, 0, JOYPAD_DOWN, JOYPAD_B,
+    };
+
+    if (frame < SCRIPT_PLAY_FRAME) {
+        uint32_t held = frame % (SCRIPT_PLAY_FRAME / 2);
+        return held >= SCRIPT_START_FRAMES && held < SCRIPT_START_FRAMES + 10 ? JOYPAD_START : 0;
+    }
+
+    return steps[(frame - SCRIPT_PLAY_FRAME) / SCRIPT_STEP_FRAMES % sizeof(steps)];
+}
+
+static int on_frame(gb_t *gb, const uint8_t *frame, uint8_t drawn) {
+    frames_run++;
+
+    uint8_t buttons = script_buttons(frames_run);
+
+    if (buttons != last_buttons) {
+        joypad_submit(gb, gb->cycles, buttons);
+        last_buttons = buttons;
+    }
+
+    if (cycle_limit) {
+        return gb->cycles < cycle_limit;
+    }
+
+    return frames_run < frame_limit;
+}
+
+/**
+ * A freshly powered on machine with a cartridge loaded
+ */
+static gb_t *power_on(const char *rom, uint8_t skip_bios) {
+    gb_t *gb = calloc(1, sizeof(*gb));
+
+    gb->in_bios = 1;
+    gb->dma_mode = DMA_MODE_NONE;
+
+    sched_init(gb);
+    cpu_init(gb);
+    mem_init(gb);
+    gpu_init(gb);
+    joypad_init(gb);
+    timer_init(gb);
+
+#if GB_OPCODE_STATS
+    opcode_stats_init(&gb->opcode_stats, OPCODE_STATS_DEFAULT_SAMPLE);
+#endif
+
+    if (!mem_load_rom(gb, rom)) {
+        return NULL;
+    }
+
+    if (skip_bios) {
+        boot_skip_bios(gb);
+    }
+
+    return gb;
+}
+
+static void power_off(gb_t *gb) {
+    free(gb->vram);
+    free(gb->ram);
+    free(gb->io_registers);
+    free(gb->hram);
+    free(gb->oam);
+    free(gb->mbc_rom);
+    free(gb->mbc_ram);
+    free(gb);
+}
+
+/**
+ * Run from the power on state for the frame or cycle limit
+ */
+static void run(gb_t *gb, const uint8_t *start, size_t size, uint32_t frames, uint64_t cycles, bench_run_t *result) {
+    state_load(gb, start, size);
+
+    frames_run = 0;
+    frame_limit = frames;
+    cycle_limit = cycles ? gb->cycles + cycles : 0;
+    last_buttons = 0;
+
+    uint64_t start_cycles = gb->cycles;
+    uint64_t start_instructions = gb->instructions;
+    int64_t start_time = pacer_now_ns();
+
+    gb_run(gb);
+
+    result->seconds = (pacer_now_ns() - start_time) / 1e9;
+    result->cycles = gb->cycles - start_cycles;
+    result->instructions = gb->instructions - start_instructions;
+    result->frames = frames_run;
+}
+
+static double run_mhz(const bench_run_t *run) {
+    return run->cycles / run->seconds / 1e6;
+}
+
+static double run_fps(const bench_run_t *run) {
+    return run->frames / run->seconds;
+}
+
+static double run_mips(const bench_run_t *run) {
+    return run->instructions / run->seconds / 1e6;
+}
+
+static double run_speed(const bench_run_t *run) {
+    return run->cycles / run->seconds / BENCH_CLOCK_HZ;
+}
+
+static void stat(const bench_run_t *runs, uint32_t count, double (*measure)(const bench_run_t *), bench_stat_t *result) {
+    double sum = 0;
+
+    result->min = INFINITY;
+    result->max = 0;
+
+    for (uint32_t i = 0; i < count; i++) {
+        double value = measure(&runs[i]);
+
+        sum += value;
+        result->min = value < result->min ? value : result->min;
+        result->max = value > result->max ? value : result->max;
+    }
+
+    result->mean = sum / count;
+
+    double squares = 0;
+
+    for (uint32_t i = 0; i < count; i++) {
+        double delta = measure(&runs[i]) - result->mean;
+        squares += delta * delta;
+    }
+
+    result->stdev = count > 1 ? sqrt(squares / (count - 1)) : 0;
+}
+
+static void print_stat(const char *name, const char *unit, const bench_stat_t *stat) {
+    printf("  %-14s %10.3f %-5s +- %.3f (%.2f%%), range %.3f - %.3f\n",
+        name, stat->mean, unit, stat->stdev, stat->mean ? stat->stdev / stat->mean * 100 : 0, stat->min, stat->max);
+}
+
+static void json_stat(FILE *f, const char *name, const bench_stat_t *stat) {
+    fprintf(f, "\"%s\": {\"mean\": %.6f, \"stdev\": %.6f, \"min\": %.6f, \"max\": %.6f}",
+        name, stat->mean, stat->stdev, stat->min, stat->max);
+}
+
+static void print_usage() {
+    printf("Usage: gb_bench [options] [rom...]\n");
+    printf("  --frames <n>    Run n frames per run (default %u)\n", BENCH_DEFAULT_FRAMES);
+    printf("  --cycles <n>    Run at least n cycles per run instead, stopping at the end of a frame\n");
+    printf("  --runs <n>      Timed runs per ROM (default %u)\n", BENCH_DEFAULT_RUNS);
+    printf("  --warmup <n>    Untimed runs first (default 1)\n");
+    printf("  --skip-bios     Start the cartridge directly in the post boot state\n");
+    printf("  --csv <file>    Write every run as CSV\n");
+    printf("  --json <file>   Write every run and the summary per ROM as JSON\n");
+}
+
+int main(int argc, char *argv[]) {
+    uint32_t frames = BENCH_DEFAULT_FRAMES;
+    uint64_t cycles = 0;
+    uint32_t runs = BENCH_DEFAULT_RUNS;
+    uint32_t warmup = 1;
+    uint8_t skip_bios = 0;
+
+    const char *csv_path = NULL;
+    const char *json_path = NULL;
+
+    const char **roms = calloc(argc, sizeof(char *));
+    int rom_count = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--frames") && i + 1 < argc) {
+            frames = strtoul(argv[++i], NULL, 10);
+        } else if (!strcmp(argv[i], "--cycles") && i + 1 < argc) {
+            cycles = strtoull(argv[++i], NULL, 10);
+        } else if (!strcmp(argv[i], "--runs") && i + 1 < argc) {
+            runs = strtoul(argv[++i], NULL, 10);
+        } else if (!strcmp(argv[i], "--warmup") && i + 1 < argc) {
+            warmup = strtoul(argv[++i], NULL, 10);
+        } else if (!strcmp(argv[i], "--skip-bios")) {
+            skip_bios = 1;
+        } else if (!strcmp(argv[i], "--csv") && i + 1 < argc) {
+            csv_path = argv[++i];
+        } else if (!strcmp(argv[i], "--json") && i + 1 < argc) {
+            json_path = argv[++i];
+        } else if (argv[i][0] != '-') {
+            roms[rom_count++] = argv[i];
+        } else {
+            print_usage();
+            return 0;
+        }
+    }
+
+    if (runs == 0 || runs > BENCH_MAX_RUNS || (frames == 0 && cycles == 0)) {
+        print_usage();
+        return 0;
+    }
+
+    if (rom_count == 0) {
+        roms[rom_count++] = BENCH_DEFAULT_ROM;
+    }
+
+    FILE *csv = NULL;
+    FILE *json = NULL;
+
+    if (csv_path) {
+        csv = fopen(csv_path, "w");
+
+        if (!csv) {
+            printf("Failed to open %s\n", csv_path);
+            return 1;
+        }
+
+        fprintf(csv, "rom,run,frames,cycles,instructions,seconds,mhz,fps,mips,speed\n");
+    }
+
+    if (json_path) {
+        json = fopen(json_path, "w");
+
+        if (!json) {
+            printf("Failed to open %s\n", json_path);
+            return 1;
+        }
+
+        fprintf(json, "[\n");
+    }
+
+    gpu_set_frame_handler(on_frame);
+
+    bench_run_t results[BENCH_MAX_RUNS];
+
+    for (int r = 0; r < rom_count; r++) {
+        gb_t *gb = power_on(roms[r], skip_bios);
+
+        if (!gb) {
+            return 1;
+        }
+
+        // Every run starts from the same power on state
+        size_t size = state_size(gb);
+        uint8_t *start = malloc(size);
+        state_save(gb, start, size);
+
+        for (uint32_t i = 0; i < warmup; i++) {
+            run(gb, start, size, frames, cycles, &results[0]);
+        }
+
+        for (uint32_t i = 0; i < runs; i++) {
+            run(gb, start, size, frames, cycles, &results[i]);
+        }
+
+        bench_stat_t mhz, fps, mips, speed;
+        stat(results, runs, run_mhz, &mhz);
+        stat(results, runs, run_fps, &fps);
+        stat(results, runs, run_mips, &mips);
+        stat(results, runs, run_speed, &speed);
+
+        printf("%s: %u frames, %llu cycles, %llu instructions per run, %u runs\n",
+            roms[r], results[0].frames, (unsigned long long)results[0].cycles, (unsigned long long)results[0].instructions, runs);
+        print_stat("Emulated clock", "MHz", &mhz);
+        print_stat("Frame rate", "fps", &fps);
+        print_stat("Instructions", "MIPS", &mips);
+        print_stat("Speed", "x", &speed);
+
+#if GB_OPCODE_STATS
+        // Over the warmup and timed runs together
+        opcode_stats_print(&gb->opcode_stats, roms[r], stdout);
+#endif
+
+        for (uint32_t i = 0; i < runs && csv; i++) {
+            fprintf(csv, "\"%s\",%u,%u,%llu,%llu,%.6f,%.6f,%.6f,%.6f,%.6f\n",
+                roms[r], i, results[i].frames, (unsigned long long)results[i].cycles,
+                (unsigned long long)results[i].instructions, results[i].seconds,
+                run_mhz(&results[i]), run_fps(&results[i]), run_mips(&results[i]), run_speed(&results[i]));
+        }
+
+        if (json) {
+            fprintf(json, "  {\"rom\": \"%s\", \"runs\": [\n", roms[r]);
+
+            for (uint32_t i = 0; i < runs; i++) {
+                fprintf(json, "    {\"frames\": %u, \"cycles\": %llu, \"instructions\": %llu, \"seconds\": %.6f}%s\n",
+                    results[i].frames, (unsigned long long)results[i].cycles,
+                    (unsigned long long)results[i].instructions, results[i].seconds, i + 1 < runs ? "," : "");
+            }
+
+            fprintf(json, "  ], ");
+            json_stat(json, "mhz", &mhz);
+            fprintf(json, ", ");
+            json_stat(json, "fps", &fps);
+            fprintf(json, ", ");
+            json_stat(json, "mips", &mips);
+            fprintf(json, ", ");
+            json_stat(json, "speed", &speed);
+            fprintf(json, "}%s\n", r + 1 < rom_count ? "," : "");
+        }
+
+        free(start);
+        power_off(gb);
+    }
+
+    if (csv) {
+        fclose(csv);
+    }
+
+    if (json) {
+        fprintf(json, "]\n");
+        fclose(json);
+    }
+
+    free(roms);
+
+    return 0;
+}
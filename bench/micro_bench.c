@@ -0,0 +1,473 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <timer.h>
+#include <scheduler.h>
+#include <pacer.h>
+
+// The cpu and gpu hot paths are static, so they are built into this file
+#include "../lib/cpu.c"
+#include "../lib/gpu.c"
+
+// Times the hot paths of each subsystem in isolation on fixed synthetic state.
+// Usage: micro_bench [--samples <n>] [name filter...]
+
+#define BENCH_DEFAULT_SAMPLES 500
+#define BENCH_WARMUP_SAMPLES 20
+
+// Each sample repeats its operation until it takes at least this long
+#define BENCH_SAMPLE_NS 50000
+
+// Where synthetic instructions are run from, and the memory they use
+#define BENCH_PC 0xC000
+#define BENCH_SP 0xDFF0
+#define BENCH_HL 0xC800
+
+// Lines of the synthetic screen with ten sprites, and with none
+#define BENCH_SPRITE_LINE 64
+#define BENCH_EMPTY_LINE 120
+
+typedef struct micro_bench micro_bench_t;
+
+typedef void bench_fn_t(gb_t *gb, const micro_bench_t *bench, uint32_t ops);
+
+struct micro_bench {
+    const char *name;
+    bench_fn_t *fn;
+
+    // Address for memory benchmarks, or line for the gpu ones
+    uint16_t address;
+
+    // Low address bits varied between operations
+    uint16_t mask;
+
+    // Instruction for cpu benchmarks, CB prefixed if cb is set
+    uint8_t opcode;
+    uint8_t cb;
+};
+
+// Keeps results alive so the work isn't optimised away
+static volatile uint32_t sink;
+
+/* SYNTHETIC STATE */
+
+static uint32_t lcg_state = 12345;
+
+static uint8_t lcg() {
+    lcg_state = lcg_state * 1103515245 + 12345;
+    return lcg_state >> 16;
+}
+
+/**
+ * An MBC1 cartridge with 128KB of ROM and 8KB of RAM, filled with a fixed pattern
+ */
+static int load_synthetic_cart(gb_t *gb) {
+    FILE *f = tmpfile();
+
+    if (!f) {
+        printf("Failed to create a synthetic cartridge\n");
+        return 0;
+    }
+
+    for (uint32_t i = 0; i < 0x20000; i++) {
+        uint8_t value = lcg();
+
+        if (i == CART_TYPE) {
+            value = 0x02;
+        } else if (i == CART_ROM_SIZE) {
+            value = 0x02;
+        } else if (i == CART_RAM_SIZE) {
+            value = 0x02;
+        }
+
+        fputc(value, f);
+    }
+
+    int loaded = mbc_setup(gb, f);
+
+    fclose(f);
+
+    return loaded;
+}
+
+/**
+ * A machine out of the boot ROM with patterned memory, the LCD on and
+ * ten sprites on BENCH_SPRITE_LINE
+ */
+static gb_t *synthetic_machine() {
+    gb_t *gb = get_gb_instance();
+
+    sched_init(gb);
+    cpu_init(gb);
+    mem_init(gb);
+    gpu_init(gb);
+    joypad_init(gb);
+    timer_init(gb);
+
+    if (!load_synthetic_cart(gb)) {
+        return NULL;
+    }
+
+    gb->in_bios = 0;
+    gb->ime = 0;
+
+    // Enable cartridge RAM
+    mem_write_byte(gb, 0x0000, 0x0A);
+
+    for (uint32_t i = 0; i < VRAM_SIZE; i++) {
+        gb->vram[i] = lcg();
+    }
+
+    for (uint32_t i = 0; i < RAM_SIZE; i++) {
+        gb->ram[i] = lcg();
+    }
+
+    for (uint32_t i = 0; i < HIGH_SPEED_RAM_SIZE; i++) {
+        gb->hram[i] = lcg();
+    }
+
+    for (uint8_t i = 0; i < 40; i++) {
+        uint8_t on_line = i < 10;
+
+        gb->oam[i * 4] = on_line ? BENCH_SPRITE_LINE + 16 - 4 : 0;
+        gb->oam[i * 4 + 1] = 8 + i * 16;
+        gb->oam[i * 4 + 2] = lcg();
+        gb->oam[i * 4 + 3] = i & 1 ? SPRITE_ATTR_PALETTE | SPRITE_ATTR_XFLIP : SPRITE_ATTR_OBJ_BG_PRIORITY;
+    }
+
+    gb->io_registers[REG_LCDC & 0xFF] = LCDC_LCD_CONTROL | LCDC_BG_WINDOW_TILE_DATA_SELECT | LCDC_OBJ_ON | LCDC_BG_WINDOW_DISPLAY;
+    gb->io_registers[REG_SCX & 0xFF] = 3;
+    gb->io_registers[REG_SCY & 0xFF] = 5;
+    gb->io_registers[REG_BGP & 0xFF] = 0xE4;
+    gb->io_registers[REG_OBP0 & 0xFF] = 0xD2;
+    gb->io_registers[REG_OBP1 & 0xFF] = 0x1B;
+    gb->io_registers[REG_TMC & 0xFF] = TMC_ENABLE | TMC_CLOCK_DIV_16;
+
+    gb->gpu.lcd_on = 1;
+    gb->gpu.lcd_mode = LCD_MODE_0_HBLANK;
+    sched_cancel(gb, SCHED_EVENT_LCD_OFF_FRAME);
+
+    return gb;
+}
+
+/* BENCHMARKS */
+
+static void bench_read(gb_t *gb, const micro_bench_t *bench, uint32_t ops) {
+    uint32_t sum = 0;
+
+    for (uint32_t i = 0; i < ops; i++) {
+        sum += mem_read_byte(gb, bench->address + (i & bench->mask));
+    }
+
+    sink = sum;
+}
+
+static void bench_write(gb_t *gb, const micro_bench_t *bench, uint32_t ops) {
+    for (uint32_t i = 0; i < ops; i++) {
+        mem_write_byte(gb, bench->address + (i & bench->mask), i);
+    }
+}
+
+/**
+ * Fetch, dispatch and execute one instruction, the same as cpu_tick
+ */
+static void bench_instruction(gb_t *gb, const micro_bench_t *bench, uint32_t ops) {
+    uint32_t cycles = 0;
+
+    gb->ram[BENCH_PC - 0xC000] = bench->cb ? 0xCB : bench->opcode;
+    gb->ram[BENCH_PC - 0xC000 + 1] = bench->cb ? bench->opcode : 0x00;
+    gb->ram[BENCH_PC - 0xC000 + 2] = 0x00;
+
+    for (uint32_t i = 0; i < ops; i++) {
+        gb->cpu.pc = BENCH_PC;
+        gb->cpu.sp = BENCH_SP;
+        gb->cpu.hl = BENCH_HL;
+        gb->cpu.remaining_machine_cycles = 0;
+
+        cpu_tick(gb);
+
+        cycles += gb->cpu.remaining_machine_cycles;
+    }
+
+    sink = cycles;
+}
+
+static void bench_cb_map(gb_t *gb, const micro_bench_t *bench, uint32_t ops) {
+    uint32_t cycles = 0;
+
+    gb->ram[BENCH_PC - 0xC000 + 1] = bench->opcode;
+
+    for (uint32_t i = 0; i < ops; i++) {
+        gb->cpu.pc = BENCH_PC + 1;
+        gb->cpu.hl = BENCH_HL;
+
+        cycles += cb_map(gb, 0xCB);
+    }
+
+    sink = cycles;
+}
+
+/**
+ * The line's sprites and registers, as the renderer sees them
+ */
+static void line_state(gb_t *gb, uint8_t y, gpu_line_state_t *line) {
+    gb->gpu.y_pos = y;
+    scan_oam(gb);
+
+    *line = current_line;
+}
+
+static void bench_pixel(gb_t *gb, const micro_bench_t *bench, uint32_t ops) {
+    gpu_line_state_t line;
+    line_state(gb, bench->address, &line);
+
+    uint32_t sum = 0;
+
+    for (uint32_t i = 0; i < ops; i++) {
+        sum += calculate_pixel(&line, i % DISPLAY_WIDTH, bench->address);
+    }
+
+    sink = sum;
+}
+
+static void bench_scanline(gb_t *gb, const micro_bench_t *bench, uint32_t ops) {
+    gpu_line_state_t line;
+    line_state(gb, bench->address, &line);
+
+    for (uint32_t i = 0; i < ops; i++) {
+        for (uint8_t x = 0; x < DISPLAY_WIDTH; x++) {
+            put_pixel(gb->gpu.pixel_buffer, x, bench->address, calculate_pixel(&line, x, bench->address));
+        }
+    }
+
+    sink = gb->gpu.pixel_buffer[bench->address][DISPLAY_WIDTH - 1];
+}
+
+static void bench_oam_scan(gb_t *gb, const micro_bench_t *bench, uint32_t ops) {
+    gb->gpu.y_pos = bench->address;
+
+    for (uint32_t i = 0; i < ops; i++) {
+        scan_oam(gb);
+    }
+
+    sink = gb->gpu.line_sprites[0];
+}
+
+/**
+ * Read a timer register once per machine cycle, running overflows as they come up
+ */
+static void bench_timer_read(gb_t *gb, const micro_bench_t *bench, uint32_t ops) {
+    uint32_t sum = 0;
+
+    for (uint32_t i = 0; i < ops; i++) {
+        gb->cycles += 4;
+
+        if (gb->cycles >= gb->next_event_cycle) {
+            sched_run(gb);
+        }
+
+        sum += timer_read(gb, bench->address);
+    }
+
+    sink = sum;
+}
+
+static void bench_timer_write(gb_t *gb, const micro_bench_t *bench, uint32_t ops) {
+    for (uint32_t i = 0; i < ops; i++) {
+        gb->cycles += 4;
+
+        if (gb->cycles >= gb->next_event_cycle) {
+            sched_run(gb);
+        }
+
+        timer_write(gb, bench->address, bench->address == REG_TMC ? TMC_ENABLE | (i & TMC_CLOCK_SELECT) : i);
+    }
+}
+
+/**
+ * The call made every cycle, with no transfer running
+ */
+static void bench_dma_idle(gb_t *gb, const micro_bench_t *bench, uint32_t ops) {
+    for (uint32_t i = 0; i < ops; i++) {
+        mem_dma(gb);
+    }
+}
+
+/**
+ * A whole OAM transfer, from the DMA register write to the end
+ */
+static void bench_dma_transfer(gb_t *gb, const micro_bench_t *bench, uint32_t ops) {
+    for (uint32_t i = 0; i < ops; i++) {
+        mem_write_byte(gb, REG_DMA, bench->address >> 8);
+
+        while (gb->dma_mode != DMA_MODE_NONE) {
+            mem_dma(gb);
+        }
+    }
+
+    sink = gb->oam[0];
+}
+
+static const micro_bench_t benchmarks[] = {
+    { "read rom bank 0",        bench_read,          0x0150, 0xFF, 0, 0 },
+    { "read rom bank n",        bench_read,          0x4000, 0xFF, 0, 0 },
+    { "read vram",              bench_read,          0x8000, 0xFF, 0, 0 },
+    { "read cart ram",          bench_read,          0xA000, 0xFF, 0, 0 },
+    { "read wram",              bench_read,          0xC000, 0xFF, 0, 0 },
+    { "read echo ram",          bench_read,          0xE000, 0xFF, 0, 0 },
+    { "read oam",               bench_read,          0xFE00, 0x7F, 0, 0 },
+    { "read io (LY)",           bench_read,          REG_LY, 0, 0, 0 },
+    { "read io (DIV)",          bench_read,          REG_DIV, 0, 0, 0 },
+    { "read hram",              bench_read,          0xFF80, 0x3F, 0, 0 },
+    { "write rom bank select",  bench_write,         0x2000, 0, 0, 0 },
+    { "write vram",             bench_write,         0x8000, 0xFF, 0, 0 },
+    { "write cart ram",         bench_write,         0xA000, 0xFF, 0, 0 },
+    { "write wram",             bench_write,         0xC100, 0xFF, 0, 0 },
+    { "write oam",              bench_write,         0xFE00, 0x7F, 0, 0 },
+    { "write io (BGP)",         bench_write,         REG_BGP, 0, 0, 0 },
+    { "write hram",             bench_write,         0xFF80, 0x3F, 0, 0 },
+
+    { "op nop",                 bench_instruction,   0, 0, 0x00, 0 },
+    { "op ld r,r",              bench_instruction,   0, 0, 0x41, 0 },
+    { "op ld r,n",              bench_instruction,   0, 0, 0x06, 0 },
+    { "op ld r,(hl)",           bench_instruction,   0, 0, 0x46, 0 },
+    { "op ld (hl),r",           bench_instruction,   0, 0, 0x70, 0 },
+    { "op ld rr,nn",            bench_instruction,   0, 0, 0x01, 0 },
+    { "op ldh (n),a",           bench_instruction,   0, 0, 0xE0, 0 },
+    { "op inc r",               bench_instruction,   0, 0, 0x04, 0 },
+    { "op inc rr",              bench_instruction,   0, 0, 0x03, 0 },
+    { "op add a,r",             bench_instruction,   0, 0, 0x80, 0 },
+    { "op xor a,r",             bench_instruction,   0, 0, 0xA8, 0 },
+    { "op cp n",                bench_instruction,   0, 0, 0xFE, 0 },
+    { "op add hl,rr",           bench_instruction,   0, 0, 0x09, 0 },
+    { "op jr n",                bench_instruction,   0, 0, 0x18, 0 },
+    { "op jp nn",               bench_instruction,   0, 0, 0xC3, 0 },
+    { "op call nn",             bench_instruction,   0, 0, 0xCD, 0 },
+    { "op ret",                 bench_instruction,   0, 0, 0xC9, 0 },
+    { "op push rr",             bench_instruction,   0, 0, 0xC5, 0 },
+    { "op pop rr",              bench_instruction,   0, 0, 0xC1, 0 },
+    { "op cb rlc r",            bench_instruction,   0, 0, 0x00, 1 },
+    { "op cb bit n,r",          bench_instruction,   0, 0, 0x7C, 1 },
+    { "op cb res n,(hl)",       bench_instruction,   0, 0, 0x86, 1 },
+
+    { "cb_map rlc r",           bench_cb_map,        0, 0, 0x00, 0 },
+    { "cb_map swap r",          bench_cb_map,        0, 0, 0x37, 0 },
+    { "cb_map srl (hl)",        bench_cb_map,        0, 0, 0x3E, 0 },
+    { "cb_map bit n,r",         bench_cb_map,        0, 0, 0x7C, 0 },
+    { "cb_map res n,(hl)",      bench_cb_map,        0, 0, 0x86, 0 },
+    { "cb_map set n,r",         bench_cb_map,        0, 0, 0xFF, 0 },
+
+    { "pixel, no sprites",      bench_pixel,         BENCH_EMPTY_LINE, 0, 0, 0 },
+    { "pixel, 10 sprites",      bench_pixel,         BENCH_SPRITE_LINE, 0, 0, 0 },
+    { "scanline, no sprites",   bench_scanline,      BENCH_EMPTY_LINE, 0, 0, 0 },
+    { "scanline, 10 sprites",   bench_scanline,      BENCH_SPRITE_LINE, 0, 0, 0 },
+    { "oam scan, no sprites",   bench_oam_scan,      BENCH_EMPTY_LINE, 0, 0, 0 },
+    { "oam scan, 10 sprites",   bench_oam_scan,      BENCH_SPRITE_LINE, 0, 0, 0 },
+
+    { "timer read DIV",         bench_timer_read,    REG_DIV, 0, 0, 0 },
+    { "timer read TIMA",        bench_timer_read,    REG_TIMA, 0, 0, 0 },
+    { "timer write TIMA",       bench_timer_write,   REG_TIMA, 0, 0, 0 },
+    { "timer write TMC",        bench_timer_write,   REG_TMC, 0, 0, 0 },
+
+    { "dma idle",               bench_dma_idle,      0, 0, 0, 0 },
+    { "dma transfer",           bench_dma_transfer,  0xC100, 0, 0, 0 },
+};
+
+/* MEASUREMENT */
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+/**
+ * Time a batch of operations, returning ns per operation
+ */
+static double time_batch(gb_t *gb, const micro_bench_t *bench, uint32_t ops) {
+    int64_t start = pacer_now_ns();
+    bench->fn(gb, bench, ops);
+
+    return (double)(pacer_now_ns() - start) / ops;
+}
+
+/**
+ * Warm up, then time samples of a batch size that takes at least BENCH_SAMPLE_NS
+ */
+static void run_bench(gb_t *gb, const micro_bench_t *bench, uint32_t samples, double *times) {
+    uint32_t ops = 1;
+
+    while (ops < (1 << 24) && time_batch(gb, bench, ops) * ops < BENCH_SAMPLE_NS) {
+        ops *= 2;
+    }
+
+    for (uint32_t i = 0; i < BENCH_WARMUP_SAMPLES; i++) {
+        time_batch(gb, bench, ops);
+    }
+
+    for (uint32_t i = 0; i < samples; i++) {
+        times[i] = time_batch(gb, bench, ops);
+    }
+
+    qsort(times, samples, sizeof(double), compare_double);
+
+    printf("%-24s %10.2f %10.2f %10.2f %10u\n",
+        bench->name, times[samples / 2], times[(samples * 99) / 100], times[0], ops);
+}
+
+/**
+ * Whether a benchmark is picked by the filters, any of which may match part of its name
+ */
+static int selected(const micro_bench_t *bench, char **filters, int filter_count) {
+    for (int i = 0; i < filter_count; i++) {
+        if (strstr(bench->name, filters[i])) {
+            return 1;
+        }
+    }
+
+    return filter_count == 0;
+}
+
+int main(int argc, char *argv[]) {
+    uint32_t samples = BENCH_DEFAULT_SAMPLES;
+
+    char **filters = calloc(argc, sizeof(char *));
+    int filter_count = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--samples") && i + 1 < argc) {
+            samples = strtoul(argv[++i], NULL, 10);
+        } else if (argv[i][0] != '-') {
+            filters[filter_count++] = argv[i];
+        } else {
+            printf("Usage: micro_bench [--samples <n>] [name filter...]\n");
+            return 0;
+        }
+    }
+
+    if (samples == 0) {
+        samples = 1;
+    }
+
+    gb_t *gb = synthetic_machine();
+
+    if (!gb) {
+        return 1;
+    }
+
+    double *times = malloc(sizeof(double) * samples);
+
+    printf("%-24s %10s %10s %10s %10s\n", "benchmark (ns/op)", "median", "p99", "min", "ops/sample");
+
+    for (uint32_t i = 0; i < sizeof(benchmarks) / sizeof(benchmarks[0]); i++) {
+        if (selected(&benchmarks[i], filters, filter_count)) {
+            run_bench(gb, &benchmarks[i], samples, times);
+        }
+    }
+
+    free(times);
+    free(filters);
+
+    return 0;
+}
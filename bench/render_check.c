@@ -0,0 +1,170 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <cpu.h>
+#include <gpu.h>
+#include <gb_memory.h>
+#include <joypad.h>
+#include <timer.h>
+#include <scheduler.h>
+
+// Checks the parallel renderer draws the same frames as the serial one.
+// ROMs are run with scripted input in GPU_RENDER_VERIFY mode, which hashes
+// both renderers' frame every frame and aborts at the first that differs.
+// Usage: render_check [--frames <n>] [--threads <n>] [rom...], every ROM in
+// roms/ by default
+
+#define CHECK_DEFAULT_FRAMES 1800
+#define CHECK_DEFAULT_THREADS 4
+
+static const char *default_roms[] = {
+    "roms/tetris.gb",
+    "roms/super mario land.gb",
+    "roms/dr mario.gb",
+    "roms/pokemon blue.gb",
+};
+
+// Start is pressed to get through title screens, then the pad is moved
+// around so games scroll and move sprites
+#define SCRIPT_START_INTERVAL 120
+#define SCRIPT_START_FRAMES 10
+#define SCRIPT_PLAY_FRAME 600
+#define SCRIPT_STEP_FRAMES 30
+
+static uint32_t frame_limit;
+static uint32_t frames_run;
+static uint32_t frames_drawn;
+static uint8_t last_buttons;
+
+static uint8_t script_buttons(uint32_t frame) {
+    static const uint8_t steps[] = {
+        JOYPAD_RIGHT, JOYPAD_A, JOYPAD_RIGHT, 0, JOYPAD_LEFT, JOYPAD_B, JOYPAD_DOWN, JOYPAD_START,
+    };
+
+    if (frame < SCRIPT_PLAY_FRAME) {
+        return frame % SCRIPT_START_INTERVAL >= SCRIPT_START_INTERVAL - SCRIPT_START_FRAMES ? JOYPAD_START : 0;
+    }
+
+    return steps[(frame - SCRIPT_PLAY_FRAME) / SCRIPT_STEP_FRAMES % sizeof(steps)];
+}
+
+/**
+ * Count the frame, which the gpu has already checked, and feed in the script
+ */
+static int on_frame(gb_t *gb, const uint8_t *frame, uint8_t drawn) {
+    frames_run++;
+    frames_drawn += drawn;
+
+    uint8_t buttons = script_buttons(frames_run);
+
+    if (buttons != last_buttons) {
+        joypad_submit(gb, gb->cycles, buttons);
+        last_buttons = buttons;
+    }
+
+    return frames_run < frame_limit;
+}
+
+static gb_t *power_on(const char *rom) {
+    gb_t *gb = calloc(1, sizeof(*gb));
+
+    gb->in_bios = 1;
+    gb->dma_mode = DMA_MODE_NONE;
+
+    sched_init(gb);
+    cpu_init(gb);
+    mem_init(gb);
+    gpu_init(gb);
+    joypad_init(gb);
+    timer_init(gb);
+
+    if (!mem_load_rom(gb, rom)) {
+        return NULL;
+    }
+
+    // Switch rendering over from the previous ROM's machine
+    gpu_state_loaded(gb);
+
+    return gb;
+}
+
+static void power_off(gb_t *gb) {
+    gpu_sync(gb);
+
+    free(gb->vram);
+    free(gb->ram);
+    free(gb->io_registers);
+    free(gb->hram);
+    free(gb->oam);
+    free(gb->mbc_rom);
+    free(gb->mbc_ram);
+    free(gb);
+}
+
+static void print_usage() {
+    printf("Usage: render_check [--frames <n>] [--threads <n>] [rom...]\n");
+    printf("  --frames <n>   Frames to run per ROM (default %u)\n", CHECK_DEFAULT_FRAMES);
+    printf("  --threads <n>  Render threads for the parallel renderer (default %u)\n", CHECK_DEFAULT_THREADS);
+}
+
+int main(int argc, char *argv[]) {
+    uint32_t frames = CHECK_DEFAULT_FRAMES;
+    uint8_t threads = CHECK_DEFAULT_THREADS;
+
+    size_t default_count = sizeof(default_roms) / sizeof(default_roms[0]);
+    const char **roms = calloc(argc + default_count, sizeof(char *));
+    int rom_count = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--frames") && i + 1 < argc) {
+            frames = strtoul(argv[++i], NULL, 10);
+        } else if (!strcmp(argv[i], "--threads") && i + 1 < argc) {
+            threads = atoi(argv[++i]);
+        } else if (argv[i][0] != '-') {
+            roms[rom_count++] = argv[i];
+        } else {
+            print_usage();
+            return 2;
+        }
+    }
+
+    if (frames == 0) {
+        print_usage();
+        return 2;
+    }
+
+    if (rom_count == 0) {
+        for (size_t i = 0; i < default_count; i++) {
+            roms[rom_count++] = default_roms[i];
+        }
+    }
+
+    if (!gpu_set_render_mode(GPU_RENDER_VERIFY, threads)) {
+        return 2;
+    }
+
+    gpu_set_frame_handler(on_frame);
+
+    for (int r = 0; r < rom_count; r++) {
+        gb_t *gb = power_on(roms[r]);
+
+        if (!gb) {
+            return 2;
+        }
+
+        frames_run = 0;
+        frames_drawn = 0;
+        frame_limit = frames;
+        last_buttons = 0;
+
+        gb_run(gb);
+
+        printf("%s: %u frames, %u drawn, parallel matches serial\n", roms[r], frames_run, frames_drawn);
+
+        power_off(gb);
+    }
+
+    free(roms);
+
+    return 0;
+}
@@ -0,0 +1,197 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <cpu.h>
+#include <gpu.h>
+#include <gb_memory.h>
+#include <joypad.h>
+#include <timer.h>
+#include <scheduler.h>
+#include <boot.h>
+#include <runahead.h>
+
+// Checks running ahead on a second machine runs the same frames as saving
+// and restoring the main one, with scripted input. Every frame emulated,
+// real or speculative, is compared by its picture, work RAM and cartridge
+// RAM, as what a game reads from RAM doesn't always reach the screen.
+// Usage: runahead_check [--frames <n>] [--ahead <n>] [rom], a RAM cart by default
+
+#define CHECK_DEFAULT_ROM "roms/pokemon blue.gb"
+#define CHECK_DEFAULT_FRAMES 1800
+#define CHECK_DEFAULT_AHEAD 2
+
+// Start is pressed every so often to get through title screens and menus,
+// which is where games check their cartridge RAM for a save
+#define SCRIPT_START_INTERVAL 120
+#define SCRIPT_START_FRAMES 10
+
+// Hash of each frame emulated, in order
+static uint64_t *hashes;
+static uint32_t hash_count;
+
+/**
+ * FNV-1a hash, continuing from hash
+ */
+static uint64_t hash_bytes(uint64_t hash, const uint8_t *bytes, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001B3;
+    }
+
+    return hash;
+}
+
+/**
+ * Record the frame, then stop after it as run ahead needs
+ */
+static int on_frame(gb_t *gb, const uint8_t *frame, uint8_t drawn) {
+    uint64_t hash = hash_bytes(0xCBF29CE484222325, frame, DISPLAY_HEIGHT * DISPLAY_WIDTH);
+    hash = hash_bytes(hash, gb->ram, RAM_SIZE);
+    hash = hash_bytes(hash, gb->mbc_ram, gb->mbc_ram_size);
+
+    hashes[hash_count++] = hash;
+
+    return 0;
+}
+
+static uint8_t script_buttons(uint32_t frame) {
+    return frame % SCRIPT_START_INTERVAL >= SCRIPT_START_INTERVAL - SCRIPT_START_FRAMES ? JOYPAD_START : 0;
+}
+
+static gb_t *power_on(const char *rom) {
+    gb_t *gb = calloc(1, sizeof(*gb));
+
+    gb->in_bios = 1;
+    gb->dma_mode = DMA_MODE_NONE;
+
+    sched_init(gb);
+    cpu_init(gb);
+    mem_init(gb);
+    gpu_init(gb);
+    joypad_init(gb);
+    timer_init(gb);
+
+    // Memory is left as malloc returns it, clear it so both runs start alike
+    memset(gb->vram, 0, VRAM_SIZE);
+    memset(gb->ram, 0, RAM_SIZE);
+    memset(gb->hram, 0, HIGH_SPEED_RAM_SIZE);
+    memset(gb->oam, 0, OAM_SIZE);
+
+    if (!mem_load_rom(gb, rom)) {
+        return NULL;
+    }
+
+    boot_skip_bios(gb);
+
+    // Stand in for a save file, so cartridge RAM reads see more than zeros
+    uint32_t seed = 1;
+
+    for (uint32_t i = 0; i < gb->mbc_ram_size; i++) {
+        seed = seed * 1103515245 + 12345;
+        gb->mbc_ram[i] = seed >> 16;
+    }
+
+    return gb;
+}
+
+static void power_off(gb_t *gb) {
+    free(gb->vram);
+    free(gb->ram);
+    free(gb->io_registers);
+    free(gb->hram);
+    free(gb->oam);
+    free(gb->mbc_rom);
+    free(gb->mbc_ram);
+    free(gb);
+}
+
+/**
+ * Run ahead from power on, storing the hash of each frame emulated in out.
+ * Returns 0 if the machine can't be set up
+ */
+static int run(const char *rom, uint32_t frames, uint8_t ahead, uint8_t secondary, uint64_t *out) {
+    gb_t *gb = power_on(rom);
+    runahead_t runahead;
+
+    if (!gb || !runahead_init(&runahead, gb, ahead, secondary)) {
+        return 0;
+    }
+
+    uint8_t last_buttons = 0;
+
+    hashes = out;
+    hash_count = 0;
+
+    for (uint32_t i = 0; i < frames; i++) {
+        uint8_t buttons = script_buttons(i);
+
+        if (buttons != last_buttons) {
+            joypad_submit(gb, gb->cycles, buttons);
+            last_buttons = buttons;
+        }
+
+        runahead_frame(&runahead, gb);
+    }
+
+    runahead_free(&runahead);
+    power_off(gb);
+
+    return 1;
+}
+
+static void print_usage() {
+    printf("Usage: runahead_check [--frames <n>] [--ahead <n>] [rom]\n");
+    printf("  --frames <n>  Frames to run (default %u)\n", CHECK_DEFAULT_FRAMES);
+    printf("  --ahead <n>   Frames to run ahead (default %u)\n", CHECK_DEFAULT_AHEAD);
+}
+
+int main(int argc, char *argv[]) {
+    const char *rom = CHECK_DEFAULT_ROM;
+    uint32_t frames = CHECK_DEFAULT_FRAMES;
+    uint8_t ahead = CHECK_DEFAULT_AHEAD;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--frames") && i + 1 < argc) {
+            frames = strtoul(argv[++i], NULL, 10);
+        } else if (!strcmp(argv[i], "--ahead") && i + 1 < argc) {
+            ahead = atoi(argv[++i]);
+        } else if (argv[i][0] != '-') {
+            rom = argv[i];
+        } else {
+            print_usage();
+            return 2;
+        }
+    }
+
+    gpu_set_frame_handler(on_frame);
+
+    // The real frame and those run ahead of it, per frame shown
+    uint32_t count = frames * (ahead + 1);
+    uint64_t *restored = malloc(sizeof(uint64_t) * count);
+    uint64_t *secondary = malloc(sizeof(uint64_t) * count);
+
+    if (!run(rom, frames, ahead, 0, restored) || !run(rom, frames, ahead, 1, secondary)) {
+        return 2;
+    }
+
+    int result = 0;
+
+    for (uint32_t i = 0; i < count; i++) {
+        if (restored[i] != secondary[i]) {
+            printf("Frame %u differs %s: %016llX restoring, %016llX on the second machine\n",
+                i / (ahead + 1), i % (ahead + 1) ? "running ahead" : "on the main machine",
+                (unsigned long long)restored[i], (unsigned long long)secondary[i]);
+            result = 1;
+            break;
+        }
+    }
+
+    if (!result) {
+        printf("Run ahead matches on both machines over %u frames\n", frames);
+    }
+
+    free(restored);
+    free(secondary);
+
+    return result;
+}
@@ -0,0 +1,104 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <cpu.h>
+#include <gpu.h>
+#include <gb_memory.h>
+#include <joypad.h>
+#include <timer.h>
+#include <scheduler.h>
+#include <boot.h>
+#include <state.h>
+
+// Times save + load of a state, headless. Usage: state_bench <rom> [iterations]
+
+#define BENCH_WARMUP_FRAMES 300
+#define BENCH_CHECK_FRAMES 120
+
+static uint32_t frame_limit;
+
+static int on_frame(gb_t *gb, const uint8_t *frame, uint8_t drawn) {
+    return gpu_frame_count(gb) + 1 != frame_limit;
+}
+
+/**
+ * Run until a given number of frames have been completed
+ */
+static void run_to_frame(gb_t *gb, uint32_t frame) {
+    frame_limit = frame;
+    gpu_set_frame_handler(on_frame);
+    gb_run(gb);
+}
+
+static double now_us() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+
+    return t.tv_sec * 1e6 + t.tv_nsec / 1e3;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        printf("Usage: state_bench <rom> [iterations]\n");
+        return 0;
+    }
+
+    uint32_t iterations = argc > 2 ? strtoul(argv[2], NULL, 10) : 10000;
+
+    gb_t *gb = get_gb_instance();
+
+    sched_init(gb);
+    cpu_init(gb);
+    mem_init(gb);
+    gpu_init(gb);
+    joypad_init(gb);
+    timer_init(gb);
+
+    if (!mem_load_rom(gb, argv[1])) {
+        return 1;
+    }
+
+    boot_skip_bios(gb);
+
+    run_to_frame(gb, BENCH_WARMUP_FRAMES);
+
+    size_t size = state_size(gb);
+    uint8_t *buffer = malloc(size);
+
+    // Saving then loading must not change what happens next
+    state_save(gb, buffer, size);
+    run_to_frame(gb, BENCH_WARMUP_FRAMES + BENCH_CHECK_FRAMES);
+    uint64_t expected = gpu_frame_hash(gb);
+
+    state_load(gb, buffer, size);
+    run_to_frame(gb, BENCH_WARMUP_FRAMES + BENCH_CHECK_FRAMES);
+
+    if (gpu_frame_hash(gb) != expected) {
+        printf("State did not restore: %016llX, expected %016llX\n", (unsigned long long)gpu_frame_hash(gb), (unsigned long long)expected);
+        return 1;
+    }
+
+    double save_time = 0;
+    double load_time = 0;
+
+    for (uint32_t i = 0; i < iterations; i++) {
+        double start = now_us();
+        state_save(gb, buffer, size);
+        double saved = now_us();
+        state_load(gb, buffer, size);
+        double loaded = now_us();
+
+        save_time += saved - start;
+        load_time += loaded - saved;
+    }
+
+    printf("State size: %zu bytes\n", size);
+    printf("Save: %.3f us\n", save_time / iterations);
+    printf("Load: %.3f us\n", load_time / iterations);
+    printf("Save + load: %.3f us\n", (save_time + load_time) / iterations);
+
+    free(buffer);
+
+    return 0;
+}
@@ -0,0 +1,16 @@
+#ifndef BOOT_H
+#define BOOT_H
+
+#include <stdint.h>
+#include <string.h>
+
+#include <gb.h>
+#include <gb_memory.h>
+
+/**
+ * Put the gameboy in the state the DMG boot ROM leaves it in, ready to
+ * start the cartridge at 0x0100. Must be called after the ROM is loaded
+ */
+void boot_skip_bios(gb_t *gb);
+
+#endif
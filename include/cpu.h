@@ -7,9 +7,8 @@
 
 #include <gb_memory.h>
 #include <gb.h>
-
-#define OPCODE_DEBUG 0
-#define OPCODE_BIOS_DEBUG 0
+#include <profiler.h>
+#include <trace.h>
 
 /**
  * Initialise the CPU by setting the registers to 0
@@ -22,4 +21,13 @@ void cpu_init(gb_t *gb);
  */
 void cpu_tick(gb_t *gb);
 
+#if GB_OPCODE_STATS
+
+/**
+ * Name of the handler executing an opcode, or a CB prefixed one
+ */
+const char* cpu_opcode_name(uint8_t opcode, uint8_t cb);
+
+#endif
+
 #endif
\ No newline at end of file
@@ -0,0 +1,62 @@
+#ifndef DISPLAY_H
+#define DISPLAY_H
+
+#define GL_SILENCE_DEPRECATION
+
+#include <GL/glew.h>
+#include <GLFW/glfw3.h>
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include <gpu.h>
+#include <joypad.h>
+#include <palette.h>
+#include <timeline.h>
+
+// Legacy path, glDrawPixels scaled with glPixelZoom
+#define DISPLAY_BACKEND_DRAW_PIXELS 0
+// Frames streamed through a ring of pixel buffer objects into a persistent
+// texture, drawn as a single scaled quad
+#define DISPLAY_BACKEND_TEXTURE 1
+
+#define DISPLAY_PBO_COUNT 3
+
+/**
+ * Open the window and start the present thread. Key presses are
+ * submitted as input to gb. Must be called from the main thread
+ */
+int display_init(gb_t *gb, uint8_t backend);
+
+/**
+ * Hand a completed indexed frame to the present thread. Never blocks on
+ * the swap chain; if frames are published faster than they are presented
+ * the older ones are dropped. The number labels it on the timeline
+ */
+void display_publish_frame(const uint8_t *frame, uint32_t number);
+
+/**
+ * Process window events. Returns 0 once the window has been closed.
+ * Must be called from the main thread
+ */
+int display_poll();
+
+/**
+ * Whether the rewind key (backspace) is held, as of the last poll
+ */
+int display_rewind_held();
+
+/**
+ * Whether the trace key (T) was pressed since the last call
+ */
+int display_trace_toggled();
+
+/**
+ * Stop the present thread and close the window
+ */
+void display_close();
+
+#endif
@@ -4,6 +4,9 @@
 #include <stdint.h>
 #include <stdlib.h>
 
+#include <stats.h>
+#include <opcode_stats.h>
+
 #define REG_P1 0xFF00
 
 #define REG_DIV 0xFF04
@@ -63,6 +66,28 @@
 #define DMA_MODE_TRANSFER 1
 #define DMA_MODE_NONE 2
 
+// Scheduler events
+#define SCHED_EVENT_LCD_OFF_FRAME 0
+#define SCHED_EVENT_INPUT 1
+#define SCHED_EVENT_TIMER 2
+#define SCHED_EVENT_PROFILE 3
+
+#define SCHED_EVENT_COUNT 4
+
+#define SCHED_NEVER UINT64_MAX
+
+#define DISPLAY_WIDTH 160
+#define DISPLAY_HEIGHT 144
+
+// Pending input changes, must be a power of 2
+#define INPUT_QUEUE_SIZE 64
+
+// Set of pressed buttons taking effect at a cycle
+typedef struct {
+    uint64_t cycle;
+    uint8_t buttons;
+} gb_input_event_t;
+
 // CPU core registers
 typedef struct {
     union {
@@ -96,14 +121,30 @@ typedef struct {
     uint8_t remaining_machine_cycles;
 } gb_cpu_core_t;
 
-// Struct for holding gameboy system variables
+// PPU state
 typedef struct {
-    uint8_t in_bios;
-    uint8_t ime;
+    uint32_t counter;
+    uint8_t lcd_mode;
 
-    // CPU
-    gb_cpu_core_t cpu;
-    
+    // The LCD starts off until enabled through LCDC
+    uint8_t lcd_on;
+
+    // Current x and y position being drawn
+    uint8_t x_pos;
+    uint8_t y_pos;
+
+    // Number of frames since startup
+    uint32_t frame_count;
+
+    // The indexes of the (max 10) sprites on the current line
+    uint8_t line_sprites[10];
+
+    // Shade (0-3) of each pixel to be drawn to the screen
+    uint8_t pixel_buffer[DISPLAY_HEIGHT][DISPLAY_WIDTH];
+} gb_gpu_t;
+
+// Struct for holding gameboy system variables
+typedef struct {
     // Memory
     uint8_t *rom;
     uint8_t *vram;
@@ -112,24 +153,105 @@ typedef struct {
     uint8_t *io_registers;
     uint8_t *hram;
 
-    // MBC
+    // Cartridge, fixed once loaded
+    uint8_t mbc_type;
+    uint8_t mbc_flags;
+
     uint8_t *mbc_rom;
     uint8_t *mbc_ram;
+    uint32_t mbc_rom_size;
+    uint32_t mbc_ram_size;
+
+    // Banks mapped at 0x4000 and 0xA000 (NULL while RAM is disabled).
+    // rom above is the bank mapped at 0x0000. All are recomputed on every
+    // bank switch
+    uint8_t *rom_bank;
+    uint8_t *ram_bank;
+    uint16_t ram_bank_mask;
+
+    // MBC3 clock footer in the save file
+    uint8_t *rtc_footer;
 
-    uint8_t current_rom_bank;
+    // Guest code profiler, NULL unless profiling
+    struct profiler *profiler;
+
+    // Instruction trace, NULL unless tracing
+    struct trace *trace;
+
+#if GB_STATS
+    // Host time and calls per subsystem, not part of the machine state
+    gb_stats_t stats;
+#endif
+
+#if GB_OPCODE_STATS
+    // Executions and host time per opcode, not part of the machine state
+    gb_opcode_stats_t opcode_stats;
+#endif
+
+    // Everything from here on is plain values, saved in states as one block
+    uint8_t in_bios;
+    uint8_t ime;
+
+    // CPU
+    gb_cpu_core_t cpu;
+
+    // MBC
+    uint8_t ram_enabled;
+    uint16_t current_rom_bank;
     uint8_t current_ram_bank;
 
     uint8_t rom_ram_mode;
 
+    // MBC3 clock, registers are as of rtc_base_tick and only brought up
+    // to date when latched or written
+    uint8_t rtc[5];
+    uint8_t rtc_latched[5];
+    uint8_t rtc_latch_write;
+    uint8_t rtc_host_time;
+    uint64_t rtc_base_tick;
+
     // DMA
     uint8_t dma_mode;
     uint8_t dma_cycles;
     uint16_t dma_addr;
+
+    // Joypad, pressed buttons as JOYPAD_* bits
+    uint8_t joypad_buttons;
+
+    gb_input_event_t input_queue[INPUT_QUEUE_SIZE];
+    uint8_t input_head;
+    uint8_t input_tail;
+
+    // Timing
+    uint64_t cycles;
+
+    // Instructions executed since power on
+    uint64_t instructions;
+
+    // Timer, DIV and TIMA are derived from cycles on access
+    uint64_t div_base;      // Cycle the divider was last reset
+    uint64_t tima_cycle;    // Cycle tima was last brought up to date
+    uint8_t tima;
+
+    // Scheduler
+    uint64_t next_event_cycle;
+    uint64_t event_cycles[SCHED_EVENT_COUNT];
+
+    // PPU
+    gb_gpu_t gpu;
 } gb_t;
 
+// First field of the saved block
+#define GB_STATE_START in_bios
+
 /**
  * Initialises and returns the global gb instance
  */
 gb_t* get_gb_instance();
 
+/**
+ * Run until the frame handler asks to stop
+ */
+void gb_run(gb_t *gb);
+
 #endif
\ No newline at end of file
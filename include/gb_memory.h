@@ -12,6 +12,15 @@
 
 #define TEST_BIOS 0
 
+#define VRAM_SIZE 0x2000
+#define RAM_SIZE 0x2000
+#define OAM_SIZE 0xA0
+#define IO_REGISTER_SIZE 0x80
+#define HIGH_SPEED_RAM_SIZE 0x80
+
+// Bank given to the boot ROM by mem_bank
+#define MEM_BANK_BOOT 0xFFFF
+
 typedef uint8_t mem_read_function_t(gb_t *gb, uint16_t address);
 typedef void mem_write_function_t(gb_t *gb, uint16_t address, uint8_t value);
 
@@ -46,9 +55,22 @@ uint16_t mem_read_word(gb_t *gb, uint16_t address);
 void mem_write_word(gb_t *gb, uint16_t address, uint16_t val);
 
 /**
- * Load a ROM file into the memory
+ * Read a byte without side effects: no timer or joypad updates, no clock
+ * register reads and no time charged to the memory subsystem. Cartridge
+ * RAM and I/O registers read as stored, for debugging tools
+ */
+uint8_t mem_peek_byte(gb_t *gb, uint16_t address);
+
+/**
+ * Bank mapped at an address, numbered as in symbol files: the ROM bank for
+ * cartridge ROM, the RAM bank for cartridge RAM, 0 for the rest
+ */
+uint16_t mem_bank(gb_t *gb, uint16_t address);
+
+/**
+ * Load a ROM file into the memory. Returns 0 on failure
  */
-void mem_load_rom(gb_t *gb, const char *fname);
+int mem_load_rom(gb_t *gb, const char *fname);
 
 /**
  * Compute dma
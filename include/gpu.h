@@ -1,28 +1,26 @@
 #ifndef GPU_H
 #define GPU_H
 
-#define GL_SILENCE_DEPRECATION
-
-#include <GLFW/glfw3.h>
-
 #include <string.h>
 #include <stdio.h>
 #include <time.h>
+#include <pthread.h>
 
 #include <gb.h>
 #include <cpu.h>
 #include <joypad.h>
+#include <palette.h>
 
 #define LCD_MODE_0_HBLANK 0
 #define LCD_MODE_1_VBLANK 1
 #define LCD_MODE_2_OAM 2
 #define LCD_MODE_3_TRANSFER 3
 
-#define DISPLAY_WIDTH 160
-#define DISPLAY_HEIGHT 144
-
 #define DISPLAY_SCALE 4
 
+// Length of a frame in cycles, used to pace blank frames while the LCD is off
+#define CYCLES_PER_FRAME 70224
+
 #define SPRITE_INDEX_NO_SPRITE 255
 
 #define SPRITE_YPOS(n) ((n & 0xFF) - 16)
@@ -38,8 +36,95 @@
 #define OBJ_PALETTE_0 0
 #define OBJ_PALETTE_1 1
 
+// Lines drawn pixel by pixel in step with the cpu
+#define GPU_RENDER_SERIAL 0
+// Lines snapshotted at the start of transfer and drawn on worker threads
+#define GPU_RENDER_PARALLEL 1
+// Both, checking the parallel frame hash against the serial one every frame
+#define GPU_RENDER_VERIFY 2
+
+#define GPU_MAX_RENDER_THREADS 16
+
+#define GPU_RENDER_ALL_FRAMES 0xFFFFFFFF
+
+// Called with each completed frame (shade 0-3 per pixel, top row first) and
+// whether it was drawn or skipped. Returns 0 to stop emulation at the end
+// of the current cycle, returning from gb_run
+typedef int gpu_frame_handler_t(gb_t *gb, const uint8_t *frame, uint8_t drawn);
+
 int gpu_init(gb_t *gb);
 
+/**
+ * Set the function called with each completed frame
+ */
+void gpu_set_frame_handler(gpu_frame_handler_t *handler);
+
+/**
+ * Select how lines are rendered. Must be called once, before the first tick
+ */
+int gpu_set_render_mode(uint8_t mode, uint8_t threads);
+
+/**
+ * Notify the gpu of a memory write before it is applied
+ */
+void gpu_mem_write(gb_t *gb, uint16_t address, uint8_t value);
+
+/**
+ * Finish lines in flight on the render workers, so the frame buffer holds
+ * every pixel drawn so far. Call before saving or restoring state
+ */
+void gpu_sync(gb_t *gb);
+
+/**
+ * Pick up rendering from a restored state, or switch rendering over to
+ * another instance between frames
+ */
+void gpu_state_loaded(gb_t *gb);
+
+/**
+ * Hash of the last completed frame
+ */
+uint64_t gpu_frame_hash(gb_t *gb);
+
+/**
+ * The frame buffer, one shade (0-3) per pixel, top row first.
+ * Holds a complete frame from the start of vblank. Use palette_convert
+ * to turn it into colours
+ */
+const uint8_t* gpu_get_frame(gb_t *gb);
+
+/**
+ * Number of frames since startup
+ */
+uint32_t gpu_frame_count(gb_t *gb);
+
+/**
+ * Only draw every (skip + 1)th frame. LY, STAT and interrupts keep exact
+ * timing on skipped frames, only pixel output is suppressed
+ */
+void gpu_set_frame_skip(uint32_t skip);
+
+/**
+ * Only draw a single frame, e.g. the last frame of a batch run.
+ * GPU_RENDER_ALL_FRAMES goes back to the frame skip setting
+ */
+void gpu_set_render_only_frame(gb_t *gb, uint32_t frame);
+
+/**
+ * Called by the scheduler every frame length while the LCD is off
+ */
+void gpu_lcd_off_frame(gb_t *gb);
+
+/**
+ * Update. Returns 0 once the frame handler has asked to stop
+ */
 int gpu_tick(gb_t *gb);
 
+/**
+ * Returns 0 once the frame handler has asked to stop, then clears the
+ * request. For frames ended outside gpu_tick, e.g. blank ones while the
+ * LCD is off
+ */
+int gpu_keep_running();
+
 #endif
\ No newline at end of file
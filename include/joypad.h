@@ -3,20 +3,56 @@
 
 #include <stdio.h>
 #include <stdint.h>
-#include <GLFW/glfw3.h>
 
 #include <gb.h>
 #include <gb_memory.h>
 
-#define JOYPAD_PORT_P14 0
-#define JOYPAD_PORT_P15 1
-
-void joypad_init();
-
-void key_pressed_callback(GLFWwindow* window, int key, int scancode, int action, int mods);
-
-uint8_t get_joypad_mask(uint8_t port);
-
-void joypad_update_io_registers(gb_t *gb);
-
-#endif
\ No newline at end of file
+// Direction keys, read through P14
+#define JOYPAD_RIGHT (1)
+#define JOYPAD_LEFT (1 << 1)
+#define JOYPAD_UP (1 << 2)
+#define JOYPAD_DOWN (1 << 3)
+
+// Button keys, read through P15
+#define JOYPAD_A (1 << 4)
+#define JOYPAD_B (1 << 5)
+#define JOYPAD_SELECT (1 << 6)
+#define JOYPAD_START (1 << 7)
+
+#define JOYPAD_P14_SELECT (1 << 4)
+#define JOYPAD_P15_SELECT (1 << 5)
+
+// Called with the pressed buttons each time input takes effect
+typedef void joypad_input_handler_t(gb_t *gb, uint8_t buttons);
+
+void joypad_init(gb_t *gb);
+
+/**
+ * Set a function to watch input as it is applied, e.g. to record it
+ */
+void joypad_set_input_handler(joypad_input_handler_t *handler);
+
+/**
+ * Queue a change of the pressed buttons to take effect at a cycle.
+ * Events are applied in the order submitted, and cycles already past
+ * take effect at the current cycle. Must be called from the emulation
+ * thread, e.g. from a frame handler. Returns 0 if the queue is full
+ */
+int joypad_submit(gb_t *gb, uint64_t cycle, uint8_t buttons);
+
+/**
+ * Drop queued input that hasn't taken effect yet
+ */
+void joypad_clear_queue(gb_t *gb);
+
+/**
+ * Apply queued input due by the current cycle. Scheduler event handler
+ */
+void joypad_input_event(gb_t *gb);
+
+/**
+ * Compute P1 from the selected lines and the pressed buttons
+ */
+uint8_t joypad_read_p1(gb_t *gb);
+
+#endif
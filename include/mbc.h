@@ -4,21 +4,75 @@
 #include <gb.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
-#define MBC_TYPE_MBC1 0
-#define MBC_TYPE_MBC2 1
-#define MBC_TYPE_MBC3 2
-#define MBC_TYPE_MBC5 3
+#define MBC_TYPE_NONE 0
+#define MBC_TYPE_MBC1 1
+#define MBC_TYPE_MBC2 2
+#define MBC_TYPE_MBC3 3
+#define MBC_TYPE_MBC5 4
+
+#define MBC_TYPE_COUNT 5
+
+// Cartridge features, from the type byte
+#define MBC_FLAG_RAM (1)
+#define MBC_FLAG_BATTERY (1 << 1)
+#define MBC_FLAG_RTC (1 << 2)
+#define MBC_FLAG_RUMBLE (1 << 3)
+// MBC1 multicart, bank 2 selects a 256KB game
+#define MBC_FLAG_MULTICART (1 << 4)
 
 #define MBC_ROM_MODE 0
 #define MBC_RAM_MODE 1
 
-void mbc_setup(gb_t *gb, FILE* f);
+#define MBC_ROM_BANK_SIZE 0x4000
+#define MBC_RAM_BANK_SIZE 0x2000
+
+// Largest ROM size code in the header, 32KB << 8 = 8MB
+#define MBC_MAX_ROM_SIZE_CODE 8
+#define MBC_MAX_ROM_SIZE (0x8000 << MBC_MAX_ROM_SIZE_CODE)
+
+// MBC2 has 512 half-bytes of RAM built in
+#define MBC2_RAM_SIZE 0x200
+
+// Cartridge header
+#define CART_LOGO 0x0104
+#define CART_TITLE 0x0134
+#define CART_TITLE_SIZE 16
+#define CART_LOGO_SIZE 48
+#define CART_TYPE 0x0147
+#define CART_ROM_SIZE 0x0148
+#define CART_RAM_SIZE 0x0149
+#define CART_HEADER_END 0x0150
+
+typedef void mbc_write_function_t(gb_t *gb, uint16_t address, uint8_t value);
+typedef uint8_t mbc_read_function_t(gb_t *gb, uint16_t address);
+
+/**
+ * Load the whole cartridge from f and pick the MBC handlers from its header.
+ * Returns 0 if the cartridge can't be used
+ */
+int mbc_setup(gb_t *gb, FILE* f);
+
+/**
+ * Give another machine the same cartridge. The ROM is shared, but it gets
+ * its own blank RAM, so nothing it writes reaches this machine or the save
+ * file. The banks are mapped from the next state loaded into it
+ */
+void mbc_share_cartridge(gb_t *copy, gb_t *gb);
+
+/**
+ * Recompute the mapped banks from the bank registers, e.g. after restoring state
+ */
+void mbc_update_banks(gb_t *gb);
 
-uint8_t mbc_read_rom_bank(gb_t *gb, uint16_t address);
+/**
+ * Write to an MBC control register in the ROM area
+ */
 void mbc_write_rom_bank(gb_t *gb, uint16_t address, uint8_t value);
 
 uint8_t mbc_read_ram_bank(gb_t *gb, uint16_t address);
 void mbc_write_ram_bank(gb_t *gb, uint16_t address, uint8_t value);
 
-#endif
\ No newline at end of file
+#endif
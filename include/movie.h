@@ -0,0 +1,159 @@
+#ifndef MOVIE_H
+#define MOVIE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <gb.h>
+#include <gpu.h>
+#include <mbc.h>
+
+// Movie file layout, little endian:
+//   "GBMV", version, flags, cartridge header, frame count, checkpoint interval
+//   start state size and state (if MOVIE_FLAG_STATE)
+//   event count, then per event: varint cycles since the last, buttons
+//   checkpoint count, then per checkpoint: frame, drawn, frame hash, RAM hash
+//   keyframe count, then per keyframe: frame, state size, state (version 2 on)
+#define MOVIE_MAGIC "GBMV"
+#define MOVIE_VERSION 2
+
+// Starts from the embedded state rather than power on
+#define MOVIE_FLAG_STATE (1)
+// Power on with the boot ROM skipped
+#define MOVIE_FLAG_SKIP_BIOS (1 << 1)
+
+#define MOVIE_CART_HEADER_SIZE (CART_HEADER_END - CART_TITLE)
+
+#define MOVIE_DEFAULT_CHECKPOINT_INTERVAL 60
+
+// A state every minute, so long movies can be verified in parallel segments
+#define MOVIE_DEFAULT_KEYFRAME_INTERVAL 3600
+
+// Input is queued this far ahead of the machine during playback
+#define MOVIE_INPUT_LOOKAHEAD (4 * CYCLES_PER_FRAME)
+
+#define MOVIE_MODE_NONE 0
+#define MOVIE_MODE_RECORD 1
+#define MOVIE_MODE_PLAY 2
+
+// Hashes of the machine at the end of a frame
+typedef struct {
+    uint32_t frame;
+    uint8_t drawn;
+    uint64_t frame_hash;
+    uint64_t ram_hash;
+} movie_checkpoint_t;
+
+// Whole machine state at the start of a frame, where playback can begin
+typedef struct {
+    uint32_t frame;
+    uint8_t *state;
+    uint32_t state_size;
+} movie_keyframe_t;
+
+typedef struct {
+    uint8_t mode;
+
+    uint32_t flags;
+    uint8_t cart[MOVIE_CART_HEADER_SIZE];
+
+    // Frame the movie starts and ends on
+    uint32_t start_frame;
+    uint32_t end_frame;
+
+    uint32_t checkpoint_interval;
+
+    uint8_t *state;
+    uint32_t state_size;
+
+    gb_input_event_t *events;
+    uint32_t event_count;
+    uint32_t event_capacity;
+
+    movie_checkpoint_t *checkpoints;
+    uint32_t checkpoint_count;
+    uint32_t checkpoint_capacity;
+
+    // Frames between keyframes added by movie_keyframe, 0 for none
+    uint32_t keyframe_interval;
+
+    movie_keyframe_t *keyframes;
+    uint32_t keyframe_count;
+    uint32_t keyframe_capacity;
+
+    // Recording, hashes of the latest frame
+    movie_checkpoint_t last;
+
+    // Playback position, and the first checkpoint that didn't match
+    uint32_t next_event;
+    uint32_t next_checkpoint;
+    uint32_t checked;
+    uint8_t desynced;
+    movie_checkpoint_t desync;
+} movie_t;
+
+/**
+ * Start recording from the machine as it is now. Power on is recorded as
+ * such, anything else (a loaded state, or battery RAM from a save file)
+ * is embedded as a state. Returns 0 on failure
+ */
+int movie_record(movie_t *movie, gb_t *gb, uint32_t checkpoint_interval, uint32_t keyframe_interval, uint8_t skip_bios, uint8_t power_on);
+
+/**
+ * Finish recording and write the movie. Returns 0 on failure
+ */
+int movie_save(movie_t *movie, gb_t *gb, const char *path);
+
+/**
+ * Write a movie as it stands. Returns 0 on failure
+ */
+int movie_write(const movie_t *movie, const char *path);
+
+/**
+ * Read a movie for the loaded cartridge. Returns 0 on failure
+ */
+int movie_load(movie_t *movie, gb_t *gb, const char *path);
+
+/**
+ * Start playback from the beginning of the movie (0) or from one of its
+ * keyframes (1 on). Returns 0 on failure
+ */
+int movie_start_at(movie_t *movie, gb_t *gb, uint32_t keyframe);
+
+/**
+ * Read a movie and put the machine in its start state. The cartridge
+ * must already be loaded. Returns 0 on failure
+ */
+int movie_play(movie_t *movie, gb_t *gb, const char *path);
+
+/**
+ * Call between frames. Stores a keyframe when one is due
+ */
+void movie_keyframe(movie_t *movie, gb_t *gb);
+
+/**
+ * Queue recorded input due soon. Call between frames while playing
+ */
+void movie_feed_input(movie_t *movie, gb_t *gb);
+
+/**
+ * Call from the frame handler with each completed frame. Records or
+ * checks a checkpoint when one is due
+ */
+void movie_frame(movie_t *movie, gb_t *gb, uint8_t drawn);
+
+/**
+ * Whether playback has reached the end of the movie or desynced
+ */
+int movie_finished(const movie_t *movie, gb_t *gb);
+
+/**
+ * Print whether playback matched the recording
+ */
+void movie_print_result(const movie_t *movie, FILE *f);
+
+void movie_free(movie_t *movie);
+
+#endif
@@ -0,0 +1,43 @@
+#ifndef MOVIE_VERIFY_H
+#define MOVIE_VERIFY_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <gb.h>
+#include <movie.h>
+
+// Why a segment failed
+#define MOVIE_VERIFY_PASSED 0
+#define MOVIE_VERIFY_DESYNC 1
+#define MOVIE_VERIFY_STATE 2
+#define MOVIE_VERIFY_CRASHED 3
+
+// Outcome of playing one segment, from a keyframe to the next
+typedef struct {
+    uint8_t status;
+
+    // First frame that didn't match
+    uint32_t frame;
+
+    uint32_t checked;
+
+    // Processor time, as segments may share cores
+    double seconds;
+} movie_segment_result_t;
+
+/**
+ * Check a movie by playing the stretches between its keyframes at the same
+ * time on up to jobs processes (0 for one per core). Each segment is checked
+ * against its checkpoints, and its end state against the keyframe the next
+ * one starts from. A movie without keyframes is played through once instead,
+ * storing one every keyframe_interval frames, and written back to path.
+ * The movie must be loaded and the machine freshly initialised, with the
+ * movie's frame handler installed. Returns 0 if the movie matched
+ */
+int movie_verify(movie_t *movie, gb_t *gb, const char *path, uint32_t jobs, uint32_t keyframe_interval);
+
+#endif
@@ -0,0 +1,69 @@
+#ifndef OPCODE_STATS_H
+#define OPCODE_STATS_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include <stats.h>
+
+// Instructions per timed one by default, often enough to time every opcode
+// a game uses without slowing it down much
+#define OPCODE_STATS_DEFAULT_SAMPLE 64
+
+// Execution counts per opcode and per CB prefixed opcode. When sampling,
+// every sample_interval-th instruction is also timed on the host clock, so
+// the cost of each handler can be estimated without timing them all
+typedef struct {
+    uint64_t counts[256];
+    uint64_t ticks[256];
+    uint64_t samples[256];
+
+    uint64_t cb_counts[256];
+    uint64_t cb_ticks[256];
+    uint64_t cb_samples[256];
+
+    // 0 to only count
+    uint32_t sample_interval;
+    uint32_t countdown;
+
+    // Second byte of the CB prefixed instruction being executed
+    uint8_t cb_opcode;
+} gb_opcode_stats_t;
+
+#if GB_OPCODE_STATS
+
+#define OPCODE_STATS_BEGIN(gb) uint64_t opcode_stats_start = opcode_stats_begin(&(gb)->opcode_stats)
+#define OPCODE_STATS_END(gb, opcode) opcode_stats_end(&(gb)->opcode_stats, opcode, opcode_stats_start)
+#define OPCODE_STATS_CB(gb, opcode) ((gb)->opcode_stats.cb_opcode = (opcode))
+
+/**
+ * Start counting, timing every interval-th instruction (0 to only count)
+ */
+void opcode_stats_init(gb_opcode_stats_t *stats, uint32_t sample_interval);
+
+/**
+ * Called before an instruction executes. Returns the host clock if it is
+ * to be sampled, otherwise 0
+ */
+uint64_t opcode_stats_begin(gb_opcode_stats_t *stats);
+
+/**
+ * Count an executed instruction, CB prefixed ones by their second byte
+ */
+void opcode_stats_end(gb_opcode_stats_t *stats, uint8_t opcode, uint64_t start);
+
+/**
+ * Print every executed opcode with its handler, most expensive first (most
+ * executed when not sampling)
+ */
+void opcode_stats_print(const gb_opcode_stats_t *stats, const char *rom, FILE *f);
+
+#else
+
+#define OPCODE_STATS_BEGIN(gb)
+#define OPCODE_STATS_END(gb, opcode)
+#define OPCODE_STATS_CB(gb, opcode)
+
+#endif
+
+#endif
@@ -0,0 +1,68 @@
+#ifndef PACER_H
+#define PACER_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <math.h>
+#include <time.h>
+
+// 4194304 Hz / 70224 cycles per frame
+#define PACER_FRAME_RATE 59.7275
+
+#define PACER_SPEED_MIN 0.25
+#define PACER_SPEED_UNLIMITED 0
+
+// Sleep until this close to a deadline, then spin the rest of the way
+#define PACER_SPIN_NS 1000000
+
+// Give up catching up and restart from now when this many frames behind
+#define PACER_RESYNC_FRAMES 4
+
+// Frame pacing state and frame time statistics
+typedef struct {
+    // Multiple of real hardware speed, or PACER_SPEED_UNLIMITED
+    double speed;
+    int64_t frame_ns;
+
+    int64_t next_deadline_ns;
+    int64_t last_frame_ns;
+
+    // Statistics of the time between frames
+    uint64_t frames;
+    double interval_mean_ns;
+    double interval_m2;
+    int64_t interval_min_ns;
+    int64_t interval_max_ns;
+
+    // Frames returned more than a spin margin after their deadline
+    uint64_t late_frames;
+    uint64_t resyncs;
+} pacer_t;
+
+/**
+ * Current time from the monotonic clock
+ */
+int64_t pacer_now_ns();
+
+/**
+ * Initialise a pacer and start timing from now
+ */
+void pacer_init(pacer_t *pacer, double speed);
+
+/**
+ * Change the speed multiplier, keeping the current phase
+ */
+void pacer_set_speed(pacer_t *pacer, double speed);
+
+/**
+ * Wait until the next frame is due. Deadlines are absolute so sleep
+ * overshoot doesn't accumulate as drift
+ */
+void pacer_wait_frame(pacer_t *pacer);
+
+/**
+ * Print the frame time statistics
+ */
+void pacer_print_stats(const pacer_t *pacer, FILE *f);
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef PALETTE_H
+#define PALETTE_H
+
+#include <stdint.h>
+#include <string.h>
+
+// 1 byte per pixel
+#define PALETTE_FORMAT_GREY 0
+// 3 bytes per pixel
+#define PALETTE_FORMAT_RGB 1
+// 4 bytes per pixel
+#define PALETTE_FORMAT_RGBA 2
+
+// RGBA colour for each of the 4 shades a pixel can take
+typedef struct {
+    uint8_t colours[4][4];
+} palette_t;
+
+/**
+ * The default greyscale palette, white to black
+ */
+extern const palette_t palette_grey;
+
+/**
+ * Bytes per pixel of a format
+ */
+uint8_t palette_format_size(uint8_t format);
+
+/**
+ * Convert pixels of an indexed frame (one shade 0-3 per byte) into format,
+ * through the palette
+ */
+void palette_convert(const palette_t *palette, const uint8_t *frame, uint32_t pixels, uint8_t format, uint8_t *out);
+
+#endif
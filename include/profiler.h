@@ -0,0 +1,134 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <gb.h>
+
+// Cycles between samples, about a hundred a frame
+#define PROFILE_DEFAULT_INTERVAL 1024
+
+// Deepest call stack followed, deeper calls are counted in their caller
+#define PROFILE_MAX_DEPTH 64
+
+// Lines in the hot spot report
+#define PROFILE_REPORT_LINES 20
+
+// Guest code addresses are banked, as bank << 16 | address
+#define PROFILE_LOCATION(bank, address) ((uint32_t)(bank) << 16 | (address))
+#define PROFILE_BANK(location) ((location) >> 16)
+#define PROFILE_ADDRESS(location) ((location) & 0xFFFF)
+
+// A call on the shadow stack
+typedef struct {
+    // Call tree node of the routine called
+    uint32_t node;
+
+    // Stack pointer just after the return address was pushed. A return
+    // that takes the stack pointer above it has left the routine
+    uint16_t sp;
+} profile_frame_t;
+
+// A routine called from a parent node. Node 0 is the root, outside any call
+typedef struct {
+    uint32_t parent;
+    uint32_t location;
+} profile_node_t;
+
+// Samples of one location under one call tree node
+typedef struct {
+    uint32_t node;
+    uint32_t location;
+    uint64_t count;
+} profile_sample_t;
+
+// A name from a symbol file
+typedef struct {
+    uint32_t location;
+    char *name;
+} profile_symbol_t;
+
+// Samples the guest program counter every interval cycles into a
+// histogram, optionally keeping the call stack each sample was taken in
+typedef struct profiler {
+    uint32_t interval;
+    uint8_t calls;
+
+    profile_frame_t stack[PROFILE_MAX_DEPTH];
+    uint32_t depth;
+    uint64_t too_deep;
+
+    // Call tree, with an open addressing table of node indexes by parent
+    // and location to find a node's children
+    profile_node_t *nodes;
+    uint32_t node_count;
+    uint32_t node_capacity;
+    uint32_t *node_table;
+    uint32_t node_table_size;
+
+    // Open addressing table of samples by node and location
+    profile_sample_t *samples;
+    uint32_t sample_count;
+    uint32_t sample_table_size;
+    uint64_t total;
+
+    // Sorted by location
+    profile_symbol_t *symbols;
+    uint32_t symbol_count;
+} profiler_t;
+
+#define PROFILE_CALL(gb) if ((gb)->profiler) profiler_call(gb)
+#define PROFILE_RET(gb) if ((gb)->profiler) profiler_ret(gb)
+
+/**
+ * Start sampling a machine every interval cycles, following calls if calls
+ * is set. Returns 0 on failure
+ */
+int profiler_init(profiler_t *profiler, gb_t *gb, uint32_t interval, uint8_t calls);
+
+/**
+ * Stop sampling and free everything
+ */
+void profiler_free(profiler_t *profiler, gb_t *gb);
+
+/**
+ * Load names from an RGBDS .sym file, lines of "bank:address name".
+ * Returns 0 if the file can't be read
+ */
+int profiler_load_symbols(profiler_t *profiler, const char *path);
+
+/**
+ * Scheduler event, takes a sample
+ */
+void profiler_sample_event(gb_t *gb);
+
+/**
+ * Called after a call, rst or interrupt has jumped to its routine
+ */
+void profiler_call(gb_t *gb);
+
+/**
+ * Called after a return has popped its address
+ */
+void profiler_ret(gb_t *gb);
+
+/**
+ * Keep sampling this session after a state load replaced the schedule
+ */
+void profiler_state_loaded(gb_t *gb);
+
+/**
+ * Write the samples as folded stacks, one "caller;callee;location count"
+ * line per stack, as read by flame graph tools. Returns 0 on failure
+ */
+int profiler_write_folded(profiler_t *profiler, const char *path);
+
+/**
+ * Print the locations with the most samples
+ */
+void profiler_print(profiler_t *profiler, FILE *f);
+
+#endif
@@ -0,0 +1,94 @@
+#ifndef REWIND_H
+#define REWIND_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <gb.h>
+
+#define REWIND_DEFAULT_INTERVAL 1
+
+// Most snapshots kept, whatever the budget. 30 minutes of single frames
+#define REWIND_MAX_ENTRIES (60 * 60 * 30)
+
+// Unchanged bytes needed to end a literal run in a delta
+#define REWIND_MIN_RUN 4
+
+// One compressed delta in the ring
+typedef struct {
+    uint32_t offset;
+    uint32_t size;
+
+    // Frame of the snapshot this delta turns the next one back into
+    uint32_t frame;
+} rewind_entry_t;
+
+// History of snapshots. The newest is kept whole, older ones as XOR deltas
+// against the snapshot after them, run length encoded into a byte ring
+typedef struct {
+    size_t state_size;
+    uint8_t *state;
+    uint32_t state_frame;
+    uint8_t have_state;
+
+    // New snapshot, and its encoded delta before it goes in the ring
+    uint8_t *scratch;
+    uint8_t *encoded;
+
+    uint8_t *ring;
+    size_t ring_size;
+    size_t ring_head;
+
+    // Oldest first
+    rewind_entry_t *entries;
+    uint32_t entry_first;
+    uint32_t entry_count;
+
+    uint32_t interval;
+
+    // Statistics
+    uint64_t snapshots;
+    uint64_t delta_bytes;
+    uint64_t delta_frames;
+    uint64_t ring_bytes;
+    uint64_t evictions;
+} rewind_t;
+
+/**
+ * Allocate a rewind history using budget bytes for deltas, snapshotting
+ * every interval frames. Returns 0 on failure
+ */
+int rewind_init(rewind_t *history, gb_t *gb, size_t budget, uint32_t interval);
+
+void rewind_free(rewind_t *history);
+
+/**
+ * Call between frames. Takes a snapshot when one is due
+ */
+void rewind_frame(rewind_t *history, gb_t *gb);
+
+/**
+ * Restore the newest snapshot at or before a frame, dropping everything
+ * after it. Returns 0 if the history doesn't go back that far, leaving
+ * the machine at the oldest snapshot
+ */
+int rewind_seek(rewind_t *history, gb_t *gb, uint32_t frame);
+
+/**
+ * Go back to the previous snapshot. Returns 0 at the end of the history
+ */
+int rewind_step_back(rewind_t *history, gb_t *gb);
+
+/**
+ * Oldest frame that can be reached
+ */
+uint32_t rewind_oldest_frame(const rewind_t *history);
+
+/**
+ * Print the size of the history and the bytes used per frame
+ */
+void rewind_print_stats(const rewind_t *history, FILE *f);
+
+#endif
@@ -0,0 +1,64 @@
+#ifndef RTC_H
+#define RTC_H
+
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include <gb.h>
+
+// Cycles per emulated second
+#define RTC_CLOCK_HZ 4194304
+
+// Clock registers, selected through the MBC3 RAM bank
+#define RTC_REG_S 0x08
+#define RTC_REG_M 0x09
+#define RTC_REG_H 0x0A
+#define RTC_REG_DL 0x0B
+#define RTC_REG_DH 0x0C
+
+#define RTC_DH_DAY_HIGH (1)
+#define RTC_DH_HALT (1 << 6)
+#define RTC_DH_CARRY (1 << 7)
+
+// Clock state appended to the save file: current and latched registers
+// as little endian 32-bit words, then a 64-bit unix timestamp
+#define RTC_FOOTER_SIZE 48
+
+/**
+ * Reset the clock to zero, counting emulated time
+ */
+void rtc_init(gb_t *gb);
+
+/**
+ * Count host time rather than emulated cycles from now on
+ */
+void rtc_use_host_time(gb_t *gb);
+
+/**
+ * Copy the running clock into the latched registers
+ */
+void rtc_latch(gb_t *gb);
+
+/**
+ * Read a latched clock register
+ */
+uint8_t rtc_read(gb_t *gb, uint8_t reg);
+
+/**
+ * Write a clock register
+ */
+void rtc_write(gb_t *gb, uint8_t reg, uint8_t value);
+
+/**
+ * Restore the clock from a save file footer, advancing it by the host time
+ * since it was stored. The footer is kept up to date from then on
+ */
+void rtc_load(gb_t *gb, uint8_t *footer);
+
+/**
+ * Write the clock to the save file footer
+ */
+void rtc_store(gb_t *gb);
+
+#endif
@@ -0,0 +1,71 @@
+#ifndef RUNAHEAD_H
+#define RUNAHEAD_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <gb.h>
+
+#define RUNAHEAD_MAX_FRAMES 8
+
+// Run ahead state and timing counters
+typedef struct {
+    uint8_t frames;
+
+    // Second machine the frames ahead are run on, or NULL to save and
+    // restore the main one around them
+    gb_t *ahead;
+
+    uint8_t *state;
+    size_t state_size;
+
+    // Cartridge RAM for the frames ahead when restoring, so they never
+    // write to the save file
+    uint8_t *ram;
+
+    // Set while the frames ahead run, for the frame handler to tell them
+    // from real ones
+    uint8_t running_ahead;
+
+    // The last frame run ahead to
+    uint8_t frame[DISPLAY_HEIGHT * DISPLAY_WIDTH];
+
+    // Time taken per displayed frame, at real speed
+    int64_t budget_ns;
+
+    // Totals over all frames
+    uint64_t frame_count;
+    int64_t run_ns;
+    int64_t save_ns;
+    int64_t ahead_ns;
+    int64_t restore_ns;
+    int64_t max_ns;
+    uint64_t over_budget;
+} runahead_t;
+
+/**
+ * Set up running frames ahead of the main machine, on a second machine
+ * if secondary is set. Call once the cartridge is loaded. Returns 0 on failure
+ */
+int runahead_init(runahead_t *runahead, gb_t *gb, uint8_t frames, uint8_t secondary);
+
+void runahead_free(runahead_t *runahead);
+
+/**
+ * Run one frame with the current input, then run ahead with the same
+ * input and return the speculative frame to show. The main machine is
+ * left at the end of the real frame. Only real frames are traced,
+ * profiled, counted in the stats and saved. The frame handler must stop
+ * gb_run after every frame
+ */
+const uint8_t* runahead_frame(runahead_t *runahead, gb_t *gb);
+
+/**
+ * Print where the time for each frame goes, and how often it didn't fit
+ * in a frame at real speed
+ */
+void runahead_print_stats(const runahead_t *runahead, FILE *f);
+
+#endif
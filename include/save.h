@@ -0,0 +1,33 @@
+#ifndef SAVE_H
+#define SAVE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <gb.h>
+#include <mbc.h>
+
+// How often the flush thread writes the save file back to disk
+#define SAVE_FLUSH_INTERVAL_MS 1000
+
+/**
+ * Back the cartridge RAM and clock of a battery backed cart with a memory
+ * mapped .sav file next to the ROM, and start the flush thread. Does
+ * nothing for carts without a battery. Returns 0 on failure
+ */
+int save_open(gb_t *gb, const char *rom_filename);
+
+/**
+ * Ask the flush thread to write the save file back now. Never blocks
+ */
+void save_request_flush();
+
+/**
+ * Stop the flush thread, write the save file back and unmap it
+ */
+void save_close(gb_t *gb);
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <stdint.h>
+
+#include <gb.h>
+
+typedef void sched_handler_t(gb_t *gb);
+
+/**
+ * Clear all scheduled events
+ */
+void sched_init(gb_t *gb);
+
+/**
+ * Schedule an event to run at an absolute cycle, replacing any earlier
+ * scheduling of the same event
+ */
+void sched_schedule(gb_t *gb, uint8_t event, uint64_t cycle);
+
+/**
+ * Remove an event from the schedule
+ */
+void sched_cancel(gb_t *gb, uint8_t event);
+
+/**
+ * Run all events due by the current cycle
+ */
+void sched_run(gb_t *gb);
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef STATE_H
+#define STATE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+
+#include <gb.h>
+
+// Save state layout:
+//   header: "GBST", version, section count, total size (32-bit words)
+//   then each section: tag, size, data, padded to 8 bytes
+// Sections are raw native copies of the machine's memory and the plain
+// value part of gb_t, so states only load into builds with the same
+// layout. Bump the version on any change to gb_t after GB_STATE_START.
+#define STATE_MAGIC "GBST"
+#define STATE_VERSION 3
+
+#define STATE_TAG(a, b, c, d) ((uint32_t)(a) | ((uint32_t)(b) << 8) | ((uint32_t)(c) << 16) | ((uint32_t)(d) << 24))
+
+#define STATE_TAG_CART STATE_TAG('C', 'A', 'R', 'T')   // Cartridge header, checked on load
+#define STATE_TAG_MACHINE STATE_TAG('M', 'A', 'C', 'H')
+#define STATE_TAG_VRAM STATE_TAG('V', 'R', 'A', 'M')
+#define STATE_TAG_RAM STATE_TAG('W', 'R', 'A', 'M')
+#define STATE_TAG_OAM STATE_TAG('O', 'A', 'M', ' ')
+#define STATE_TAG_IO STATE_TAG('I', 'O', ' ', ' ')
+#define STATE_TAG_HRAM STATE_TAG('H', 'R', 'A', 'M')
+#define STATE_TAG_MBC_RAM STATE_TAG('X', 'R', 'A', 'M')
+
+#define STATE_SECTION_COUNT 8
+
+#define STATE_HEADER_SIZE 16
+#define STATE_SECTION_HEADER_SIZE 8
+
+/**
+ * Size in bytes of a save state of this machine
+ */
+size_t state_size(gb_t *gb);
+
+/**
+ * Save the whole machine into a caller provided buffer. Doesn't allocate.
+ * Returns the number of bytes written, or 0 if the buffer is too small
+ */
+size_t state_save(gb_t *gb, uint8_t *buffer, size_t buffer_size);
+
+/**
+ * Restore the machine from a state. The state is checked completely
+ * before anything is changed. Returns 0 if it can't be loaded
+ */
+int state_load(gb_t *gb, const uint8_t *buffer, size_t size);
+
+int state_save_file(gb_t *gb, const char *path);
+int state_load_file(gb_t *gb, const char *path);
+
+#endif
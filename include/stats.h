@@ -0,0 +1,106 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+// Build with GB_STATS set (make STATS=1) to account host time and calls to
+// each subsystem, per frame. Otherwise the hooks compile to nothing
+#ifndef GB_STATS
+#define GB_STATS 0
+#endif
+
+// Build with GB_OPCODE_STATS set (make OPCODE_STATS=1) to count executed
+// opcodes, see opcode_stats.h
+#ifndef GB_OPCODE_STATS
+#define GB_OPCODE_STATS 0
+#endif
+
+// Subsystems time is charged to. Time in none of them, in the run loop and
+// the scheduler, or outside gb_run altogether, is STATS_OTHER
+#define STATS_OTHER 0
+#define STATS_CPU 1
+#define STATS_MEMORY 2
+#define STATS_PPU 3
+#define STATS_TIMER 4
+#define STATS_DMA 5
+#define STATS_JOYPAD 6
+// The frame handler: presenting, pacing and polling input
+#define STATS_FRONTEND 7
+
+#define STATS_SUBSYSTEM_COUNT 8
+
+// How deep subsystems can be entered from within each other, e.g. a timer
+// read from a memory read from an instruction
+#define STATS_MAX_DEPTH 8
+
+typedef struct {
+    // Host clock ticks, see stats_tick_ns
+    uint64_t ticks;
+    uint64_t calls;
+} gb_stats_counter_t;
+
+// Per instance accounting. Time is only charged to the innermost
+// subsystem, so a frame's time adds up across them
+typedef struct {
+    uint8_t active;
+    uint8_t depth;
+    uint8_t stack[STATS_MAX_DEPTH];
+
+    // When the active subsystem was last charged
+    uint64_t since;
+
+    // The frame in progress, the last complete one and all complete ones
+    gb_stats_counter_t current[STATS_SUBSYSTEM_COUNT];
+    gb_stats_counter_t last_frame[STATS_SUBSYSTEM_COUNT];
+    gb_stats_counter_t total[STATS_SUBSYSTEM_COUNT];
+
+    uint32_t frames;
+} gb_stats_t;
+
+#if GB_STATS || GB_OPCODE_STATS
+
+/**
+ * Read the host clock, in ticks of stats_tick_ns
+ */
+uint64_t stats_ticks();
+
+/**
+ * Length of a host clock tick in ns
+ */
+double stats_tick_ns();
+
+#endif
+
+#if GB_STATS
+
+#define STATS_ENTER(gb, subsystem) stats_enter(&(gb)->stats, subsystem)
+#define STATS_LEAVE(gb) stats_leave(&(gb)->stats)
+#define STATS_FRAME(gb) stats_frame(&(gb)->stats)
+
+/**
+ * Charge time to a subsystem until the matching stats_leave
+ */
+void stats_enter(gb_stats_t *stats, uint8_t subsystem);
+
+void stats_leave(gb_stats_t *stats);
+
+/**
+ * Close the frame in progress. Called as each frame completes
+ */
+void stats_frame(gb_stats_t *stats);
+
+/**
+ * Print time and calls per frame by subsystem
+ */
+void stats_print(const gb_stats_t *stats, FILE *f);
+
+#else
+
+#define STATS_ENTER(gb, subsystem)
+#define STATS_LEAVE(gb)
+#define STATS_FRAME(gb)
+
+#endif
+
+#endif
@@ -0,0 +1,108 @@
+#ifndef TIMELINE_H
+#define TIMELINE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+// Threads that can record events: the emulation and present threads and
+// the render workers
+#define TIMELINE_MAX_THREADS 20
+
+// Events buffered per thread, about a second of rendering at full speed
+#define TIMELINE_RING_SIZE (1 << 13)
+
+// How often the writer drains the buffers
+#define TIMELINE_DRAIN_INTERVAL_MS 10
+
+// Trace event process ids. Host events are timed on the monotonic clock,
+// one track per thread; emulated events on the machine's clock, a cycle
+// being 1 / 4.194304 us
+#define TIMELINE_PID_HOST 1
+#define TIMELINE_PID_EMULATED 2
+
+#define TIMELINE_CYCLES_PER_US 4.194304
+
+#define TIMELINE_SPAN 0
+#define TIMELINE_INSTANT 1
+
+// An event, kept as recorded until the writer formats it. Names are
+// string literals so only the pointer is stored
+typedef struct {
+    const char *name;
+    const char *arg_name;
+    int64_t arg;
+
+    // Nanoseconds for host events, cycles for emulated ones
+    int64_t start;
+    int64_t duration;
+
+    uint8_t type;
+    uint8_t pid;
+} timeline_event_t;
+
+// Single producer, single consumer ring owned by one thread and drained
+// by the writer. Events are dropped rather than blocking the thread when
+// it is full, so the timeline doesn't add the latency it is measuring
+typedef struct {
+    const char *name;
+    uint32_t tid;
+
+    timeline_event_t *ring;
+    atomic_uint_fast64_t head;
+    atomic_uint_fast64_t tail;
+
+    // Only touched by the owning thread
+    uint64_t dropped;
+} timeline_thread_t;
+
+/**
+ * Start writing trace events, in the Chrome JSON trace event format read
+ * by chrome://tracing and Perfetto, to path. Returns 0 on failure
+ */
+int timeline_open(const char *path);
+
+/**
+ * Give the calling thread its own event buffer and a named track.
+ * Does nothing unless a timeline is open
+ */
+void timeline_thread_start(const char *name);
+
+/**
+ * Host time to start a span at, or 0 without a timeline, so callers don't
+ * read the clock for nothing
+ */
+int64_t timeline_now();
+
+/**
+ * Record a span on the calling thread's track from start until now, with
+ * an optional named value
+ */
+void timeline_span(const char *name, int64_t start, const char *arg_name, int64_t arg);
+
+/**
+ * Record a point in host time on the calling thread's track
+ */
+void timeline_instant(const char *name, const char *arg_name, int64_t arg);
+
+/**
+ * Record a span in emulated time between two cycle counts, or a point if
+ * they are equal
+ */
+void timeline_cycles(const char *name, uint64_t start, uint64_t end, const char *arg_name, int64_t arg);
+
+/**
+ * Write everything recorded and close the file. Every thread must have
+ * stopped recording. Returns 0 if any of it failed to write
+ */
+int timeline_close();
+
+/**
+ * Print how many events were written and dropped
+ */
+void timeline_print_stats(FILE *f);
+
+#endif
@@ -4,8 +4,21 @@
 #include <gb.h>
 #include <gb_memory.h>
 
-void timer_init();
+void timer_init(gb_t *gb);
 
-void timer_tick(gb_t *gb);
+/**
+ * Read DIV or TIMA, derived from the cycle counter
+ */
+uint8_t timer_read(gb_t *gb, uint16_t address);
 
-#endif
\ No newline at end of file
+/**
+ * Write a timer register and reschedule the next overflow
+ */
+void timer_write(gb_t *gb, uint16_t address, uint8_t value);
+
+/**
+ * Reload TIMA and raise the interrupt. Scheduler event handler
+ */
+void timer_overflow_event(gb_t *gb);
+
+#endif
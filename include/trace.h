@@ -0,0 +1,93 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include <gb.h>
+
+#define TRACE_MAGIC "GBTR"
+#define TRACE_VERSION 1
+
+// Magic, version, record size and a reserved word, then the records
+#define TRACE_HEADER_SIZE 16
+
+// Records in the ring, 2 MB
+#define TRACE_RING_SIZE (1 << 16)
+
+// How long the writer sleeps once it has caught up
+#define TRACE_DRAIN_INTERVAL_MS 2
+
+// One instruction, as the machine was just before it executed. Written to
+// the file as is, so the layout is fixed
+typedef struct {
+    uint64_t cycle;
+    uint16_t pc;
+    uint16_t bank;
+    uint16_t sp;
+
+    uint8_t a, f, b, c, d, e, h, l;
+
+    // The bytes at pc, however many the instruction uses
+    uint8_t opcode[3];
+    uint8_t ime;
+
+    uint8_t reserved[6];
+} trace_record_t;
+
+// Single producer, single consumer ring. The emulation thread fills it
+// and a writer thread drains it to disk; the emulation thread only waits
+// if it gets a whole ring ahead
+typedef struct trace {
+    FILE *file;
+    trace_record_t *ring;
+
+    // Records ever added and ever written. The emulation thread keeps its
+    // last view of tail to check for space without touching the writer's
+    // cache line on every record
+    atomic_uint_fast64_t head;
+    atomic_uint_fast64_t tail;
+    uint64_t known_tail;
+
+    pthread_t thread;
+    atomic_int running;
+    atomic_int failed;
+
+    // Times the emulation thread found the ring full
+    uint64_t stalls;
+} trace_t;
+
+#define TRACE_INSTRUCTION(gb) if ((gb)->trace) trace_instruction(gb)
+
+/**
+ * Create a trace file and start its writer. Tracing starts disabled.
+ * Returns 0 on failure
+ */
+int trace_open(trace_t *trace, const char *path);
+
+/**
+ * Switch tracing of a machine on or off, at any point
+ */
+void trace_set_enabled(trace_t *trace, gb_t *gb, uint8_t enabled);
+
+/**
+ * Record the instruction about to execute. Only called while enabled
+ */
+void trace_instruction(gb_t *gb);
+
+/**
+ * Write out everything recorded, stop the writer and close the file.
+ * Returns 0 if any of it failed to write
+ */
+int trace_close(trace_t *trace, gb_t *gb);
+
+/**
+ * Print how much was traced
+ */
+void trace_print_stats(trace_t *trace, FILE *f);
+
+#endif
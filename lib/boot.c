@@ -0,0 +1,143 @@
+#include <boot.h>
+
+// Internal divider when the boot ROM hands over, DIV reads 0xAB
+#define BOOT_DIVIDER 0xABCC
+
+// Where the boot ROM draws the logo
+#define BOOT_LOGO_TILES 0x0010
+#define BOOT_LOGO_MAP 0x1904
+#define BOOT_TRADEMARK_MAP 0x1910
+
+// (R) tile, from the end of the boot ROM
+static const uint8_t boot_trademark[8] = {
+    0x3C, 0x42, 0xB9, 0xA5, 0xB9, 0xA5, 0x42, 0x3C
+};
+
+// I/O registers as left by the boot ROM
+static const struct {
+    uint16_t address;
+    uint8_t value;
+} boot_io_registers[] = {
+    { REG_P1, 0xCF },
+    { 0xFF01, 0x00 },   // SB
+    { 0xFF02, 0x7E },   // SC
+    { INTERRUPT_FLAGS, 0xE1 },
+    { 0xFF10, 0x80 },   // NR10
+    { 0xFF11, 0xBF },
+    { 0xFF12, 0xF3 },
+    { 0xFF13, 0xFF },
+    { 0xFF14, 0xBF },
+    { 0xFF16, 0x3F },   // NR21
+    { 0xFF17, 0x00 },
+    { 0xFF18, 0xFF },
+    { 0xFF19, 0xBF },
+    { 0xFF1A, 0x7F },   // NR30
+    { 0xFF1B, 0xFF },
+    { 0xFF1C, 0x9F },
+    { 0xFF1D, 0xFF },
+    { 0xFF1E, 0xBF },
+    { 0xFF20, 0xFF },   // NR41
+    { 0xFF21, 0x00 },
+    { 0xFF22, 0x00 },
+    { 0xFF23, 0xBF },
+    { 0xFF24, 0x77 },   // NR50
+    { 0xFF25, 0xF3 },
+    { 0xFF26, 0xF1 },
+    { REG_STAT, 0x84 }, // Mode bits set when the LCD turns on
+    { REG_SCY, 0x00 },
+    { REG_SCX, 0x00 },
+    { REG_LY, 0x00 },
+    { REG_LYC, 0x00 },
+    { REG_DMA, 0xFF },
+    { REG_BGP, 0xFC },
+    { REG_OBP0, 0xFF },
+    { REG_OBP1, 0xFF },
+    { REG_WY, 0x00 },
+    { REG_WX, 0x00 },
+    { 0xFF50, 0x01 },   // Boot ROM disabled
+};
+
+/**
+ * Double each bit of a nibble into a byte
+ */
+static uint8_t boot_double_nibble(uint8_t nibble) {
+    uint8_t out = 0;
+
+    for (uint8_t i = 0; i < 4; i++) {
+        if (nibble & (1 << i)) {
+            out |= 3 << (i * 2);
+        }
+    }
+
+    return out;
+}
+
+/**
+ * Draw the cartridge logo the way the boot ROM does, scaled up 2x
+ */
+static void boot_draw_logo(gb_t *gb) {
+    uint8_t *tiles = gb->vram + BOOT_LOGO_TILES;
+
+    // Each logo byte is two 4x4 blocks, each becoming 2 rows of a tile.
+    // Only the low plane is written
+    for (uint8_t i = 0; i < CART_LOGO_SIZE; i++) {
+        uint8_t logo = gb->rom[CART_LOGO + i];
+
+        tiles[0] = tiles[2] = boot_double_nibble(logo >> 4);
+        tiles[4] = tiles[6] = boot_double_nibble(logo & 0xF);
+
+        tiles += 8;
+    }
+
+    for (uint8_t i = 0; i < 8; i++) {
+        tiles[i * 2] = boot_trademark[i];
+    }
+
+    // Tiles 1-12 on one row and 13-24 on the next, the (R) after them
+    for (uint8_t i = 0; i < 12; i++) {
+        gb->vram[BOOT_LOGO_MAP + i] = i + 1;
+        gb->vram[BOOT_LOGO_MAP + 0x20 + i] = i + 13;
+    }
+
+    gb->vram[BOOT_TRADEMARK_MAP] = 0x19;
+}
+
+void boot_skip_bios(gb_t *gb) {
+    gb->cpu.a = 0x01;
+    gb->cpu.f = 0xB0;
+    gb->cpu.b = 0x00;
+    gb->cpu.c = 0x13;
+    gb->cpu.d = 0x00;
+    gb->cpu.e = 0xD8;
+    gb->cpu.h = 0x01;
+    gb->cpu.l = 0x4D;
+
+    gb->cpu.sp = 0xFFFE;
+    gb->cpu.pc = 0x0100;
+
+    gb->cpu.remaining_machine_cycles = 0;
+
+    gb->ime = 0;
+
+    memset(gb->vram, 0, VRAM_SIZE);
+    boot_draw_logo(gb);
+
+    for (uint8_t i = 0; i < sizeof(boot_io_registers) / sizeof(boot_io_registers[0]); i++) {
+        gb->io_registers[boot_io_registers[i].address & 0xFF] = boot_io_registers[i].value;
+    }
+
+    gb->hram[INTERRUPT_ENABLE - 0xFF80] = 0x00;
+
+    mem_remove_bios(gb);
+
+    // Timer phase. Modular arithmetic keeps this valid at cycle 0
+    gb->div_base = gb->cycles - BOOT_DIVIDER;
+    gb->tima_cycle = gb->cycles;
+    gb->tima = 0;
+    gb->io_registers[REG_TMA & 0xFF] = 0x00;
+    gb->io_registers[REG_TMC & 0xFF] = 0xF8;
+
+    // Start the ppu at the top of the frame. Goes through the memory map so
+    // the gpu sees the LCD turning on
+    mem_write_byte(gb, REG_LCDC, 0x91);
+}
@@ -85,13 +85,6 @@ static uint8_t cpu_read_program(gb_t *gb) {
  * Retrieve unsigned 8-bit immediate argument
  */
 uint8_t cpu_read_n(gb_t *gb) {
-    #if OPCODE_DEBUG
-        #if !OPCODE_BIOS_DEBUG
-            if (!gb->in_bios)
-        #endif
-        printf("\t%X", mem_read_byte(gb, gb->cpu.pc));
-    #endif
-
     return cpu_read_program(gb);
 }
 
@@ -99,13 +92,6 @@ uint8_t cpu_read_n(gb_t *gb) {
  * Retrieve signed 8-bit immediate argument
  */
 int8_t cpu_read_e(gb_t *gb) {
-    #if OPCODE_DEBUG
-        #if !OPCODE_BIOS_DEBUG
-            if (!gb->in_bios)
-        #endif
-        printf("\t%X", mem_read_byte(gb, gb->cpu.pc));
-    #endif
-
     return (int8_t)cpu_read_program(gb);
 }
 
@@ -113,13 +99,6 @@ int8_t cpu_read_e(gb_t *gb) {
  * Retrieve unsigned 16-bit immediate argument
  */
 uint16_t cpu_read_nn(gb_t *gb) {
-    #if OPCODE_DEBUG
-        #if !OPCODE_BIOS_DEBUG
-            if (!gb->in_bios)
-        #endif
-        printf("\t%X", mem_read_word(gb, gb->cpu.pc));
-    #endif
-    
     uint16_t arg = mem_read_word(gb, gb->cpu.pc);
     gb->cpu.pc += 2;
 
@@ -1807,6 +1786,8 @@ static uint8_t call(gb_t *gb, uint8_t opcode) {
     mem_write_word(gb, gb->cpu.sp, gb->cpu.pc);
 
     gb->cpu.pc = nn;
+    PROFILE_CALL(gb);
+
     return 6;
 }
 
@@ -1824,6 +1805,7 @@ static uint8_t callif(gb_t *gb, uint8_t opcode) {
         mem_write_word(gb, gb->cpu.sp, gb->cpu.pc);
 
         gb->cpu.pc = nn;
+        PROFILE_CALL(gb);
     }
 
     return cc ? 6 : 3;
@@ -1837,6 +1819,7 @@ static uint8_t callif(gb_t *gb, uint8_t opcode) {
 static uint8_t ret(gb_t *gb, uint8_t opcode) {
     gb->cpu.pc = mem_read_word(gb, gb->cpu.sp);
     gb->cpu.sp += 2;
+    PROFILE_RET(gb);
 
     return 4;
 }
@@ -1852,6 +1835,7 @@ static uint8_t retif(gb_t *gb, uint8_t opcode) {
     if (cc) {
         gb->cpu.pc = mem_read_word(gb, gb->cpu.sp);
         gb->cpu.sp += 2;
+        PROFILE_RET(gb);
     }
 
     return cc ? 5 : 2;
@@ -1865,6 +1849,7 @@ static uint8_t retif(gb_t *gb, uint8_t opcode) {
 static uint8_t reti(gb_t *gb, uint8_t opcode) {
     gb->cpu.pc = mem_read_word(gb, gb->cpu.sp);
     gb->cpu.sp += 2;
+    PROFILE_RET(gb);
 
     gb->ime = 1;
 
@@ -1883,6 +1868,7 @@ static uint8_t rst(gb_t *gb, uint8_t opcode) {
     mem_write_word(gb, gb->cpu.sp, gb->cpu.pc);
 
     gb->cpu.pc = ((n & 0b110) << 3) | ((n & 1) << 3);
+    PROFILE_CALL(gb);
 
     return 4;
 }
@@ -1893,13 +1879,8 @@ static uint8_t rst(gb_t *gb, uint8_t opcode) {
 static uint8_t cb_map(gb_t *gb, uint8_t opcode) {
     uint8_t new_opcode = cpu_read_program(gb);
 
-    #if OPCODE_DEBUG
-        #if !OPCODE_BIOS_DEBUG
-            if (!gb->in_bios)
-        #endif
-        printf("%X\t", new_opcode);
-    #endif
-    
+    OPCODE_STATS_CB(gb, new_opcode);
+
     switch (new_opcode >> 3) {
         case 0:
             return ((new_opcode & 0xF) == 0xE) || ((new_opcode & 0xF) == 0x6) ? rlc_mhl(gb, new_opcode) : rlc_r(gb, new_opcode);
@@ -1967,6 +1948,54 @@ static cpu_instruction_t* const cpu_opcode_table[] = {
 /* 0xF- */  ldh_a_mn,   pop_rr,     ldh_a_mc,   di,         no_opcode,  push_rr,    or_a_n,     rst,        ld_hl_spe,  ld_sp_hl,   ld_a_mnn,   ei,         no_opcode,  no_opcode,  cp_a_n,     rst,
 };
 
+#if GB_OPCODE_STATS
+
+// Handler names for the opcode stats, laid out as cpu_opcode_table
+static const char* const cpu_opcode_names[] = {
+/* 0x0- */  "nop",        "ld_rr_nn",   "ld_mbc_a",   "inc_rr",     "inc_r",      "dec_r",      "ld_r_n",     "rlca",       "ld_mnn_sp",  "add_hl_rr",  "ld_a_mbc",   "dec_rr",     "inc_r",      "dec_r",      "ld_r_n",     "rrca",
+/* 0x1- */  "stop",       "ld_rr_nn",   "ld_mde_a",   "inc_rr",     "inc_r",      "dec_r",      "ld_r_n",     "rla",        "jr",         "add_hl_rr",  "ld_a_mde",   "dec_rr",     "inc_r",      "dec_r",      "ld_r_n",     "rra",
+/* 0x2- */  "jrif",       "ld_rr_nn",   "ldi_mhl_a",  "inc_rr",     "inc_r",      "dec_r",      "ld_r_n",     "daa",        "jrif",       "add_hl_rr",  "ldi_a_mhl",  "dec_rr",     "inc_r",      "dec_r",      "ld_r_n",     "cpl",
+/* 0x3- */  "jrif",       "ld_rr_nn",   "ldd_mhl_a",  "inc_rr",     "inc_mhl",    "dec_mhl",    "ld_mhl_n",   "scf",        "jrif",       "add_hl_rr",  "ldd_a_mhl",  "dec_rr",     "inc_r",      "dec_r",      "ld_r_n",     "ccf",
+/* 0x4- */  "ld_r_r",     "ld_r_r",     "ld_r_r",     "ld_r_r",     "ld_r_r",     "ld_r_r",     "ld_r_mhl",   "ld_r_r",     "ld_r_r",     "ld_r_r",     "ld_r_r",     "ld_r_r",     "ld_r_r",     "ld_r_r",     "ld_r_mhl",   "ld_r_r",
+/* 0x5- */  "ld_r_r",     "ld_r_r",     "ld_r_r",     "ld_r_r",     "ld_r_r",     "ld_r_r",     "ld_r_mhl",   "ld_r_r",     "ld_r_r",     "ld_r_r",     "ld_r_r",     "ld_r_r",     "ld_r_r",     "ld_r_r",     "ld_r_mhl",   "ld_r_r",
+/* 0x6- */  "ld_r_r",     "ld_r_r",     "ld_r_r",     "ld_r_r",     "ld_r_r",     "ld_r_r",     "ld_r_mhl",   "ld_r_r",     "ld_r_r",     "ld_r_r",     "ld_r_r",     "ld_r_r",     "ld_r_r",     "ld_r_r",     "ld_r_mhl",   "ld_r_r",
+/* 0x7- */  "ld_mhl_r",   "ld_mhl_r",   "ld_mhl_r",   "ld_mhl_r",   "ld_mhl_r",   "ld_mhl_r",   "halt",       "ld_mhl_r",   "ld_r_r",     "ld_r_r",     "ld_r_r",     "ld_r_r",     "ld_r_r",     "ld_r_r",     "ld_r_mhl",   "ld_r_r",
+/* 0x8- */  "add_a_r",    "add_a_r",    "add_a_r",    "add_a_r",    "add_a_r",    "add_a_r",    "add_a_mhl",  "add_a_r",    "adc_a_r",    "adc_a_r",    "adc_a_r",    "adc_a_r",    "adc_a_r",    "adc_a_r",    "adc_a_mhl",  "adc_a_r",
+/* 0x9- */  "sub_a_r",    "sub_a_r",    "sub_a_r",    "sub_a_r",    "sub_a_r",    "sub_a_r",    "sub_a_mhl",  "sub_a_r",    "sbc_a_r",    "sbc_a_r",    "sbc_a_r",    "sbc_a_r",    "sbc_a_r",    "sbc_a_r",    "sbc_a_mhl",  "sbc_a_r",
+/* 0xA- */  "and_a_r",    "and_a_r",    "and_a_r",    "and_a_r",    "and_a_r",    "and_a_r",    "and_a_mhl",  "and_a_r",    "xor_a_r",    "xor_a_r",    "xor_a_r",    "xor_a_r",    "xor_a_r",    "xor_a_r",    "xor_a_mhl",  "xor_a_r",
+/* 0xB- */  "or_a_r",     "or_a_r",     "or_a_r",     "or_a_r",     "or_a_r",     "or_a_r",     "or_a_mhl",   "or_a_r",     "cp_a_r",     "cp_a_r",     "cp_a_r",     "cp_a_r",     "cp_a_r",     "cp_a_r",     "cp_a_mhl",   "cp_a_r",
+/* 0xC- */  "retif",      "pop_rr",     "jpif_nn",    "jp_nn",      "callif",     "push_rr",    "add_a_n",    "rst",        "retif",      "ret",        "jpif_nn",    "cb_map",     "callif",     "call",       "adc_a_n",    "rst",
+/* 0xD- */  "retif",      "pop_rr",     "jpif_nn",    "no_opcode",  "callif",     "push_rr",    "sub_a_n",    "rst",        "retif",      "reti",       "jpif_nn",    "no_opcode",  "callif",     "no_opcode",  "sbc_a_n",    "rst",
+/* 0xE- */  "ldh_mn_a",   "pop_rr",     "ldh_mc_a",   "no_opcode",  "no_opcode",  "push_rr",    "and_a_n",    "rst",        "add_sp_e",   "jp_hl",      "ld_mnn_a",   "no_opcode",  "no_opcode",  "no_opcode",  "xor_a_n",    "rst",
+/* 0xF- */  "ldh_a_mn",   "pop_rr",     "ldh_a_mc",   "di",         "no_opcode",  "push_rr",    "or_a_n",     "rst",        "ld_hl_spe",  "ld_sp_hl",   "ld_a_mnn",   "ei",         "no_opcode",  "no_opcode",  "cp_a_n",     "rst",
+};
+
+// Shift and rotate handlers of the CB prefixed opcodes below 0x40, 8 each
+static const char* const cpu_cb_shift_names[] = {
+    "rlc", "rrc", "rl", "rr", "sla", "sra", "swap", "srl",
+};
+
+// Bit handlers from 0x40, 64 each
+static const char* const cpu_cb_bit_names[] = {
+    "bit_n", "res_n", "set_n",
+};
+
+const char* cpu_opcode_name(uint8_t opcode, uint8_t cb) {
+    static char name[16];
+
+    if (!cb) {
+        return cpu_opcode_names[opcode];
+    }
+
+    // Same split as cb_map, (hl) operands have their own handlers
+    const char *operation = opcode < 0x40 ? cpu_cb_shift_names[opcode >> 3] : cpu_cb_bit_names[(opcode >> 6) - 1];
+    snprintf(name, sizeof(name), "%s_%s", operation, OPCODE_PARAM_LOW(opcode) == 0b110 ? "mhl" : "r");
+
+    return name;
+}
+
+#endif
+
 #define INTERRUPT_VBLANK 0x0040
 #define INTERRUPT_LCD_STATUS 0x0048
 #define INTERRUPT_TIMER 0x0050
@@ -1983,6 +2012,7 @@ uint8_t call_interrupt(gb_t *gb, uint16_t addr) {
     mem_write_word(gb, gb->cpu.sp, gb->cpu.pc);
 
     gb->cpu.pc = addr;
+    PROFILE_CALL(gb);
 
     // 3 machine cycles
     return 3;
@@ -2017,26 +2047,18 @@ void cpu_tick(gb_t *gb) {
     if (gb->cpu.remaining_machine_cycles == 0) {
         // Ready for next instruction
         // Otherwise, theoretically doing a previous instruction, so wait
+        STATS_ENTER(gb, STATS_CPU);
+
+        TRACE_INSTRUCTION(gb);
 
         // Opcode
         uint8_t opcode = cpu_read_program(gb);
 
-        #if OPCODE_DEBUG
-            #if !OPCODE_BIOS_DEBUG
-                if (!gb->in_bios)
-            #endif
-            printf("%04X\t%X", gb->cpu.pc - 1, opcode);
-        #endif
-
         // Execute
+        OPCODE_STATS_BEGIN(gb);
         gb->cpu.remaining_machine_cycles += cpu_opcode_table[opcode](gb, opcode);
-
-        #if OPCODE_DEBUG
-            #if !OPCODE_BIOS_DEBUG
-                if (!gb->in_bios)
-            #endif
-            printf("\n");
-        #endif
+        OPCODE_STATS_END(gb, opcode);
+        gb->instructions++;
 
         // Check for interrupts
         if (gb->ime) {
@@ -2086,6 +2108,8 @@ void cpu_tick(gb_t *gb) {
             printf("Z: %i\tN: %i\tH: %i\tC: %i\n", gb->cpu.flag_z, gb->cpu.flag_n, gb->cpu.flag_h, gb->cpu.flag_c);
             abort();
         }
+
+        STATS_LEAVE(gb);
     }
 
     gb->cpu.remaining_machine_cycles--;
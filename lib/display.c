@@ -0,0 +1,363 @@
+#include <display.h>
+
+// Set on a frame index in ready_frame when it has not been presented yet
+#define FRAME_NEW (1 << 2)
+#define FRAME_INDEX 0b11
+
+static GLFWwindow *window;
+
+// Instance receiving key presses, and the buttons currently held
+static gb_t *input_gb;
+static uint8_t held_buttons = 0;
+
+// Whether the rewind key is held
+static uint8_t rewind_held = 0;
+
+// Whether the trace key was pressed since the last check
+static uint8_t trace_toggled = 0;
+
+static uint8_t display_backend;
+
+static pthread_t present_thread;
+static atomic_int present_running;
+
+// Framebuffer size, queried on the main thread for the present thread
+static atomic_int framebuffer_width;
+static atomic_int framebuffer_height;
+
+// Triple buffer of completed frames. The emulation thread owns write_frame,
+// the present thread owns read_frame, and the third is swapped through
+// ready_frame
+static uint8_t frames[3][DISPLAY_HEIGHT * DISPLAY_WIDTH];
+static uint32_t frame_numbers[3];
+static uint8_t write_frame = 0;
+static atomic_uint ready_frame = 1;
+static uint8_t read_frame = 2;
+
+// Only used to sleep the present thread while there is nothing to show
+static pthread_mutex_t present_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t present_cond = PTHREAD_COND_INITIALIZER;
+
+// Frame converted through the palette for drawing
+static GLubyte rgba_buffer[DISPLAY_HEIGHT][DISPLAY_WIDTH][4];
+
+// Texture backend objects
+static GLuint frame_texture;
+static GLuint frame_pbos[DISPLAY_PBO_COUNT];
+static uint8_t frame_pbo_index = 0;
+
+/**
+ * Show the drawn frame, blocking on vsync
+ */
+static void swap_buffers() {
+    int64_t start = timeline_now();
+
+    glfwSwapBuffers(window);
+
+    timeline_span("swap", start, NULL, 0);
+}
+
+/**
+ * Create the texture and pixel buffer ring. Returns 0 if the context
+ * can't stream through pixel buffer objects
+ */
+static int texture_init() {
+    if (glewInit() != GLEW_OK || !GLEW_VERSION_2_1) {
+        printf("Pixel buffer objects not supported, falling back to glDrawPixels\n");
+        return 0;
+    }
+
+    glGenTextures(1, &frame_texture);
+    glBindTexture(GL_TEXTURE_2D, frame_texture);
+
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, DISPLAY_WIDTH, DISPLAY_HEIGHT, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+
+    glGenBuffers(DISPLAY_PBO_COUNT, frame_pbos);
+
+    for (uint8_t i = 0; i < DISPLAY_PBO_COUNT; i++) {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, frame_pbos[i]);
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, sizeof(rgba_buffer), NULL, GL_STREAM_DRAW);
+    }
+
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    glEnable(GL_TEXTURE_2D);
+
+    return 1;
+}
+
+/**
+ * Draw a frame to the window by streaming it into the texture
+ */
+static void present_frame_texture(const uint8_t *frame) {
+    int width = atomic_load(&framebuffer_width);
+    int height = atomic_load(&framebuffer_height);
+
+    // Fill the next buffer in the ring while earlier uploads may still be in flight
+    frame_pbo_index = (frame_pbo_index + 1) % DISPLAY_PBO_COUNT;
+
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, frame_pbos[frame_pbo_index]);
+
+    // Orphan the old storage so mapping never waits for the driver to finish with it
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, sizeof(rgba_buffer), NULL, GL_STREAM_DRAW);
+
+    GLubyte *pixels = glMapBuffer(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY);
+
+    if (pixels) {
+        // Convert straight into driver memory
+        palette_convert(&palette_grey, frame, DISPLAY_WIDTH * DISPLAY_HEIGHT, PALETTE_FORMAT_RGBA, pixels);
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    }
+
+    // Upload from the bound pixel buffer, offset 0
+    glBindTexture(GL_TEXTURE_2D, frame_texture);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, DISPLAY_WIDTH, DISPLAY_HEIGHT, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    glViewport(0, 0, width, height);
+    glClear(GL_COLOR_BUFFER_BIT);
+
+    // Texture row 0 is the top of the frame
+    glBegin(GL_QUADS);
+    glTexCoord2f(0, 0);
+    glVertex2f(-1, 1);
+    glTexCoord2f(1, 0);
+    glVertex2f(1, 1);
+    glTexCoord2f(1, 1);
+    glVertex2f(1, -1);
+    glTexCoord2f(0, 1);
+    glVertex2f(-1, -1);
+    glEnd();
+
+    swap_buffers();
+}
+
+/**
+ * Draw a frame to the window with glDrawPixels
+ */
+static void present_frame_draw_pixels(const uint8_t *frame) {
+    int width = atomic_load(&framebuffer_width);
+    int height = atomic_load(&framebuffer_height);
+
+    glViewport(0, 0, width, height);
+    glClear(GL_COLOR_BUFFER_BIT);
+
+    palette_convert(&palette_grey, frame, DISPLAY_WIDTH * DISPLAY_HEIGHT, PALETTE_FORMAT_RGBA, &rgba_buffer[0][0][0]);
+
+    // Frames are stored top row first, so draw downwards from the top left
+    glRasterPos2f(-1, 1);
+    glPixelZoom((GLfloat)width / (GLfloat)DISPLAY_WIDTH, -(GLfloat)height / (GLfloat)DISPLAY_HEIGHT);
+
+    glDrawPixels(DISPLAY_WIDTH, DISPLAY_HEIGHT, GL_RGBA, GL_UNSIGNED_BYTE, rgba_buffer);
+
+    swap_buffers();
+}
+
+/**
+ * Present thread. Owns the GL context and is the only thread to block on vsync
+ */
+static void* present_loop(void *arg) {
+    timeline_thread_start("present");
+
+    glfwMakeContextCurrent(window);
+    glfwSwapInterval(1);
+
+    glClearColor(1.0, 1.0, 1.0, 1.0);
+    glShadeModel(GL_FLAT);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+    if (display_backend == DISPLAY_BACKEND_TEXTURE && !texture_init()) {
+        display_backend = DISPLAY_BACKEND_DRAW_PIXELS;
+    }
+
+    while (atomic_load(&present_running)) {
+        pthread_mutex_lock(&present_lock);
+
+        while (!(atomic_load(&ready_frame) & FRAME_NEW) && atomic_load(&present_running)) {
+            pthread_cond_wait(&present_cond, &present_lock);
+        }
+
+        pthread_mutex_unlock(&present_lock);
+
+        if (!atomic_load(&present_running)) {
+            break;
+        }
+
+        // Take the newest frame, leaving the old one to be written
+        read_frame = atomic_exchange(&ready_frame, read_frame) & FRAME_INDEX;
+
+        int64_t start = timeline_now();
+
+        if (display_backend == DISPLAY_BACKEND_TEXTURE) {
+            present_frame_texture(frames[read_frame]);
+        } else {
+            present_frame_draw_pixels(frames[read_frame]);
+        }
+
+        timeline_span("present", start, "frame", frame_numbers[read_frame]);
+    }
+
+    glfwMakeContextCurrent(NULL);
+
+    return NULL;
+}
+
+/**
+ * Map a key to the joypad buttons
+ */
+static uint8_t key_button(int key) {
+    switch (key) {
+        case GLFW_KEY_UP:
+            return JOYPAD_UP;
+
+        case GLFW_KEY_DOWN:
+            return JOYPAD_DOWN;
+
+        case GLFW_KEY_LEFT:
+            return JOYPAD_LEFT;
+
+        case GLFW_KEY_RIGHT:
+            return JOYPAD_RIGHT;
+
+        case GLFW_KEY_A:
+            return JOYPAD_A;
+
+        case GLFW_KEY_B:
+            return JOYPAD_B;
+
+        case GLFW_KEY_ENTER:
+            return JOYPAD_START;
+
+        case GLFW_KEY_RIGHT_SHIFT:
+            return JOYPAD_SELECT;
+
+        default:
+            return 0;
+    }
+}
+
+/**
+ * Submit key changes as input at the current cycle. Called from
+ * glfwPollEvents, so on the emulation thread
+ */
+static void key_callback(GLFWwindow *window, int key, int scancode, int action, int mods) {
+    if (key == GLFW_KEY_BACKSPACE && action != GLFW_REPEAT) {
+        rewind_held = action == GLFW_PRESS;
+        return;
+    }
+
+    if (key == GLFW_KEY_T) {
+        trace_toggled |= action == GLFW_PRESS;
+        return;
+    }
+
+    uint8_t button = key_button(key);
+
+    if (!button || action == GLFW_REPEAT) {
+        return;
+    }
+
+    if (action == GLFW_PRESS) {
+        held_buttons |= button;
+    } else {
+        held_buttons &= ~button;
+    }
+
+    joypad_submit(input_gb, input_gb->cycles, held_buttons);
+
+    timeline_instant("input", "buttons", held_buttons);
+    timeline_cycles("input", input_gb->cycles, input_gb->cycles, "buttons", held_buttons);
+}
+
+int display_init(gb_t *gb, uint8_t backend) {
+    display_backend = backend;
+    input_gb = gb;
+
+    if (!glfwInit()) {
+        printf("Failed to init GLFW\n");
+        return 0;
+    }
+
+    glfwWindowHint(GLFW_RESIZABLE, GL_FALSE);
+
+    window = glfwCreateWindow(DISPLAY_WIDTH * DISPLAY_SCALE, DISPLAY_HEIGHT * DISPLAY_SCALE, "gbemu", NULL, NULL);
+
+    if (!window) {
+        printf("Failed to open window\n");
+        return 0;
+    }
+
+    glfwSetKeyCallback(window, key_callback);
+
+    int width, height;
+    glfwGetFramebufferSize(window, &width, &height);
+
+    atomic_store(&framebuffer_width, width);
+    atomic_store(&framebuffer_height, height);
+
+    // Blank until the first frame arrives
+    memset(frames, 0, sizeof(frames));
+
+    atomic_store(&present_running, 1);
+
+    if (pthread_create(&present_thread, NULL, present_loop, NULL)) {
+        printf("Failed to start present thread\n");
+        return 0;
+    }
+
+    return 1;
+}
+
+void display_publish_frame(const uint8_t *frame, uint32_t number) {
+    memcpy(frames[write_frame], frame, sizeof(frames[0]));
+    frame_numbers[write_frame] = number;
+
+    // Swap the finished frame in as ready, taking back whichever buffer was there
+    write_frame = atomic_exchange(&ready_frame, write_frame | FRAME_NEW) & FRAME_INDEX;
+
+    pthread_mutex_lock(&present_lock);
+    pthread_cond_signal(&present_cond);
+    pthread_mutex_unlock(&present_lock);
+}
+
+int display_poll() {
+    int width, height;
+
+    glfwPollEvents();
+
+    glfwGetFramebufferSize(window, &width, &height);
+
+    atomic_store(&framebuffer_width, width);
+    atomic_store(&framebuffer_height, height);
+
+    return !glfwWindowShouldClose(window);
+}
+
+int display_rewind_held() {
+    return rewind_held;
+}
+
+int display_trace_toggled() {
+    uint8_t toggled = trace_toggled;
+    trace_toggled = 0;
+
+    return toggled;
+}
+
+void display_close() {
+    pthread_mutex_lock(&present_lock);
+    atomic_store(&present_running, 0);
+    pthread_cond_signal(&present_cond);
+    pthread_mutex_unlock(&present_lock);
+
+    pthread_join(present_thread, NULL);
+
+    glfwDestroyWindow(window);
+    glfwTerminate();
+}
@@ -1,4 +1,8 @@
 #include <gb.h>
+#include <cpu.h>
+#include <gpu.h>
+#include <gb_memory.h>
+#include <scheduler.h>
 
 /**
  * Initialises and returns the global gb instance
@@ -7,13 +11,50 @@ gb_t* get_gb_instance() {
     static gb_t *gb_instance = NULL;
 
     if (gb_instance == NULL) {
-        gb_instance = malloc(sizeof(*gb_instance));
+        gb_instance = calloc(1, sizeof(*gb_instance));
 
         gb_instance->in_bios = 1;
         gb_instance->ime = 1;
 
         gb_instance->dma_mode = DMA_MODE_NONE;
+
+        gb_instance->cycles = 0;
     }
     
     return gb_instance;
-}
\ No newline at end of file
+}
+
+void gb_run(gb_t *gb) {
+    // Main tick loop
+    for (;;) {
+        int running = 1;
+
+        if (gb->cycles >= gb->next_event_cycle) {
+            sched_run(gb);
+
+            // Blank frames while the LCD is off end in an event
+            running = gpu_keep_running();
+        }
+
+        if ((gb->cycles & 3) == 0) {
+            // Divide the cpu clock by 4
+            cpu_tick(gb);
+        }
+
+        mem_dma(gb);
+
+        // The PPU has no work per cycle while the LCD is off
+        if (gb->gpu.lcd_on) {
+            STATS_ENTER(gb, STATS_PPU);
+            running &= gpu_tick(gb);
+            STATS_LEAVE(gb);
+        }
+
+        // Stop on a cycle boundary so a saved state resumes cleanly
+        gb->cycles++;
+
+        if (!running) {
+            break;
+        }
+    }
+}
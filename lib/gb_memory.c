@@ -1,12 +1,7 @@
 #include <gb_memory.h>
-
-#define ROM_SIZE 0x4000
-#define VRAM_SIZE 0x2000
-#define MBC_RAM_SIZE 0x2000
-#define RAM_SIZE 0x2000
-#define OAM_SIZE 0xA0
-#define IO_REGISTER_SIZE 0x80
-#define HIGH_SPEED_RAM_SIZE 0x80
+#include <gpu.h>
+#include <joypad.h>
+#include <timer.h>
 
 // BIOS code
 static const uint8_t bios[256] = {
@@ -54,7 +49,7 @@ static uint8_t mem_read_rom(gb_t *gb, uint16_t address) {
  * Read from the switchable ROM bank on the cartridge
  */
 static uint8_t mem_read_mbc_rom(gb_t *gb, uint16_t address) {
-    return mbc_read_rom_bank(gb, address);
+    return gb->rom_bank[address & 0x3FFF];
 }
 
 /**
@@ -98,6 +93,22 @@ static uint8_t mem_read_hram(gb_t *gb, uint16_t address) {
     }
 
     if (address < 0xFF80) {
+        if (address == REG_P1) {
+            STATS_ENTER(gb, STATS_JOYPAD);
+            uint8_t value = joypad_read_p1(gb);
+            STATS_LEAVE(gb);
+
+            return value;
+        }
+
+        if (address == REG_DIV || address == REG_TIMA) {
+            STATS_ENTER(gb, STATS_TIMER);
+            uint8_t value = timer_read(gb, address);
+            STATS_LEAVE(gb);
+
+            return value;
+        }
+
         // I/O registers
         return gb->io_registers[address & 0xFF];
     }
@@ -140,6 +151,7 @@ static void mem_write_mbc_rom(gb_t *gb, uint16_t address, uint8_t value) {
  * Write to the vram
  */
 static void mem_write_vram(gb_t *gb, uint16_t address, uint8_t value) {
+    gpu_mem_write(gb, address, value);
     gb->vram[address & 0x1FFF] = value;
 }
 
@@ -169,6 +181,7 @@ static void mem_write_high_ram(gb_t *gb, uint16_t address, uint8_t value) {
 
     if (address < 0xFEA0) {
         // OAM
+        gpu_mem_write(gb, address, value);
         gb->oam[address & 0xFF] = value;
         return;
     }
@@ -179,14 +192,14 @@ static void mem_write_high_ram(gb_t *gb, uint16_t address, uint8_t value) {
     }
 
     if (address < 0xFF80) {
-
-        if (address == REG_SCX) {
-            printf("SCX: %i\n", value);
-        }
+        gpu_mem_write(gb, address, value);
 
         // I/O registers
-        if (address == REG_DIV) {
-            value = 0;
+        if (address >= REG_DIV && address <= REG_TMC) {
+            STATS_ENTER(gb, STATS_TIMER);
+            timer_write(gb, address, value);
+            STATS_LEAVE(gb);
+            return;
         }
 
         if (address == 0xFF50 && value) {
@@ -230,37 +243,48 @@ static mem_write_function_t* const mem_write_map[] = {
 };
 
 void mem_init(gb_t *gb) {
-    gb->rom = malloc(ROM_SIZE);
+    // Mapped into the cartridge once it is loaded
+    gb->rom = NULL;
     gb->vram = malloc(VRAM_SIZE);
     gb->ram = malloc(RAM_SIZE);
-    gb->io_registers = malloc(IO_REGISTER_SIZE);
+    gb->io_registers = calloc(IO_REGISTER_SIZE, 1);
     gb->hram = malloc(HIGH_SPEED_RAM_SIZE);
     gb->oam = malloc(OAM_SIZE);
 }
 
-void mem_load_rom(gb_t *gb, const char *fname) {
+int mem_load_rom(gb_t *gb, const char *fname) {
     // File object
     FILE *f;
 
     // Open file
     f = fopen(fname, "rb");
 
-    // Load first 16KB into the rom
-    fread(gb->rom, ROM_SIZE, 1, f);
+    if (!f) {
+        printf("Failed to open %s\n", fname);
+        return 0;
+    }
 
-    // Setup the MBC
-    mbc_setup(gb, f);
+    // Load the cartridge and setup the MBC
+    int loaded = mbc_setup(gb, f);
 
     // Close
     fclose(f);
+
+    return loaded;
 }
 
 uint8_t mem_read_byte(gb_t *gb, uint16_t address) {
-    return mem_read_map[address >> 12](gb, address);
+    STATS_ENTER(gb, STATS_MEMORY);
+    uint8_t value = mem_read_map[address >> 12](gb, address);
+    STATS_LEAVE(gb);
+
+    return value;
 }
 
 void mem_write_byte(gb_t *gb, uint16_t address, uint8_t val) {
+    STATS_ENTER(gb, STATS_MEMORY);
     mem_write_map[address >> 12](gb, address, val);
+    STATS_LEAVE(gb);
 }
 
 uint16_t mem_read_word(gb_t *gb, uint16_t address) {
@@ -272,6 +296,46 @@ void mem_write_word(gb_t *gb, uint16_t address, uint16_t val) {
     mem_write_byte(gb, address + 1, val >> 8);
 }
 
+uint8_t mem_peek_byte(gb_t *gb, uint16_t address) {
+    if (address < 0x8000) {
+        return mem_read_map[address >> 12](gb, address);
+    }
+
+    if (address < 0xA000) {
+        return mem_read_vram(gb, address);
+    }
+
+    if (address < 0xC000) {
+        return gb->ram_bank ? gb->ram_bank[address & gb->ram_bank_mask] : 0xFF;
+    }
+
+    if (address < 0xFF00 || address >= 0xFF80) {
+        return mem_read_hram(gb, address);
+    }
+
+    return gb->io_registers[address & 0xFF];
+}
+
+uint16_t mem_bank(gb_t *gb, uint16_t address) {
+    if (address < 0x100 && gb->in_bios) {
+        return MEM_BANK_BOOT;
+    }
+
+    if (address < 0x4000) {
+        return (gb->rom - gb->mbc_rom) / MBC_ROM_BANK_SIZE;
+    }
+
+    if (address < 0x8000) {
+        return (gb->rom_bank - gb->mbc_rom) / MBC_ROM_BANK_SIZE;
+    }
+
+    if (address >= 0xA000 && address < 0xC000) {
+        return gb->current_ram_bank;
+    }
+
+    return 0;
+}
+
 void mem_remove_bios(gb_t *gb) {
     gb->in_bios = 0;
 }
@@ -288,7 +352,8 @@ void mem_dma(gb_t *gb) {
             break;
 
         case DMA_MODE_TRANSFER:
-            ;
+            STATS_ENTER(gb, STATS_DMA);
+
             // Transfer data
             uint16_t read_addr = gb->dma_addr + gb->dma_cycles;
             uint16_t write_addr = 0xFE00 + gb->dma_cycles;
@@ -304,6 +369,7 @@ void mem_dma(gb_t *gb) {
                 gb->dma_mode = DMA_MODE_NONE;
             }
 
+            STATS_LEAVE(gb);
             break;
         
         default:
@@ -1,49 +1,109 @@
 #include <gpu.h>
+#include <scheduler.h>
+#include <timeline.h>
 
-static uint32_t gpu_counter = 0;
 static uint32_t display_refresh_counter = 0;
 
-static uint8_t lcd_mode = LCD_MODE_2_OAM;
+// Frames not drawn between each drawn frame
+static uint32_t frame_skip = 0;
 
-// The indexes of the (max 10) sprites to be drawn on the current line
-static uint8_t line_sprites[10];
+// If set, the only frame that is drawn
+static uint32_t render_only_frame = GPU_RENDER_ALL_FRAMES;
 
-// Current x and y position being drawn
-static uint8_t x_pos = 0;
-static uint8_t y_pos = 0;
+// Whether pixels are being produced for the current frame
+static uint8_t render_this_frame = 1;
 
-static GLFWwindow *window;
-
-// Data to hold the pixels to be drawn to the screen
-static GLubyte pixel_buffer[DISPLAY_HEIGHT][DISPLAY_WIDTH][3];
+// Called with each completed frame, returns 0 to stop emulation
+static gpu_frame_handler_t *frame_handler = NULL;
+static int running = 1;
 
 /**
- * Transform from gameboy pixel number (0-3)
- * to greyscale level (0-255)
+ * Report a stop asked for by the frame handler, once. The next run carries on
  */
-static uint8_t grey_value(uint8_t pixel) {
-    return 255 - (pixel * 85);
+int gpu_keep_running() {
+    int result = running;
+    running = 1;
+
+    return result;
 }
 
+// Register and memory state seen by the renderer while drawing a line
+typedef struct {
+    uint8_t lcdc;
+    uint8_t scx;
+    uint8_t scy;
+    uint8_t wx;
+    uint8_t wy;
+    uint8_t bgp;
+    uint8_t obp0;
+    uint8_t obp1;
+
+    // The indexes of the (max 10) sprites to be drawn on the line
+    uint8_t line_sprites[10];
+
+    const uint8_t *vram;
+    const uint8_t *oam;
+} gpu_line_state_t;
+
+// Copy of vram and oam captured for lines rendered off the emulation thread
+typedef struct {
+    uint8_t vram[VRAM_SIZE];
+    uint8_t oam[OAM_SIZE];
+} gpu_vram_version_t;
+
+static uint8_t render_mode = GPU_RENDER_SERIAL;
+
+// Live state for the line currently being drawn
+static gpu_line_state_t current_line;
+
+// Per line snapshots, taken at the start of the pixel transfer
+static gpu_line_state_t line_snapshots[DISPLAY_HEIGHT];
+
+// Lines which were written to mid transfer and so are drawn on the emulation thread
+static uint8_t line_inline[DISPLAY_HEIGHT];
+
+// Copy on write versions of vram/oam used by the snapshots in this frame
+static gpu_vram_version_t *vram_versions[DISPLAY_HEIGHT];
+static uint8_t vram_version_count = 0;
+static uint8_t vram_dirty = 1;
+
+// Buffer written by the parallel renderer when verifying against the serial one
+static uint8_t verify_buffer[DISPLAY_HEIGHT][DISPLAY_WIDTH];
+
+// Buffer the workers are drawing this frame into
+static uint8_t (*render_target)[DISPLAY_WIDTH];
+
+// Line render workers
+static pthread_t render_threads[GPU_MAX_RENDER_THREADS];
+static uint8_t render_thread_count = 0;
+
+static pthread_mutex_t render_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t render_work_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t render_done_cond = PTHREAD_COND_INITIALIZER;
+
+// Queue of this frame's lines waiting for a worker
+static uint8_t render_queue[DISPLAY_HEIGHT];
+static uint8_t render_queue_head = 0;
+static uint8_t render_queue_tail = 0;
+static uint8_t render_lines_pending = 0;
+
 /**
  * Transfrom a pixel through the bg palette
  */
-static uint8_t bg_palette_transform(gb_t *gb, uint8_t pixel) {
-    uint8_t bgp = mem_read_byte(gb, REG_BGP);
-
-    return (bgp & (0b11 << (2 * pixel))) >> (2 * pixel);
+static uint8_t bg_palette_transform(const gpu_line_state_t *line, uint8_t pixel) {
+    return (line->bgp & (0b11 << (2 * pixel))) >> (2 * pixel);
 }
 
 /**
  * Transfrom a pixel through the obj palette
  */
-static uint8_t obj_palette_transform(gb_t *gb, uint8_t pixel, uint8_t obj_pallete) {
+static uint8_t obj_palette_transform(const gpu_line_state_t *line, uint8_t pixel, uint8_t obj_pallete) {
     // Colour 0 is transparent
     if (pixel == 0) {
         return 0;
     }
 
-    uint8_t obp = mem_read_byte(gb, obj_pallete ? REG_OBP1 : REG_OBP0);
+    uint8_t obp = obj_pallete ? line->obp1 : line->obp0;
 
     return (obp & (0b11 << (2 * pixel))) >> (2 * pixel);
 }
@@ -51,18 +111,18 @@ static uint8_t obj_palette_transform(gb_t *gb, uint8_t pixel, uint8_t obj_pallet
 /**
  * Get the tile map index for an absolute display position x & y (0-255)
  */
-static uint8_t get_bg_tile_index(gb_t *gb, uint8_t x, uint8_t y) {
+static uint8_t get_bg_tile_index(const gpu_line_state_t *line, uint8_t x, uint8_t y) {
     // Turn into block number (0-32)
     uint8_t block_x = x >> 3;
     uint8_t block_y = y >> 3;
 
     // Determine the start of the background tile map from bit 3 of LCDC
-    uint16_t tile_map_start = (mem_read_byte(gb, REG_LCDC) & LCDC_BG_TILE_MAP_DISPLAY_SELECT) ? 0x9C00 : 0x9800;
+    uint16_t tile_map_start = (line->lcdc & LCDC_BG_TILE_MAP_DISPLAY_SELECT) ? 0x9C00 : 0x9800;
 
     uint16_t tile_addr = tile_map_start + 32 * block_y + block_x;
 
     // Get the character code of the tile at this location
-    uint8_t character_code = mem_read_byte(gb, tile_addr);
+    uint8_t character_code = line->vram[tile_addr & 0x1FFF];
 
     return character_code;
 }
@@ -70,9 +130,9 @@ static uint8_t get_bg_tile_index(gb_t *gb, uint8_t x, uint8_t y) {
 /**
  * Get the pixel value from a tile at (x, y) in the tile
  */
-static uint8_t get_tile_pixel(gb_t *gb, uint16_t tile_address, uint8_t x, uint8_t y) {
-    uint8_t tile_lsb = mem_read_byte(gb, tile_address + (y * 2));
-    uint8_t tile_msb = mem_read_byte(gb, tile_address + (y * 2) + 1);
+static uint8_t get_tile_pixel(const gpu_line_state_t *line, uint16_t tile_address, uint8_t x, uint8_t y) {
+    uint8_t tile_lsb = line->vram[(tile_address + (y * 2)) & 0x1FFF];
+    uint8_t tile_msb = line->vram[(tile_address + (y * 2) + 1) & 0x1FFF];
 
     uint8_t val = (!!(tile_msb & (1 << (7 - x))) << 1) | (!!(tile_lsb & (1 << (7 - x))));
 
@@ -82,10 +142,10 @@ static uint8_t get_tile_pixel(gb_t *gb, uint16_t tile_address, uint8_t x, uint8_
 /**
  * Get the pixel value from a background/window tile at (x, y) in the tile
  */
-static uint8_t get_tile_pixel_bg_window(gb_t *gb, uint16_t tile_index, uint8_t x, uint8_t y) {
+static uint8_t get_tile_pixel_bg_window(const gpu_line_state_t *line, uint16_t tile_index, uint8_t x, uint8_t y) {
     uint16_t tile_address;
 
-    if (mem_read_byte(gb, REG_LCDC) & (mem_read_byte(gb, REG_LCDC) & LCDC_BG_WINDOW_TILE_DATA_SELECT)) {
+    if (line->lcdc & LCDC_BG_WINDOW_TILE_DATA_SELECT) {
         // 0x8000 mode
         tile_address = 0x8000 + tile_index * 16;
     } else {
@@ -93,13 +153,13 @@ static uint8_t get_tile_pixel_bg_window(gb_t *gb, uint16_t tile_index, uint8_t x
         tile_address = 0x9000 + ((int8_t)(tile_index) * 16);
     }
 
-    return get_tile_pixel(gb, tile_address, x, y);
+    return get_tile_pixel(line, tile_address, x, y);
 }
 
 /**
  * Get the entry in the OAM for index 0 - 39
  */
-static uint32_t get_oam_entry(gb_t *gb, uint8_t index) {
+static uint32_t get_oam_entry(const gpu_line_state_t *line, uint8_t index) {
     if (index > 40) {
         printf("Index %i in OAM out of range (0-39)\n", index);
         abort();
@@ -108,10 +168,10 @@ static uint32_t get_oam_entry(gb_t *gb, uint8_t index) {
     uint32_t ret_val;
 
     // Read the 4 bytes
-    ret_val = mem_read_byte(gb, (index * 4) + 0xFE00);
-    ret_val |= mem_read_byte(gb, (index * 4) + 0xFE01) << 8;
-    ret_val |= mem_read_byte(gb, (index * 4) + 0xFE02) << 16;
-    ret_val |= mem_read_byte(gb, (index * 4) + 0xFE03) << 24;
+    ret_val = line->oam[index * 4];
+    ret_val |= line->oam[(index * 4) + 1] << 8;
+    ret_val |= line->oam[(index * 4) + 2] << 16;
+    ret_val |= line->oam[(index * 4) + 3] << 24;
 
     return ret_val;
 }
@@ -119,8 +179,8 @@ static uint32_t get_oam_entry(gb_t *gb, uint8_t index) {
 /*
  * Determine if sprite overlaps an x position
  */
-static uint8_t sprite_at_x(gb_t *gb, uint8_t index, uint8_t x) {
-    uint32_t sprite_val = get_oam_entry(gb, index);
+static uint8_t sprite_at_x(const gpu_line_state_t *line, uint8_t index, uint8_t x) {
+    uint32_t sprite_val = get_oam_entry(line, index);
 
     int16_t sprite_x = SPRITE_XPOS(sprite_val);
 
@@ -130,12 +190,12 @@ static uint8_t sprite_at_x(gb_t *gb, uint8_t index, uint8_t x) {
 /**
  * Determine if sprite overlaps a y position
  */
-static uint8_t sprite_at_y(gb_t *gb, uint8_t index, uint8_t y) {
-    uint32_t sprite_val = get_oam_entry(gb, index);
+static uint8_t sprite_at_y(const gpu_line_state_t *line, uint8_t index, uint8_t y) {
+    uint32_t sprite_val = get_oam_entry(line, index);
 
     int16_t sprite_y = SPRITE_YPOS(sprite_val);
 
-    uint8_t sprite_height = (mem_read_byte(gb, REG_LCDC) & LCDC_OBJ_BLOCK_COMPOSITION) ? 16 : 8;
+    uint8_t sprite_height = (line->lcdc & LCDC_OBJ_BLOCK_COMPOSITION) ? 16 : 8;
 
     return (y >= sprite_y) && (y < (sprite_y + sprite_height));
 }
@@ -143,16 +203,16 @@ static uint8_t sprite_at_y(gb_t *gb, uint8_t index, uint8_t y) {
 /**
  * Get the pixel colour from a sprite (transformed through palette)
  */
-static uint8_t get_sprite_pixel(gb_t *gb, uint8_t index, uint8_t x, uint8_t y) {
-    if (!sprite_at_x(gb, index, x) || !(sprite_at_y(gb, index, y))) {
+static uint8_t get_sprite_pixel(const gpu_line_state_t *line, uint8_t index, uint8_t x, uint8_t y) {
+    if (!sprite_at_x(line, index, x) || !(sprite_at_y(line, index, y))) {
         // Sprite isn't at this location
         return 0;
     }
 
-    uint32_t sprite_val = get_oam_entry(gb, index);
+    uint32_t sprite_val = get_oam_entry(line, index);
 
     // Determine if 8x8 or 8x16 mode
-    uint8_t double_height_mode = !!(mem_read_byte(gb, REG_LCDC) & LCDC_OBJ_BLOCK_COMPOSITION);
+    uint8_t double_height_mode = !!(line->lcdc & LCDC_OBJ_BLOCK_COMPOSITION);
 
     uint8_t x_in_sprite = x - SPRITE_XPOS(sprite_val);
 
@@ -176,45 +236,23 @@ static uint8_t get_sprite_pixel(gb_t *gb, uint8_t index, uint8_t x, uint8_t y) {
         y_in_sprite -= 8;
     }
 
-    uint8_t col = get_tile_pixel(gb, tile_address, x_in_sprite, y_in_sprite);
-    col = obj_palette_transform(gb, col, !!(SPRITE_ATTR(sprite_val) & SPRITE_ATTR_PALETTE));
+    uint8_t col = get_tile_pixel(line, tile_address, x_in_sprite, y_in_sprite);
+    col = obj_palette_transform(line, col, !!(SPRITE_ATTR(sprite_val) & SPRITE_ATTR_PALETTE));
 
     return col;
 }
 
 /**
- * Render the current frame to the screen
- */
-static void gpu_render_frame(gb_t *gb) {
-    int width, height;
-
-    glClear(GL_COLOR_BUFFER_BIT);
-
-    if (mem_read_byte(gb, REG_LCDC) & LCDC_LCD_CONTROL) {
-        glfwGetFramebufferSize(window, &width, &height);
-
-        glPixelZoom((GLfloat)width / (GLfloat)DISPLAY_WIDTH, (GLfloat)height / (GLfloat)DISPLAY_HEIGHT);
-        
-        glDrawPixels(DISPLAY_WIDTH, DISPLAY_HEIGHT, GL_RGB, GL_UNSIGNED_BYTE, pixel_buffer);
-        
-        glfwSwapBuffers(window);
-    }
-}
-
-/**
- * Calculate the value of a pixel and put into pixel buffer
+ * Calculate the value of a pixel
  */
-static void calculate_pixel(gb_t *gb, uint8_t x, uint8_t y) {
-    uint8_t scx = mem_read_byte(gb, REG_SCX);
-    uint8_t scy = mem_read_byte(gb, REG_SCY);
-
+static uint8_t calculate_pixel(const gpu_line_state_t *line, uint8_t x, uint8_t y) {
     // Adjust for scroll
-    uint8_t x_adj = (x + scx) & 0xFF;
-    uint8_t y_adj = (y + scy) & 0xFF;
+    uint8_t x_adj = (x + line->scx) & 0xFF;
+    uint8_t y_adj = (y + line->scy) & 0xFF;
     
     // Calculate background
-    uint8_t tile_index = get_bg_tile_index(gb, x_adj, y_adj);
-    uint8_t bg_pixel = bg_palette_transform(gb, get_tile_pixel_bg_window(gb, tile_index, x_adj & 0x7, y_adj & 0x7));
+    uint8_t tile_index = get_bg_tile_index(line, x_adj, y_adj);
+    uint8_t bg_pixel = bg_palette_transform(line, get_tile_pixel_bg_window(line, tile_index, x_adj & 0x7, y_adj & 0x7));
 
     // Calculate window
     // TODO
@@ -225,23 +263,23 @@ static void calculate_pixel(gb_t *gb, uint8_t x, uint8_t y) {
     uint8_t sprite_least_x = 255;
 
     for (uint8_t i = 0; i < 10; i++) {
-        uint8_t index = line_sprites[i];
+        uint8_t index = line->line_sprites[i];
         if (index == SPRITE_INDEX_NO_SPRITE) {
             // Reached the end of the list
             break;
         }
 
-        if (sprite_at_x(gb, index, x)) {
+        if (sprite_at_x(line, index, x)) {
             // Current x is in this sprite
 
             // Sprite with lowest x is always displayed
-            uint32_t sprite_val = get_oam_entry(gb, index);
+            uint32_t sprite_val = get_oam_entry(line, index);
             uint8_t sprite_x = SPRITE_XPOS(sprite_val);
             
             if (sprite_x < sprite_least_x) {
                 // This sprite has a lower x position, and thus has
                 // priority
-                sprite_pixel = get_sprite_pixel(gb, index, x, y);
+                sprite_pixel = get_sprite_pixel(line, index, x, y);
                 sprite_bg_priority = !!(SPRITE_ATTR(sprite_val) & SPRITE_ATTR_OBJ_BG_PRIORITY); 
                 sprite_least_x = sprite_x;
             }
@@ -253,85 +291,547 @@ static void calculate_pixel(gb_t *gb, uint8_t x, uint8_t y) {
         bg_pixel = sprite_pixel;
     }
 
-    // Calculate the screen colour
-    uint8_t col = grey_value(bg_pixel);
+    return bg_pixel;
+}
+
+/**
+ * Put a pixel into a pixel buffer
+ */
+static void put_pixel(uint8_t buffer[DISPLAY_HEIGHT][DISPLAY_WIDTH], uint8_t x, uint8_t y, uint8_t pixel) {
+    buffer[y][x] = pixel;
+}
+
+/**
+ * Buffer the parallel renderer draws into
+ */
+static uint8_t (*parallel_buffer(gb_t *gb))[DISPLAY_WIDTH] {
+    return render_mode == GPU_RENDER_VERIFY ? verify_buffer : gb->gpu.pixel_buffer;
+}
+
+/**
+ * Read the renderer visible registers and the line's sprites into a line state
+ */
+static void capture_line_registers(gb_t *gb, gpu_line_state_t *line) {
+    memcpy(line->line_sprites, gb->gpu.line_sprites, sizeof(line->line_sprites));
+
+    line->lcdc = gb->io_registers[REG_LCDC & 0xFF];
+    line->scx = gb->io_registers[REG_SCX & 0xFF];
+    line->scy = gb->io_registers[REG_SCY & 0xFF];
+    line->wx = gb->io_registers[REG_WX & 0xFF];
+    line->wy = gb->io_registers[REG_WY & 0xFF];
+    line->bgp = gb->io_registers[REG_BGP & 0xFF];
+    line->obp0 = gb->io_registers[REG_OBP0 & 0xFF];
+    line->obp1 = gb->io_registers[REG_OBP1 & 0xFF];
+}
+
+/**
+ * Draw a whole line from its snapshot
+ */
+static void render_line(uint8_t y) {
+    for (uint8_t x = 0; x < DISPLAY_WIDTH; x++) {
+        put_pixel(render_target, x, y, calculate_pixel(&line_snapshots[y], x, y));
+    }
+}
+
+/**
+ * Line render worker thread
+ */
+static void* render_worker(void *arg) {
+    timeline_thread_start("render");
+
+    for (;;) {
+        pthread_mutex_lock(&render_lock);
+
+        while (render_queue_head == render_queue_tail) {
+            pthread_cond_wait(&render_work_cond, &render_lock);
+        }
+
+        uint8_t y = render_queue[render_queue_head];
+        render_queue_head++;
+
+        pthread_mutex_unlock(&render_lock);
+
+        int64_t start = timeline_now();
+
+        render_line(y);
+
+        timeline_span("line", start, "line", y);
+
+        pthread_mutex_lock(&render_lock);
+
+        if (--render_lines_pending == 0) {
+            pthread_cond_signal(&render_done_cond);
+        }
+
+        pthread_mutex_unlock(&render_lock);
+    }
+
+    return NULL;
+}
+
+/**
+ * Hand a snapshotted line to the workers
+ */
+static void submit_line(uint8_t y) {
+    pthread_mutex_lock(&render_lock);
+
+    render_queue[render_queue_tail] = y;
+    render_queue_tail++;
+    render_lines_pending++;
+
+    pthread_cond_signal(&render_work_cond);
+    pthread_mutex_unlock(&render_lock);
+}
+
+/**
+ * Wait for the workers to finish all submitted lines
+ */
+static void wait_for_lines() {
+    pthread_mutex_lock(&render_lock);
+
+    while (render_lines_pending) {
+        pthread_cond_wait(&render_done_cond, &render_lock);
+    }
+
+    // Each line is queued at most once per frame, so the queue never wraps
+    render_queue_head = 0;
+    render_queue_tail = 0;
+
+    pthread_mutex_unlock(&render_lock);
+}
+
+/**
+ * Snapshot the current line for rendering off the emulation thread.
+ * vram/oam are only copied when they have been written since the last snapshot
+ */
+static void snapshot_line(gb_t *gb) {
+    if (gb->gpu.y_pos == 0) {
+        // New frame, the workers are done with the previous versions
+        vram_version_count = 0;
+        vram_dirty = 1;
+
+        // Published to the workers with the first submitted line
+        render_target = parallel_buffer(gb);
+    }
+
+    if (vram_dirty) {
+        if (vram_versions[vram_version_count] == NULL) {
+            vram_versions[vram_version_count] = malloc(sizeof(gpu_vram_version_t));
+        }
+
+        memcpy(vram_versions[vram_version_count]->vram, gb->vram, VRAM_SIZE);
+        memcpy(vram_versions[vram_version_count]->oam, gb->oam, OAM_SIZE);
+
+        vram_version_count++;
+        vram_dirty = 0;
+    }
 
-    // Push to pixel buffer
-    pixel_buffer[(DISPLAY_HEIGHT - 1) - y][x][0] = col;
-    pixel_buffer[(DISPLAY_HEIGHT - 1) - y][x][1] = col;
-    pixel_buffer[(DISPLAY_HEIGHT - 1) - y][x][2] = col;
+    gpu_line_state_t *snapshot = &line_snapshots[gb->gpu.y_pos];
+
+    *snapshot = current_line;
+    snapshot->vram = vram_versions[vram_version_count - 1]->vram;
+    snapshot->oam = vram_versions[vram_version_count - 1]->oam;
+
+    line_inline[gb->gpu.y_pos] = 0;
+}
+
+/**
+ * FNV-1a hash of a pixel buffer
+ */
+static uint64_t buffer_hash(uint8_t buffer[DISPLAY_HEIGHT][DISPLAY_WIDTH]) {
+    const uint8_t *bytes = &buffer[0][0];
+    uint64_t hash = 0xCBF29CE484222325;
+
+    for (uint32_t i = 0; i < DISPLAY_HEIGHT * DISPLAY_WIDTH; i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001B3;
+    }
+
+    return hash;
+}
+
+/**
+ * Check the parallel renderer drew the same frame as the serial renderer
+ */
+static void verify_frame(gb_t *gb) {
+    uint64_t serial_hash = buffer_hash(gb->gpu.pixel_buffer);
+    uint64_t parallel_hash = buffer_hash(verify_buffer);
+
+    if (serial_hash != parallel_hash) {
+        printf("Parallel render mismatch on frame %u (serial %016llX, parallel %016llX)\n",
+            gb->gpu.frame_count, (unsigned long long)serial_hash, (unsigned long long)parallel_hash);
+
+        for (uint8_t y = 0; y < DISPLAY_HEIGHT; y++) {
+            if (memcmp(gb->gpu.pixel_buffer[y], verify_buffer[y], sizeof(gb->gpu.pixel_buffer[0]))) {
+                printf("First differing line: %i (%s)\n", y, line_inline[y] ? "inline" : "snapshot");
+                break;
+            }
+        }
+
+        // Not flushed by abort, which would lose the report when piped
+        fflush(stdout);
+        abort();
+    }
+}
+
+/**
+ * Find the (max 10) sprites on the current line
+ */
+static void scan_oam(gb_t *gb) {
+    // Index of sprite on line (max of 10)
+    uint8_t sprite_array_index = 0;
+
+    // Reset line sprite array
+    memset(gb->gpu.line_sprites, SPRITE_INDEX_NO_SPRITE, sizeof(gb->gpu.line_sprites));
+
+    capture_line_registers(gb, &current_line);
+    
+    if (current_line.lcdc | LCDC_OBJ_ON) {
+        // Loop through all of OAM to find the first 10 sprites that are
+        // on the current line
+        for (uint8_t i = 0; i < 40; i++) {
+            if (sprite_at_y(&current_line, i, gb->gpu.y_pos)) {
+                // On current line - add to array
+                gb->gpu.line_sprites[sprite_array_index++] = i;
+            }
+
+            if (sprite_array_index == 10) {
+                // Reached max number of sprites
+                break;
+            }
+        }
+    }
+
+    memcpy(current_line.line_sprites, gb->gpu.line_sprites, sizeof(current_line.line_sprites));
+}
+
+/**
+ * Whether a frame should be drawn, given the frame skip settings
+ */
+static uint8_t frame_should_render(uint32_t frame) {
+    if (render_only_frame != GPU_RENDER_ALL_FRAMES) {
+        return frame == render_only_frame;
+    }
+
+    return (frame % (frame_skip + 1)) == 0;
 }
 
 /**
  * Initialise the gpu
  */
 int gpu_init(gb_t *gb) {
-    if (!glfwInit()) {
-        printf("Failed to init GLFW\n");
+    gb->gpu.counter = 0;
+    gb->gpu.lcd_mode = LCD_MODE_0_HBLANK;
+    gb->gpu.lcd_on = 0;
+    gb->gpu.x_pos = 0;
+    gb->gpu.y_pos = 0;
+    gb->gpu.frame_count = 0;
+
+    memset(gb->gpu.line_sprites, SPRITE_INDEX_NO_SPRITE, sizeof(gb->gpu.line_sprites));
+    memset(gb->gpu.pixel_buffer, 0, sizeof(gb->gpu.pixel_buffer));
+
+    current_line.vram = gb->vram;
+    current_line.oam = gb->oam;
+
+    render_target = gb->gpu.pixel_buffer;
+
+    // Blank frames until the LCD is turned on
+    sched_schedule(gb, SCHED_EVENT_LCD_OFF_FRAME, gb->cycles + CYCLES_PER_FRAME);
+
+    return 1;
+}
+
+/**
+ * Set the function called with each completed frame
+ */
+void gpu_set_frame_handler(gpu_frame_handler_t *handler) {
+    frame_handler = handler;
+}
+
+/**
+ * Select how lines are rendered. Parallel rendering snapshots each line
+ * and draws it on one of threads workers
+ */
+int gpu_set_render_mode(uint8_t mode, uint8_t threads) {
+    if (mode != GPU_RENDER_SERIAL && (threads == 0 || threads > GPU_MAX_RENDER_THREADS)) {
+        printf("Render threads must be between 1 and %i\n", GPU_MAX_RENDER_THREADS);
         return 0;
     }
 
-    window = glfwCreateWindow(DISPLAY_WIDTH * DISPLAY_SCALE, DISPLAY_HEIGHT * DISPLAY_SCALE, "gbemu", NULL, NULL);
-
-    if (!window) {
-        printf("Failed to open window\n");
+    if (render_thread_count) {
+        printf("Render mode already set\n");
         return 0;
     }
-    
-    glfwMakeContextCurrent(window);
 
-    glfwWindowHint(GLFW_RESIZABLE, GL_FALSE);
+    render_mode = mode;
+
+    if (mode == GPU_RENDER_SERIAL) {
+        return 1;
+    }
 
-    glClearColor(1.0, 1.0, 1.0, 1.0);
-    glShadeModel(GL_FLAT);
-    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    for (uint8_t i = 0; i < threads; i++) {
+        if (pthread_create(&render_threads[i], NULL, render_worker, NULL)) {
+            printf("Failed to start render thread\n");
+            return 0;
+        }
 
-    // Assign key callback. Probably shouldn't be in gpu functions.
-    glfwSetKeyCallback(window, key_pressed_callback);
+        render_thread_count++;
+    }
 
     return 1;
 }
 
+/**
+ * Track writes which change what the parallel renderer should see
+ */
+static void watch_render_write(gb_t *gb, uint16_t address) {
+    if ((address >= 0x8000 && address < 0xA000) || (address >= 0xFE00 && address < 0xFEA0)) {
+        vram_dirty = 1;
+    } else if (address != REG_LCDC && address != REG_SCX && address != REG_SCY && address != REG_BGP
+        && address != REG_OBP0 && address != REG_OBP1 && address != REG_WX && address != REG_WY) {
+        // Not visible to the renderer
+        return;
+    }
+
+    if (gb->gpu.lcd_mode == LCD_MODE_3_TRANSFER && !line_inline[gb->gpu.y_pos]) {
+        // The snapshot no longer matches what the rest of the line sees. Draw the
+        // pixels transferred so far, then finish the line on this thread
+        line_inline[gb->gpu.y_pos] = 1;
+
+        uint8_t (*buffer)[DISPLAY_WIDTH] = parallel_buffer(gb);
+
+        capture_line_registers(gb, &current_line);
+
+        for (uint8_t x = 0; x < gb->gpu.x_pos; x++) {
+            put_pixel(buffer, x, gb->gpu.y_pos, calculate_pixel(&current_line, x, gb->gpu.y_pos));
+        }
+    }
+}
+
 /**
  * Write the mode value to the stat register
  */
 static void write_mode(gb_t *gb) {
     uint8_t stat = mem_read_byte(gb, REG_STAT);
     stat &= ~3;
-    stat |= (lcd_mode & 3);
+    stat |= (gb->gpu.lcd_mode & 3);
     mem_write_byte(gb, REG_STAT, stat);
 }
 
+/**
+ * Stop the ppu. LY is held at 0 in mode 0 and the screen is blank,
+ * with a blank frame presented every frame length until it is turned back on
+ */
+static void lcd_turn_off(gb_t *gb) {
+    if (render_mode != GPU_RENDER_SERIAL) {
+        wait_for_lines();
+    }
+
+    gb->gpu.lcd_on = 0;
+    gb->gpu.lcd_mode = LCD_MODE_0_HBLANK;
+    write_mode(gb);
+
+    gb->gpu.counter = 0;
+    gb->gpu.x_pos = 0;
+    gb->gpu.y_pos = 0;
+
+    mem_write_byte(gb, REG_LY, gb->gpu.y_pos);
+
+    memset(gb->gpu.pixel_buffer, 0, sizeof(gb->gpu.pixel_buffer));
+    memset(verify_buffer, 0, sizeof(verify_buffer));
+
+    sched_schedule(gb, SCHED_EVENT_LCD_OFF_FRAME, gb->cycles + CYCLES_PER_FRAME);
+}
+
+/**
+ * Start the ppu from the beginning of line 0
+ */
+static void lcd_turn_on(gb_t *gb) {
+    sched_cancel(gb, SCHED_EVENT_LCD_OFF_FRAME);
+
+    gb->gpu.lcd_on = 1;
+    gb->gpu.lcd_mode = LCD_MODE_2_OAM;
+    write_mode(gb);
+
+    gb->gpu.counter = 0;
+    gb->gpu.x_pos = 0;
+    gb->gpu.y_pos = 0;
+}
+
+/**
+ * Notify the gpu of a memory write before it is applied
+ */
+void gpu_mem_write(gb_t *gb, uint16_t address, uint8_t value) {
+    if (render_mode != GPU_RENDER_SERIAL && render_this_frame) {
+        watch_render_write(gb, address);
+    }
+
+    if (address == REG_LCDC && ((gb->io_registers[REG_LCDC & 0xFF] ^ value) & LCDC_LCD_CONTROL)) {
+        if (value & LCDC_LCD_CONTROL) {
+            lcd_turn_on(gb);
+        } else {
+            lcd_turn_off(gb);
+        }
+    }
+}
+
+/**
+ * Finish lines in flight so the frame buffer holds everything drawn so far
+ */
+void gpu_sync(gb_t *gb) {
+    if (render_mode == GPU_RENDER_SERIAL) {
+        return;
+    }
+
+    wait_for_lines();
+
+    uint8_t y = gb->gpu.y_pos;
+
+    if (render_this_frame && gb->gpu.lcd_on && gb->gpu.lcd_mode == LCD_MODE_3_TRANSFER && !line_inline[y]) {
+        // This line's snapshot isn't submitted until hblank, draw the pixels transferred so far
+        for (uint8_t x = 0; x < gb->gpu.x_pos; x++) {
+            put_pixel(parallel_buffer(gb), x, y, calculate_pixel(&line_snapshots[y], x, y));
+        }
+    }
+}
+
+/**
+ * Pick up from a restored state
+ */
+void gpu_state_loaded(gb_t *gb) {
+    current_line.vram = gb->vram;
+    current_line.oam = gb->oam;
+    memcpy(current_line.line_sprites, gb->gpu.line_sprites, sizeof(current_line.line_sprites));
+
+    render_this_frame = frame_should_render(gb->gpu.frame_count);
+
+    if (render_mode == GPU_RENDER_SERIAL) {
+        return;
+    }
+
+    // Lines already drawn come from the state, the rest are snapshotted as usual
+    render_target = parallel_buffer(gb);
+    vram_dirty = 1;
+
+    if (render_mode == GPU_RENDER_VERIFY) {
+        memcpy(verify_buffer, gb->gpu.pixel_buffer, sizeof(verify_buffer));
+    }
+
+    if (gb->gpu.lcd_mode == LCD_MODE_3_TRANSFER) {
+        // No snapshot for this line, finish it on this thread
+        line_inline[gb->gpu.y_pos] = 1;
+    }
+}
+
+/**
+ * Hash of the last completed frame
+ */
+uint64_t gpu_frame_hash(gb_t *gb) {
+    return buffer_hash(gb->gpu.pixel_buffer);
+}
+
+/**
+ * The frame buffer, one shade (0-3) per pixel, top row first.
+ * Holds a complete frame from the start of vblank
+ */
+const uint8_t* gpu_get_frame(gb_t *gb) {
+    return &gb->gpu.pixel_buffer[0][0];
+}
+
+/**
+ * Number of frames since startup
+ */
+uint32_t gpu_frame_count(gb_t *gb) {
+    return gb->gpu.frame_count;
+}
+
+/**
+ * Only draw every (skip + 1)th frame
+ */
+void gpu_set_frame_skip(uint32_t skip) {
+    frame_skip = skip;
+}
+
+/**
+ * Only draw a single frame
+ */
+void gpu_set_render_only_frame(gb_t *gb, uint32_t frame) {
+    render_only_frame = frame;
+    render_this_frame = frame_should_render(gb->gpu.frame_count);
+}
+
+/**
+ * Hand the frame on and move on to the next one
+ */
+static void finish_frame(gb_t *gb) {
+    if (render_this_frame) {
+        if (render_mode != GPU_RENDER_SERIAL) {
+            int64_t start = timeline_now();
+
+            wait_for_lines();
+
+            timeline_span("render wait", start, "frame", gb->gpu.frame_count);
+        }
+
+        if (render_mode == GPU_RENDER_VERIFY) {
+            verify_frame(gb);
+        }
+    }
+
+    STATS_FRAME(gb);
+
+    if (frame_handler) {
+        STATS_ENTER(gb, STATS_FRONTEND);
+        running = frame_handler(gb, &gb->gpu.pixel_buffer[0][0], render_this_frame);
+        STATS_LEAVE(gb);
+    }
+
+    gb->gpu.frame_count++;
+    render_this_frame = frame_should_render(gb->gpu.frame_count);
+}
+
+/**
+ * Called by the scheduler every frame length while the LCD is off
+ */
+void gpu_lcd_off_frame(gb_t *gb) {
+    finish_frame(gb);
+
+    sched_schedule(gb, SCHED_EVENT_LCD_OFF_FRAME, gb->cycles + CYCLES_PER_FRAME);
+}
+
 /**
  * Update
  */
 int gpu_tick(gb_t *gb) {
+    if (!gb->gpu.lcd_on) {
+        // Nothing to do until LCDC turns the LCD back on
+        return gpu_keep_running();
+    }
+
     // Update based on mode
-    switch (lcd_mode) {
+    switch (gb->gpu.lcd_mode) {
         case LCD_MODE_0_HBLANK:
-            gpu_counter++;
+            gb->gpu.counter++;
 
-            if (gpu_counter > 200) {
-                gpu_counter = 0;
-                y_pos++;
+            if (gb->gpu.counter > 200) {
+                gb->gpu.counter = 0;
+                gb->gpu.y_pos++;
 
                 // Write y position to LY register
-                mem_write_byte(gb, REG_LY, y_pos);
+                mem_write_byte(gb, REG_LY, gb->gpu.y_pos);
 
-                if (y_pos == DISPLAY_HEIGHT) {
+                if (gb->gpu.y_pos == DISPLAY_HEIGHT) {
                     // Drawn all lines, go into vblank
 
                     // Vblank interrupt
                     mem_write_byte(gb, INTERRUPT_FLAGS, mem_read_byte(gb, INTERRUPT_FLAGS) | INT_FLAG_VBLANK);
 
-                    lcd_mode = LCD_MODE_1_VBLANK;
+                    gb->gpu.lcd_mode = LCD_MODE_1_VBLANK;
                     write_mode(gb);
 
-                    // Render to screen                    
-                    gpu_render_frame(gb);
-                    glfwPollEvents();
+                    finish_frame(gb);
                 } else {
-                    lcd_mode = LCD_MODE_2_OAM;
+                    gb->gpu.lcd_mode = LCD_MODE_2_OAM;
                     write_mode(gb);
                 }
             }
@@ -339,62 +839,46 @@ int gpu_tick(gb_t *gb) {
             break;
         
         case LCD_MODE_1_VBLANK:
-            gpu_counter++;
+            gb->gpu.counter++;
 
-            if (gpu_counter == 456) {
-                gpu_counter = 0;
+            if (gb->gpu.counter == 456) {
+                gb->gpu.counter = 0;
 
-                y_pos++;
+                gb->gpu.y_pos++;
 
                 // Write y position to LY register
-                mem_write_byte(gb, REG_LY, y_pos);
+                mem_write_byte(gb, REG_LY, gb->gpu.y_pos);
             }
 
-            if (y_pos == 154) {
+            if (gb->gpu.y_pos == 154) {
                 // Restart
-                lcd_mode = LCD_MODE_2_OAM;
+                gb->gpu.lcd_mode = LCD_MODE_2_OAM;
                 write_mode(gb);
 
-                x_pos = 0;
-                y_pos = 0;
+                gb->gpu.x_pos = 0;
+                gb->gpu.y_pos = 0;
                 
                 // Write y position to LY register
-                mem_write_byte(gb, REG_LY, y_pos);
+                mem_write_byte(gb, REG_LY, gb->gpu.y_pos);
             }
 
             break;
 
         case LCD_MODE_2_OAM:
-            gpu_counter++;
+            gb->gpu.counter++;
 
-            if (gpu_counter > 80) {
-                gpu_counter = 0;
+            if (gb->gpu.counter > 80) {
+                gb->gpu.counter = 0;
 
-                // Index of sprite on line (max of 10)
-                uint8_t sprite_array_index = 0;
+                if (render_this_frame) {
+                    scan_oam(gb);
 
-                // Reset line sprite array
-                memset(line_sprites, SPRITE_INDEX_NO_SPRITE, sizeof(line_sprites));
-                
-                if (mem_read_byte(gb, REG_LCDC) | LCDC_OBJ_ON) {
-                    // Loop through all of OAM to find the first 10 sprites that are
-                    // on the current line
-                    for (uint8_t i = 0; i < 40; i++) {
-                        uint32_t sprite_val = get_oam_entry(gb, i);
-
-                        if (sprite_at_y(gb, i, y_pos)) {
-                            // On current line - add to array
-                            line_sprites[sprite_array_index++] = i;
-                        }
-
-                        if (sprite_array_index == 10) {
-                            // Reached max number of sprites
-                            break;
-                        }
+                    if (render_mode != GPU_RENDER_SERIAL) {
+                        snapshot_line(gb);
                     }
                 }
 
-                lcd_mode = LCD_MODE_3_TRANSFER;
+                gb->gpu.lcd_mode = LCD_MODE_3_TRANSFER;
                 write_mode(gb);
             }
 
@@ -402,21 +886,37 @@ int gpu_tick(gb_t *gb) {
 
         case LCD_MODE_3_TRANSFER:
             // Calculate pixel
-            calculate_pixel(gb, x_pos, y_pos);
+            if (render_this_frame && (render_mode != GPU_RENDER_PARALLEL || line_inline[gb->gpu.y_pos])) {
+                capture_line_registers(gb, &current_line);
+
+                uint8_t pixel = calculate_pixel(&current_line, gb->gpu.x_pos, gb->gpu.y_pos);
 
-            if (x_pos < (DISPLAY_WIDTH - 1)) {
-                x_pos++;
+                if (render_mode != GPU_RENDER_PARALLEL) {
+                    put_pixel(gb->gpu.pixel_buffer, gb->gpu.x_pos, gb->gpu.y_pos, pixel);
+                }
+
+                if (render_mode != GPU_RENDER_SERIAL && line_inline[gb->gpu.y_pos]) {
+                    put_pixel(parallel_buffer(gb), gb->gpu.x_pos, gb->gpu.y_pos, pixel);
+                }
+            }
+
+            if (gb->gpu.x_pos < (DISPLAY_WIDTH - 1)) {
+                gb->gpu.x_pos++;
             } else {
-                gpu_counter++;
+                gb->gpu.counter++;
 
-                if (gpu_counter > 296) {
-                    gpu_counter = 0;
+                if (gb->gpu.counter > 296) {
+                    gb->gpu.counter = 0;
 
                     // Reached end of line, go into hblank
-                    lcd_mode = LCD_MODE_0_HBLANK;
+                    gb->gpu.lcd_mode = LCD_MODE_0_HBLANK;
                     write_mode(gb);
+
+                    if (render_this_frame && render_mode != GPU_RENDER_SERIAL && !line_inline[gb->gpu.y_pos]) {
+                        submit_line(gb->gpu.y_pos);
+                    }
                     
-                    x_pos = 0;
+                    gb->gpu.x_pos = 0;
                 }
             }
 
@@ -426,5 +926,5 @@ int gpu_tick(gb_t *gb) {
             break;
     }
 
-    return !glfwWindowShouldClose(window);
+    return gpu_keep_running();
 }
\ No newline at end of file
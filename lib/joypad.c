@@ -1,97 +1,91 @@
 #include <joypad.h>
+#include <scheduler.h>
 
-static struct {
-    union {
-        struct {
-            uint8_t right:1;
-            uint8_t left:1;
-            uint8_t up:1;
-            uint8_t down:1;
-        };
-        struct {
-            uint8_t p14;
-        };
-    };
-    
-    union {
-        struct {
-            uint8_t a:1;
-            uint8_t b:1;
-            uint8_t select:1;
-            uint8_t start:1;
-        };
-        struct {
-            uint8_t p15;
-        };
-    };
-} joypad;
-
-void joypad_init() {
-    joypad.p14 = 0xF;
-    joypad.p15 = 0xF;
-}
+static joypad_input_handler_t *input_handler = NULL;
 
-void key_pressed_callback(GLFWwindow* window, int key, int scancode, int action, int mods) {
-    uint8_t joypad_key_pressed = 1;
+void joypad_init(gb_t *gb) {
+    gb->joypad_buttons = 0;
 
-    switch (key) {
-        case GLFW_KEY_UP:
-            joypad.up = !action;
-            break;
+    gb->input_head = 0;
+    gb->input_tail = 0;
+}
 
-        case GLFW_KEY_DOWN:
-            joypad.down = !action;
-            break;
+void joypad_set_input_handler(joypad_input_handler_t *handler) {
+    input_handler = handler;
+}
 
-        case GLFW_KEY_LEFT:
-            joypad.left = !action;
-            break;
+int joypad_submit(gb_t *gb, uint64_t cycle, uint8_t buttons) {
+    uint8_t tail = gb->input_tail;
+    uint8_t next = (tail + 1) & (INPUT_QUEUE_SIZE - 1);
 
-        case GLFW_KEY_RIGHT:
-            joypad.right = !action;
-            break;
+    if (next == gb->input_head) {
+        return 0;
+    }
 
-        case GLFW_KEY_A:
-            joypad.a = !action;
-            break;
+    if (cycle < gb->cycles) {
+        cycle = gb->cycles;
+    }
 
-        case GLFW_KEY_B:
-            joypad.b = !action;
-            break;
+    // Keep the queue ordered so the head is always the next due
+    if (tail != gb->input_head) {
+        uint64_t last_cycle = gb->input_queue[(tail - 1) & (INPUT_QUEUE_SIZE - 1)].cycle;
 
-        case GLFW_KEY_ENTER:
-            joypad.start = !action;
-            break;
+        if (cycle < last_cycle) {
+            cycle = last_cycle;
+        }
+    }
 
-        case GLFW_KEY_RIGHT_SHIFT:
-            joypad.select = !action;
-            break;
+    gb->input_queue[tail].cycle = cycle;
+    gb->input_queue[tail].buttons = buttons;
+    gb->input_tail = next;
 
-        default:
-            joypad_key_pressed = 0;
+    if (cycle < gb->event_cycles[SCHED_EVENT_INPUT]) {
+        sched_schedule(gb, SCHED_EVENT_INPUT, cycle);
     }
 
-    if (action && joypad_key_pressed) {
-        gb_t *gb = get_gb_instance();
+    return 1;
+}
 
-        // Interrupt
-        mem_write_byte(gb, INTERRUPT_FLAGS, mem_read_byte(gb, INTERRUPT_FLAGS) | INT_FLAG_JOYPAD);
+void joypad_clear_queue(gb_t *gb) {
+    gb->input_head = gb->input_tail;
+    sched_cancel(gb, SCHED_EVENT_INPUT);
+}
+
+void joypad_input_event(gb_t *gb) {
+    while (gb->input_head != gb->input_tail) {
+        gb_input_event_t *event = &gb->input_queue[gb->input_head];
+
+        if (event->cycle > gb->cycles) {
+            sched_schedule(gb, SCHED_EVENT_INPUT, event->cycle);
+            return;
+        }
+
+        if (event->buttons & ~gb->joypad_buttons) {
+            // Interrupt on any newly pressed button
+            mem_write_byte(gb, INTERRUPT_FLAGS, mem_read_byte(gb, INTERRUPT_FLAGS) | INT_FLAG_JOYPAD);
+        }
+
+        gb->joypad_buttons = event->buttons;
+        gb->input_head = (gb->input_head + 1) & (INPUT_QUEUE_SIZE - 1);
+
+        if (input_handler) {
+            input_handler(gb, gb->joypad_buttons);
+        }
     }
 }
 
-void joypad_update_io_registers(gb_t *gb) {
-    uint8_t joypad_mask;
+uint8_t joypad_read_p1(gb_t *gb) {
+    uint8_t select = gb->io_registers[REG_P1 & 0xFF] & (JOYPAD_P14_SELECT | JOYPAD_P15_SELECT);
+    uint8_t pressed = 0;
 
-    uint8_t read_mask = mem_read_byte(gb, REG_P1);
+    // Lines are active low
+    if (!(select & JOYPAD_P14_SELECT)) {
+        pressed |= gb->joypad_buttons & 0xF;
+    }
 
-    if (!(read_mask & (1 << 4))) {
-        joypad_mask = joypad.p14 & 0xF;
-    } else if (!(read_mask & (1 << 5))) {
-        joypad_mask = joypad.p15 & 0xF;
-    } else {
-        return;
+    if (!(select & JOYPAD_P15_SELECT)) {
+        pressed |= gb->joypad_buttons >> 4;
     }
 
-    read_mask &= 0xF0;
-    mem_write_byte(gb, REG_P1, read_mask | joypad_mask);
-}
\ No newline at end of file
+    return 0xC0 | select | (~pressed & 0xF);
+}
@@ -1,109 +1,421 @@
 #include <mbc.h>
+#include <save.h>
+#include <rtc.h>
 
-void mbc_setup(gb_t *gb, FILE* f) {
-    uint8_t cart_type = gb->rom[0x0147];
-    uint8_t rom_size = gb->rom[0x0148];
-    uint8_t ram_size = gb->rom[0x0149];
+typedef struct {
+    void (*update_banks)(gb_t *gb);
+    mbc_write_function_t *write_rom;
+    mbc_read_function_t *read_ram;
+    mbc_write_function_t *write_ram;
+} mbc_handlers_t;
 
-    uint32_t mbc_rom_size = (0x8000 << rom_size) - 0x4000;
-    uint32_t mbc_ram_size = 0x8000 << ((ram_size - 1) * 2);
+/**
+ * Type and features of each cartridge type byte
+ */
+static int cart_type_info(uint8_t cart_type, uint8_t *type, uint8_t *flags) {
+    switch (cart_type) {
+        case 0x00: *type = MBC_TYPE_NONE; *flags = 0; break;
+        case 0x08: *type = MBC_TYPE_NONE; *flags = MBC_FLAG_RAM; break;
+        case 0x09: *type = MBC_TYPE_NONE; *flags = MBC_FLAG_RAM | MBC_FLAG_BATTERY; break;
 
-    printf("Ram size: %i\n", mbc_ram_size);
-    printf("Rom size: %i\n", mbc_rom_size);
+        case 0x01: *type = MBC_TYPE_MBC1; *flags = 0; break;
+        case 0x02: *type = MBC_TYPE_MBC1; *flags = MBC_FLAG_RAM; break;
+        case 0x03: *type = MBC_TYPE_MBC1; *flags = MBC_FLAG_RAM | MBC_FLAG_BATTERY; break;
 
-    gb->mbc_rom = malloc(mbc_rom_size);
+        case 0x05: *type = MBC_TYPE_MBC2; *flags = MBC_FLAG_RAM; break;
+        case 0x06: *type = MBC_TYPE_MBC2; *flags = MBC_FLAG_RAM | MBC_FLAG_BATTERY; break;
 
-    if (ram_size > 0) {
-        gb->mbc_ram = malloc(mbc_ram_size);
+        case 0x0F: *type = MBC_TYPE_MBC3; *flags = MBC_FLAG_RTC | MBC_FLAG_BATTERY; break;
+        case 0x10: *type = MBC_TYPE_MBC3; *flags = MBC_FLAG_RTC | MBC_FLAG_RAM | MBC_FLAG_BATTERY; break;
+        case 0x11: *type = MBC_TYPE_MBC3; *flags = 0; break;
+        case 0x12: *type = MBC_TYPE_MBC3; *flags = MBC_FLAG_RAM; break;
+        case 0x13: *type = MBC_TYPE_MBC3; *flags = MBC_FLAG_RAM | MBC_FLAG_BATTERY; break;
+
+        case 0x19: *type = MBC_TYPE_MBC5; *flags = 0; break;
+        case 0x1A: *type = MBC_TYPE_MBC5; *flags = MBC_FLAG_RAM; break;
+        case 0x1B: *type = MBC_TYPE_MBC5; *flags = MBC_FLAG_RAM | MBC_FLAG_BATTERY; break;
+        case 0x1C: *type = MBC_TYPE_MBC5; *flags = MBC_FLAG_RUMBLE; break;
+        case 0x1D: *type = MBC_TYPE_MBC5; *flags = MBC_FLAG_RUMBLE | MBC_FLAG_RAM; break;
+        case 0x1E: *type = MBC_TYPE_MBC5; *flags = MBC_FLAG_RUMBLE | MBC_FLAG_RAM | MBC_FLAG_BATTERY; break;
+
+        default:
+            return 0;
     }
 
-    gb->current_ram_bank = 0;
-    gb->current_rom_bank = 0;
-    gb->rom_ram_mode = MBC_ROM_MODE;
+    return 1;
+}
+
+/**
+ * Size in bytes of the RAM size header byte
+ */
+static uint32_t cart_ram_size(uint8_t ram_size) {
+    switch (ram_size) {
+        case 1: return 0x800;
+        case 2: return 0x2000;
+        case 3: return 0x8000;
+        case 4: return 0x20000;
+        case 5: return 0x10000;
+        default: return 0;
+    }
+}
+
+/**
+ * Point the switchable areas at ROM and RAM banks, wrapping past the end of the cartridge
+ */
+static void map_banks(gb_t *gb, uint32_t rom_bank_0, uint32_t rom_bank, uint32_t ram_bank) {
+    uint32_t rom_banks = gb->mbc_rom_size / MBC_ROM_BANK_SIZE;
 
-    // Load cartridge into rom
+    gb->rom = gb->mbc_rom + (rom_bank_0 % rom_banks) * MBC_ROM_BANK_SIZE;
+    gb->rom_bank = gb->mbc_rom + (rom_bank % rom_banks) * MBC_ROM_BANK_SIZE;
 
-    // Move to the position of the second bank.
-    fseek(f, 0x4000, SEEK_SET);
-    fread(gb->mbc_rom, mbc_rom_size, 1, f);
+    if (gb->ram_enabled && gb->mbc_ram_size) {
+        uint32_t ram_banks = (gb->mbc_ram_size + MBC_RAM_BANK_SIZE - 1) / MBC_RAM_BANK_SIZE;
+        gb->ram_bank = gb->mbc_ram + (ram_bank % ram_banks) * MBC_RAM_BANK_SIZE;
+    } else {
+        gb->ram_bank = NULL;
+    }
 }
 
-uint8_t mbc_read_rom_bank(gb_t *gb, uint16_t address) {
-    return gb->mbc_rom[(0x4000 * (gb->current_rom_bank - 1)) + (address & 0x3FFF)];
+/* NO MBC */
+
+static void none_update_banks(gb_t *gb) {
+    map_banks(gb, 0, 1, 0);
 }
 
-void mbc_write_rom_bank(gb_t *gb, uint16_t address, uint8_t value) {
-    // MBC1 - so far
+static void none_write_rom(gb_t *gb, uint16_t address, uint8_t value) {
+    // Nothing to switch
+}
+
+/**
+ * Read from the mapped RAM bank, open bus if there is none
+ */
+static uint8_t banked_read_ram(gb_t *gb, uint16_t address) {
+    if (!gb->ram_bank) {
+        return 0xFF;
+    }
+
+    return gb->ram_bank[address & gb->ram_bank_mask];
+}
 
+static void banked_write_ram(gb_t *gb, uint16_t address, uint8_t value) {
+    if (gb->ram_bank) {
+        gb->ram_bank[address & gb->ram_bank_mask] = value;
+    }
+}
+
+/**
+ * Enable or disable RAM from a write to 0x0000-0x1FFF. Games disable RAM
+ * once they are done saving, so flush the save file then
+ */
+static void write_ram_enable(gb_t *gb, uint8_t value) {
+    uint8_t enabled = (value & 0x0F) == 0x0A;
+
+    if (gb->ram_enabled && !enabled) {
+        save_request_flush();
+    }
+
+    gb->ram_enabled = enabled;
+}
+
+/* MBC1 */
+
+static void mbc1_update_banks(gb_t *gb) {
+    // Bank 1 register is 5 bits, or 4 wired on multicarts
+    uint8_t shift = gb->mbc_flags & MBC_FLAG_MULTICART ? 4 : 5;
+    uint32_t bank_1 = gb->current_rom_bank & ((1 << shift) - 1);
+    uint32_t bank_2 = gb->current_ram_bank << shift;
+
+    if (gb->rom_ram_mode == MBC_RAM_MODE) {
+        // Bank 2 also applies to the fixed ROM area and selects the RAM bank
+        map_banks(gb, bank_2, bank_2 | bank_1, gb->current_ram_bank);
+    } else {
+        map_banks(gb, 0, bank_2 | bank_1, 0);
+    }
+}
+
+static void mbc1_write_rom(gb_t *gb, uint16_t address, uint8_t value) {
     if (address < 0x2000) {
         // Enable ram bank
-
-        if (value == 0x0A) {
-            // Enable
-        } else {
-            // Disable
-        }
+        write_ram_enable(gb, value);
     } else if (address < 0x4000) {
-        // Switch rom bank (lower 5 bits)
+        // Switch rom bank (lower 5 bits), 0 is treated as 1 before masking
+        value &= 0x1F;
 
         if (value == 0) {
             value = 1;
         }
 
-        gb->current_rom_bank &= 0xE0;
-        gb->current_rom_bank |= value & 0x1F;
+        gb->current_rom_bank = value;
     } else if (address < 0x6000) {
         // Switch rom bank (upper 2 bits) / switch ram
+        gb->current_ram_bank = value & 0x03;
+    } else {
+        // Rom/ram mode
+        gb->rom_ram_mode = value & 1;
+    }
 
-        if (gb->rom_ram_mode == MBC_ROM_MODE) {
-            gb->current_rom_bank &= 0x1F;
-            gb->current_rom_bank |= value & 0xE0;
-        } else {
-            if (value < 8) {
-                gb->current_ram_bank = value;
-            }
+    mbc1_update_banks(gb);
+}
+
+/* MBC2 */
+
+static void mbc2_update_banks(gb_t *gb) {
+    map_banks(gb, 0, gb->current_rom_bank, 0);
+}
+
+static void mbc2_write_rom(gb_t *gb, uint16_t address, uint8_t value) {
+    if (address >= 0x4000) {
+        return;
+    }
+
+    // Address bit 8 picks between ram enable and rom bank
+    if (address & 0x100) {
+        value &= 0x0F;
+
+        if (value == 0) {
+            value = 1;
         }
-    } else if (address < 0x8000) {
-        // Rom/ram mode
-        if (value < 2) {
-            gb->rom_ram_mode = value;
+
+        gb->current_rom_bank = value;
+    } else {
+        write_ram_enable(gb, value);
+    }
+
+    mbc2_update_banks(gb);
+}
+
+/**
+ * Built in RAM is 4 bits wide and repeats through the whole area
+ */
+static uint8_t mbc2_read_ram(gb_t *gb, uint16_t address) {
+    if (!gb->ram_bank) {
+        return 0xFF;
+    }
+
+    return 0xF0 | gb->ram_bank[address & (MBC2_RAM_SIZE - 1)];
+}
+
+static void mbc2_write_ram(gb_t *gb, uint16_t address, uint8_t value) {
+    if (gb->ram_bank) {
+        gb->ram_bank[address & (MBC2_RAM_SIZE - 1)] = value & 0x0F;
+    }
+}
+
+/* MBC3 */
+
+static void mbc3_update_banks(gb_t *gb) {
+    map_banks(gb, 0, gb->current_rom_bank, gb->current_ram_bank & 0x03);
+
+    if (gb->current_ram_bank > 0x03) {
+        // Clock registers aren't backed by RAM
+        gb->ram_bank = NULL;
+    }
+}
+
+static void mbc3_write_rom(gb_t *gb, uint16_t address, uint8_t value) {
+    if (address < 0x2000) {
+        // Enable ram bank and clock
+        write_ram_enable(gb, value);
+    } else if (address < 0x4000) {
+        // Switch rom bank
+        value &= 0x7F;
+
+        if (value == 0) {
+            value = 1;
         }
+
+        gb->current_rom_bank = value;
+    } else if (address < 0x6000) {
+        // Switch ram bank, or 0x08-0x0C for a clock register
+        gb->current_ram_bank = value;
+    } else {
+        // Latch clock data on writing 0 then 1
+        if (gb->rtc_latch_write == 0 && value == 1 && gb->mbc_flags & MBC_FLAG_RTC) {
+            rtc_latch(gb);
+        }
+
+        gb->rtc_latch_write = value;
+    }
+
+    mbc3_update_banks(gb);
+}
+
+/**
+ * Whether a clock register is selected in place of RAM
+ */
+static uint8_t mbc3_rtc_selected(gb_t *gb) {
+    return gb->ram_enabled && gb->mbc_flags & MBC_FLAG_RTC && gb->current_ram_bank >= RTC_REG_S && gb->current_ram_bank <= RTC_REG_DH;
+}
+
+static uint8_t mbc3_read_ram(gb_t *gb, uint16_t address) {
+    if (mbc3_rtc_selected(gb)) {
+        return rtc_read(gb, gb->current_ram_bank);
+    }
+
+    return banked_read_ram(gb, address);
+}
+
+static void mbc3_write_ram(gb_t *gb, uint16_t address, uint8_t value) {
+    if (mbc3_rtc_selected(gb)) {
+        rtc_write(gb, gb->current_ram_bank, value);
+        return;
+    }
+
+    banked_write_ram(gb, address, value);
+}
+
+/* MBC5 */
+
+static void mbc5_update_banks(gb_t *gb) {
+    map_banks(gb, 0, gb->current_rom_bank, gb->current_ram_bank);
+}
+
+static void mbc5_write_rom(gb_t *gb, uint16_t address, uint8_t value) {
+    if (address < 0x2000) {
+        // Enable ram bank
+        write_ram_enable(gb, value);
+    } else if (address < 0x3000) {
+        // Switch rom bank (lower 8 bits), bank 0 can be selected
+        gb->current_rom_bank = (gb->current_rom_bank & 0x100) | value;
+    } else if (address < 0x4000) {
+        // Switch rom bank (bit 9)
+        gb->current_rom_bank = (gb->current_rom_bank & 0xFF) | ((value & 1) << 8);
+    } else if (address < 0x6000) {
+        // Switch ram bank, bit 3 drives the motor on rumble carts
+        gb->current_ram_bank = value & (gb->mbc_flags & MBC_FLAG_RUMBLE ? 0x07 : 0x0F);
     }
 
-    // MBC3 - so far
-    
-    // if (address < 0x2000) {
-    //     // Enable ram bank
+    mbc5_update_banks(gb);
+}
 
-    //     if (value == 0x0A) {
-    //         // Enable
-    //     } else {
-    //         // Disable
-    //     }
-    // } else if (address < 0x4000) {
-    //     // Switch rom bank
+static const mbc_handlers_t mbc_handlers[MBC_TYPE_COUNT] = {
+    { none_update_banks, none_write_rom, banked_read_ram, banked_write_ram },  // MBC_TYPE_NONE
+    { mbc1_update_banks, mbc1_write_rom, banked_read_ram, banked_write_ram },  // MBC_TYPE_MBC1
+    { mbc2_update_banks, mbc2_write_rom, mbc2_read_ram, mbc2_write_ram },      // MBC_TYPE_MBC2
+    { mbc3_update_banks, mbc3_write_rom, mbc3_read_ram, mbc3_write_ram },      // MBC_TYPE_MBC3
+    { mbc5_update_banks, mbc5_write_rom, banked_read_ram, banked_write_ram },  // MBC_TYPE_MBC5
+};
 
-    //     if (value == 0) {
-    //         value = 1;
-    //     }
+/**
+ * MBC1 multicarts are 1MB with a second copy of the logo at the start of the second game
+ */
+static uint8_t detect_multicart(gb_t *gb) {
+    if (gb->mbc_type != MBC_TYPE_MBC1 || gb->mbc_rom_size != 0x100000) {
+        return 0;
+    }
 
-    //     gb->current_rom_bank = value;
-    // } else if (address < 0x6000) {
-    //     // Switch rom bank (upper 2 bits) / switch ram
-    //     if (value < 8) {
-    //         gb->current_ram_bank = value;
-    //     }
-    // } else if (address < 0x8000) {
-    //     // Latch clock data
-    // }
+    return !memcmp(gb->mbc_rom + CART_LOGO, gb->mbc_rom + 0x10 * MBC_ROM_BANK_SIZE + CART_LOGO, CART_LOGO_SIZE);
+}
+
+int mbc_setup(gb_t *gb, FILE* f) {
+    fseek(f, 0, SEEK_END);
+    long file_size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    if (file_size < 2 * MBC_ROM_BANK_SIZE) {
+        printf("Rom too small: %li\n", file_size);
+        return 0;
+    }
+
+    if (file_size > MBC_MAX_ROM_SIZE) {
+        printf("Rom too large: %li\n", file_size);
+        return 0;
+    }
+
+    uint8_t header[CART_HEADER_END];
+
+    if (fread(header, sizeof(header), 1, f) != 1) {
+        printf("Failed to read cartridge header\n");
+        return 0;
+    }
+
+    fseek(f, 0, SEEK_SET);
+
+    if (!cart_type_info(header[CART_TYPE], &gb->mbc_type, &gb->mbc_flags)) {
+        printf("Unsupported cartridge type: 0x%02X\n", header[CART_TYPE]);
+        return 0;
+    }
+
+    // Trust the header over the file size, but never read less than the file
+    if (header[CART_ROM_SIZE] <= MBC_MAX_ROM_SIZE_CODE) {
+        gb->mbc_rom_size = 0x8000 << header[CART_ROM_SIZE];
+    } else {
+        printf("Unknown ROM size code 0x%02X, using the file size\n", header[CART_ROM_SIZE]);
+        gb->mbc_rom_size = 2 * MBC_ROM_BANK_SIZE;
+    }
+
+    while (gb->mbc_rom_size < file_size) {
+        gb->mbc_rom_size <<= 1;
+    }
+
+    if (gb->mbc_type == MBC_TYPE_MBC2) {
+        gb->mbc_ram_size = MBC2_RAM_SIZE;
+    } else if (gb->mbc_flags & MBC_FLAG_RAM) {
+        gb->mbc_ram_size = cart_ram_size(header[CART_RAM_SIZE]);
+    } else {
+        gb->mbc_ram_size = 0;
+    }
+
+    printf("Ram size: %i\n", gb->mbc_ram_size);
+    printf("Rom size: %i\n", gb->mbc_rom_size);
+
+    // Unused space reads as open bus
+    gb->mbc_rom = malloc(gb->mbc_rom_size);
+    memset(gb->mbc_rom, 0xFF, gb->mbc_rom_size);
+
+    if (fread(gb->mbc_rom, file_size, 1, f) != 1) {
+        printf("Failed to read ROM\n");
+        free(gb->mbc_rom);
+        gb->mbc_rom = NULL;
+        return 0;
+    }
+
+    // Replaced by the save file mapping for battery backed carts
+    gb->mbc_ram = calloc(gb->mbc_ram_size, 1);
+
+    // RAM smaller than a bank repeats through it
+    gb->ram_bank_mask = gb->mbc_ram_size && gb->mbc_ram_size < MBC_RAM_BANK_SIZE ? gb->mbc_ram_size - 1 : MBC_RAM_BANK_SIZE - 1;
+
+    if (detect_multicart(gb)) {
+        gb->mbc_flags |= MBC_FLAG_MULTICART;
+    }
+
+    gb->ram_enabled = gb->mbc_type == MBC_TYPE_NONE;
+    gb->current_ram_bank = 0;
+    gb->current_rom_bank = 1;
+    gb->rom_ram_mode = MBC_ROM_MODE;
+
+    rtc_init(gb);
+
+    map_banks(gb, 0, 1, 0);
+
+    return 1;
+}
+
+void mbc_share_cartridge(gb_t *copy, gb_t *gb) {
+    // Everything mbc_setup sets outside the saved state
+    copy->mbc_type = gb->mbc_type;
+    copy->mbc_flags = gb->mbc_flags;
+    copy->mbc_rom = gb->mbc_rom;
+    copy->mbc_rom_size = gb->mbc_rom_size;
+    copy->mbc_ram_size = gb->mbc_ram_size;
+    copy->mbc_ram = calloc(gb->mbc_ram_size ? gb->mbc_ram_size : 1, 1);
+    copy->ram_bank_mask = gb->ram_bank_mask;
+    copy->rtc_footer = NULL;
+}
+
+void mbc_update_banks(gb_t *gb) {
+    mbc_handlers[gb->mbc_type].update_banks(gb);
+}
+
+void mbc_write_rom_bank(gb_t *gb, uint16_t address, uint8_t value) {
+    mbc_handlers[gb->mbc_type].write_rom(gb, address, value);
 }
 
 uint8_t mbc_read_ram_bank(gb_t *gb, uint16_t address) {
-    // TODO: deal with accessing ram that's not there (e.g. when in 2kb ram mode)
-    return 0;
-    // return gb->mbc_ram[(gb->current_ram_bank * 0x2000) + (address & 0x1FFF)];
+    return mbc_handlers[gb->mbc_type].read_ram(gb, address);
 }
 
 void mbc_write_ram_bank(gb_t *gb, uint16_t address, uint8_t value) {
-    // gb->mbc_ram[(gb->current_ram_bank * 0x2000) + (address & 0x1FFF)] = value;
-}
\ No newline at end of file
+    mbc_handlers[gb->mbc_type].write_ram(gb, address, value);
+}
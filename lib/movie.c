@@ -0,0 +1,526 @@
+#include <movie.h>
+#include <joypad.h>
+#include <gb_memory.h>
+#include <state.h>
+#include <boot.h>
+#include <scheduler.h>
+
+// Movie being recorded, for the input handler
+static movie_t *recording = NULL;
+
+/* FILE LAYOUT */
+
+static void write_le(FILE *f, uint64_t value, uint8_t bytes) {
+    for (uint8_t i = 0; i < bytes; i++) {
+        fputc((value >> (i * 8)) & 0xFF, f);
+    }
+}
+
+static void write_varint(FILE *f, uint64_t value) {
+    while (value >= 0x80) {
+        fputc((value & 0x7F) | 0x80, f);
+        value >>= 7;
+    }
+
+    fputc(value, f);
+}
+
+// Position in a movie being read. Reads past the end set overrun
+typedef struct {
+    const uint8_t *data;
+    size_t size;
+    size_t offset;
+    uint8_t overrun;
+} movie_reader_t;
+
+static uint64_t read_le(movie_reader_t *reader, uint8_t bytes) {
+    if (reader->offset + bytes > reader->size) {
+        reader->overrun = 1;
+        return 0;
+    }
+
+    uint64_t value = 0;
+
+    for (uint8_t i = 0; i < bytes; i++) {
+        value |= (uint64_t)reader->data[reader->offset++] << (i * 8);
+    }
+
+    return value;
+}
+
+static uint64_t read_varint(movie_reader_t *reader) {
+    uint64_t value = 0;
+    uint8_t shift = 0;
+    uint8_t byte;
+
+    do {
+        byte = read_le(reader, 1);
+        value |= (uint64_t)(byte & 0x7F) << shift;
+        shift += 7;
+    } while ((byte & 0x80) && !reader->overrun && shift < 64);
+
+    return value;
+}
+
+static const uint8_t *read_bytes(movie_reader_t *reader, size_t size) {
+    if (reader->offset + size > reader->size) {
+        reader->overrun = 1;
+        return NULL;
+    }
+
+    reader->offset += size;
+
+    return reader->data + reader->offset - size;
+}
+
+/* RECORDING */
+
+static uint64_t hash_bytes(uint64_t hash, const uint8_t *data, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        hash ^= data[i];
+        hash *= 0x100000001B3;
+    }
+
+    return hash;
+}
+
+/**
+ * Hash the frame and the machine's RAM
+ */
+static void take_checkpoint(gb_t *gb, uint8_t drawn, movie_checkpoint_t *checkpoint) {
+    uint64_t hash = 0xCBF29CE484222325;
+
+    hash = hash_bytes(hash, gb->ram, RAM_SIZE);
+    hash = hash_bytes(hash, gb->hram, HIGH_SPEED_RAM_SIZE);
+    hash = hash_bytes(hash, gb->mbc_ram, gb->mbc_ram_size);
+
+    checkpoint->frame = gpu_frame_count(gb);
+    checkpoint->drawn = drawn;
+    checkpoint->frame_hash = gpu_frame_hash(gb);
+    checkpoint->ram_hash = hash;
+}
+
+static void add_checkpoint(movie_t *movie, const movie_checkpoint_t *checkpoint) {
+    if (movie->checkpoint_count == movie->checkpoint_capacity) {
+        movie->checkpoint_capacity = movie->checkpoint_capacity ? movie->checkpoint_capacity * 2 : 256;
+        movie->checkpoints = realloc(movie->checkpoints, sizeof(movie_checkpoint_t) * movie->checkpoint_capacity);
+    }
+
+    movie->checkpoints[movie->checkpoint_count++] = *checkpoint;
+}
+
+static void add_event(movie_t *movie, uint64_t cycle, uint8_t buttons) {
+    if (movie->event_count == movie->event_capacity) {
+        movie->event_capacity = movie->event_capacity ? movie->event_capacity * 2 : 256;
+        movie->events = realloc(movie->events, sizeof(gb_input_event_t) * movie->event_capacity);
+    }
+
+    movie->events[movie->event_count].cycle = cycle;
+    movie->events[movie->event_count].buttons = buttons;
+    movie->event_count++;
+}
+
+/**
+ * Record input on the cycle it takes effect, so playback can queue it for exactly then
+ */
+static void record_input(gb_t *gb, uint8_t buttons) {
+    add_event(recording, gb->cycles, buttons);
+}
+
+static void add_keyframe(movie_t *movie, uint32_t frame, uint8_t *state, uint32_t state_size) {
+    if (movie->keyframe_count == movie->keyframe_capacity) {
+        movie->keyframe_capacity = movie->keyframe_capacity ? movie->keyframe_capacity * 2 : 16;
+        movie->keyframes = realloc(movie->keyframes, sizeof(movie_keyframe_t) * movie->keyframe_capacity);
+    }
+
+    movie->keyframes[movie->keyframe_count].frame = frame;
+    movie->keyframes[movie->keyframe_count].state = state;
+    movie->keyframes[movie->keyframe_count].state_size = state_size;
+    movie->keyframe_count++;
+}
+
+int movie_record(movie_t *movie, gb_t *gb, uint32_t checkpoint_interval, uint32_t keyframe_interval, uint8_t skip_bios, uint8_t power_on) {
+    memset(movie, 0, sizeof(*movie));
+
+    if (gb->rtc_host_time) {
+        printf("Movies need the cartridge clock to follow emulated time\n");
+        return 0;
+    }
+
+    movie->mode = MOVIE_MODE_RECORD;
+    movie->checkpoint_interval = checkpoint_interval ? checkpoint_interval : 1;
+    movie->keyframe_interval = keyframe_interval;
+    movie->start_frame = gpu_frame_count(gb);
+    movie->end_frame = movie->start_frame;
+
+    memcpy(movie->cart, gb->mbc_rom + CART_TITLE, MOVIE_CART_HEADER_SIZE);
+
+    if (power_on && !(gb->mbc_flags & MBC_FLAG_BATTERY)) {
+        movie->flags = skip_bios ? MOVIE_FLAG_SKIP_BIOS : 0;
+    } else {
+        // Battery RAM and loaded states can't be reproduced from the cartridge alone
+        movie->flags = MOVIE_FLAG_STATE;
+        movie->state_size = state_size(gb);
+        movie->state = malloc(movie->state_size);
+
+        state_save(gb, movie->state, movie->state_size);
+    }
+
+    recording = movie;
+    joypad_set_input_handler(record_input);
+
+    return 1;
+}
+
+int movie_save(movie_t *movie, gb_t *gb, const char *path) {
+    joypad_set_input_handler(NULL);
+    recording = NULL;
+
+    // Always finish on a checkpoint
+    if (movie->end_frame > movie->start_frame
+        && (!movie->checkpoint_count || movie->checkpoints[movie->checkpoint_count - 1].frame != movie->last.frame)) {
+        add_checkpoint(movie, &movie->last);
+    }
+
+    return movie_write(movie, path);
+}
+
+int movie_write(const movie_t *movie, const char *path) {
+    FILE *f = fopen(path, "wb");
+
+    if (!f) {
+        printf("Failed to open %s\n", path);
+        return 0;
+    }
+
+    fwrite(MOVIE_MAGIC, 1, 4, f);
+    write_le(f, MOVIE_VERSION, 4);
+    write_le(f, movie->flags, 4);
+    fwrite(movie->cart, 1, MOVIE_CART_HEADER_SIZE, f);
+    write_le(f, movie->start_frame, 4);
+    write_le(f, movie->end_frame, 4);
+    write_le(f, movie->checkpoint_interval, 4);
+
+    if (movie->flags & MOVIE_FLAG_STATE) {
+        write_le(f, movie->state_size, 4);
+        fwrite(movie->state, 1, movie->state_size, f);
+    }
+
+    write_le(f, movie->event_count, 4);
+
+    uint64_t last_cycle = 0;
+
+    for (uint32_t i = 0; i < movie->event_count; i++) {
+        write_varint(f, movie->events[i].cycle - last_cycle);
+        fputc(movie->events[i].buttons, f);
+
+        last_cycle = movie->events[i].cycle;
+    }
+
+    write_le(f, movie->checkpoint_count, 4);
+
+    for (uint32_t i = 0; i < movie->checkpoint_count; i++) {
+        write_le(f, movie->checkpoints[i].frame, 4);
+        fputc(movie->checkpoints[i].drawn, f);
+        write_le(f, movie->checkpoints[i].frame_hash, 8);
+        write_le(f, movie->checkpoints[i].ram_hash, 8);
+    }
+
+    write_le(f, movie->keyframe_count, 4);
+
+    for (uint32_t i = 0; i < movie->keyframe_count; i++) {
+        write_le(f, movie->keyframes[i].frame, 4);
+        write_le(f, movie->keyframes[i].state_size, 4);
+        fwrite(movie->keyframes[i].state, 1, movie->keyframes[i].state_size, f);
+    }
+
+    int written = !ferror(f);
+
+    fclose(f);
+
+    return written;
+}
+
+/* PLAYBACK */
+
+/**
+ * Parse a whole movie file
+ */
+static int movie_parse(movie_t *movie, const uint8_t *data, size_t size) {
+    movie_reader_t reader = { data, size, 0, 0 };
+
+    const uint8_t *magic = read_bytes(&reader, 4);
+
+    if (!magic || memcmp(magic, MOVIE_MAGIC, 4)) {
+        printf("Not a movie\n");
+        return 0;
+    }
+
+    uint32_t version = read_le(&reader, 4);
+
+    if (version < 1 || version > MOVIE_VERSION) {
+        printf("Movie version %u, expected %u\n", version, MOVIE_VERSION);
+        return 0;
+    }
+
+    movie->flags = read_le(&reader, 4);
+
+    const uint8_t *cart = read_bytes(&reader, MOVIE_CART_HEADER_SIZE);
+
+    if (cart) {
+        memcpy(movie->cart, cart, MOVIE_CART_HEADER_SIZE);
+    }
+
+    movie->start_frame = read_le(&reader, 4);
+    movie->end_frame = read_le(&reader, 4);
+    movie->checkpoint_interval = read_le(&reader, 4);
+
+    if (movie->flags & MOVIE_FLAG_STATE) {
+        movie->state_size = read_le(&reader, 4);
+
+        const uint8_t *state = read_bytes(&reader, movie->state_size);
+
+        if (state) {
+            movie->state = malloc(movie->state_size);
+            memcpy(movie->state, state, movie->state_size);
+        }
+    }
+
+    uint32_t event_count = read_le(&reader, 4);
+    uint64_t cycle = 0;
+
+    for (uint32_t i = 0; i < event_count && !reader.overrun; i++) {
+        cycle += read_varint(&reader);
+        add_event(movie, cycle, read_le(&reader, 1));
+    }
+
+    uint32_t checkpoint_count = read_le(&reader, 4);
+
+    for (uint32_t i = 0; i < checkpoint_count && !reader.overrun; i++) {
+        movie_checkpoint_t checkpoint;
+
+        checkpoint.frame = read_le(&reader, 4);
+        checkpoint.drawn = read_le(&reader, 1);
+        checkpoint.frame_hash = read_le(&reader, 8);
+        checkpoint.ram_hash = read_le(&reader, 8);
+
+        add_checkpoint(movie, &checkpoint);
+    }
+
+    uint32_t keyframe_count = version >= 2 ? read_le(&reader, 4) : 0;
+
+    for (uint32_t i = 0; i < keyframe_count && !reader.overrun; i++) {
+        uint32_t frame = read_le(&reader, 4);
+        uint32_t state_size = read_le(&reader, 4);
+        const uint8_t *state = read_bytes(&reader, state_size);
+
+        if (!state) {
+            break;
+        }
+
+        // Checked against this machine when loaded
+        uint8_t *copy = malloc(state_size);
+        memcpy(copy, state, state_size);
+
+        add_keyframe(movie, frame, copy, state_size);
+    }
+
+    if (reader.overrun) {
+        printf("Movie truncated\n");
+        return 0;
+    }
+
+    return 1;
+}
+
+int movie_load(movie_t *movie, gb_t *gb, const char *path) {
+    memset(movie, 0, sizeof(*movie));
+
+    FILE *f = fopen(path, "rb");
+
+    if (!f) {
+        printf("Failed to open %s\n", path);
+        return 0;
+    }
+
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    if (size < 0) {
+        printf("Failed to read %s\n", path);
+        fclose(f);
+        return 0;
+    }
+
+    uint8_t *data = malloc(size);
+    size_t read = fread(data, 1, size, f);
+
+    fclose(f);
+
+    int parsed = read == (size_t)size && movie_parse(movie, data, size);
+
+    free(data);
+
+    if (!parsed) {
+        return 0;
+    }
+
+    if (memcmp(movie->cart, gb->mbc_rom + CART_TITLE, MOVIE_CART_HEADER_SIZE)) {
+        printf("Movie is for a different cartridge\n");
+        return 0;
+    }
+
+    return 1;
+}
+
+int movie_start_at(movie_t *movie, gb_t *gb, uint32_t keyframe) {
+    if (keyframe > movie->keyframe_count) {
+        return 0;
+    }
+
+    if (keyframe) {
+        if (!state_load(gb, movie->keyframes[keyframe - 1].state, movie->keyframes[keyframe - 1].state_size)) {
+            return 0;
+        }
+    } else if (movie->flags & MOVIE_FLAG_STATE) {
+        if (!state_load(gb, movie->state, movie->state_size)) {
+            return 0;
+        }
+    } else if (movie->flags & MOVIE_FLAG_SKIP_BIOS) {
+        boot_skip_bios(gb);
+    }
+
+    // Input still queued in the state is in the movie too, on the same cycle
+    joypad_clear_queue(gb);
+
+    movie->next_event = 0;
+
+    while (movie->next_event < movie->event_count && movie->events[movie->next_event].cycle < gb->cycles) {
+        movie->next_event++;
+    }
+
+    movie->next_checkpoint = 0;
+
+    while (movie->next_checkpoint < movie->checkpoint_count && movie->checkpoints[movie->next_checkpoint].frame < gpu_frame_count(gb)) {
+        movie->next_checkpoint++;
+    }
+
+    movie->mode = MOVIE_MODE_PLAY;
+    movie->checked = 0;
+    movie->desynced = 0;
+
+    return 1;
+}
+
+int movie_play(movie_t *movie, gb_t *gb, const char *path) {
+    return movie_load(movie, gb, path) && movie_start_at(movie, gb, 0);
+}
+
+void movie_keyframe(movie_t *movie, gb_t *gb) {
+    uint32_t frame = gpu_frame_count(gb);
+
+    if (!movie->keyframe_interval || frame % movie->keyframe_interval || frame <= movie->start_frame) {
+        return;
+    }
+
+    if (movie->keyframe_count && movie->keyframes[movie->keyframe_count - 1].frame >= frame) {
+        return;
+    }
+
+    uint32_t size = state_size(gb);
+    uint8_t *state = malloc(size);
+    state_save(gb, state, size);
+
+    add_keyframe(movie, frame, state, size);
+}
+
+void movie_feed_input(movie_t *movie, gb_t *gb) {
+    while (movie->next_event < movie->event_count) {
+        gb_input_event_t *event = &movie->events[movie->next_event];
+
+        if (event->cycle >= gb->cycles + MOVIE_INPUT_LOOKAHEAD || !joypad_submit(gb, event->cycle, event->buttons)) {
+            return;
+        }
+
+        movie->next_event++;
+    }
+}
+
+void movie_frame(movie_t *movie, gb_t *gb, uint8_t drawn) {
+    uint32_t frame = gpu_frame_count(gb);
+
+    if (movie->mode == MOVIE_MODE_RECORD) {
+        take_checkpoint(gb, drawn, &movie->last);
+        movie->end_frame = frame + 1;
+
+        if ((frame + 1) % movie->checkpoint_interval == 0) {
+            add_checkpoint(movie, &movie->last);
+        }
+
+        return;
+    }
+
+    if (movie->mode != MOVIE_MODE_PLAY || movie->desynced) {
+        return;
+    }
+
+    while (movie->next_checkpoint < movie->checkpoint_count && movie->checkpoints[movie->next_checkpoint].frame <= frame) {
+        movie_checkpoint_t *expected = &movie->checkpoints[movie->next_checkpoint++];
+
+        if (expected->frame != frame) {
+            continue;
+        }
+
+        movie_checkpoint_t actual;
+        take_checkpoint(gb, drawn, &actual);
+
+        // Frames skipped on either side can't be compared
+        uint8_t frame_matches = !expected->drawn || !drawn || expected->frame_hash == actual.frame_hash;
+
+        if (!frame_matches || expected->ram_hash != actual.ram_hash) {
+            movie->desynced = 1;
+            movie->desync = actual;
+            movie->next_checkpoint--;
+            return;
+        }
+
+        movie->checked++;
+    }
+}
+
+int movie_finished(const movie_t *movie, gb_t *gb) {
+    return movie->desynced || gpu_frame_count(gb) >= movie->end_frame;
+}
+
+void movie_print_result(const movie_t *movie, FILE *f) {
+    if (movie->desynced) {
+        const movie_checkpoint_t *expected = &movie->checkpoints[movie->next_checkpoint];
+
+        fprintf(f, "Movie desynced at frame %u: frame hash %016llX (recorded %016llX), RAM hash %016llX (recorded %016llX)\n",
+            expected->frame, (unsigned long long)movie->desync.frame_hash, (unsigned long long)expected->frame_hash,
+            (unsigned long long)movie->desync.ram_hash, (unsigned long long)expected->ram_hash);
+        return;
+    }
+
+    fprintf(f, "Movie matched: %u frames, %u of %u checkpoints checked\n",
+        movie->end_frame - movie->start_frame, movie->checked, movie->checkpoint_count);
+}
+
+void movie_free(movie_t *movie) {
+    if (recording == movie) {
+        joypad_set_input_handler(NULL);
+        recording = NULL;
+    }
+
+    for (uint32_t i = 0; i < movie->keyframe_count; i++) {
+        free(movie->keyframes[i].state);
+    }
+
+    free(movie->keyframes);
+    free(movie->state);
+    free(movie->events);
+    free(movie->checkpoints);
+
+    memset(movie, 0, sizeof(*movie));
+}
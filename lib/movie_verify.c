@@ -0,0 +1,282 @@
+#include <movie_verify.h>
+#include <joypad.h>
+#include <state.h>
+#include <pacer.h>
+
+#ifndef _WIN32
+    #include <unistd.h>
+    #include <sys/wait.h>
+#endif
+
+/**
+ * Save the machine with its input queue emptied. Playback queues input
+ * ahead of the machine, so the queue differs from the recording's
+ */
+static void save_without_queue(gb_t *gb, uint8_t *buffer, size_t size) {
+    joypad_clear_queue(gb);
+    memset(gb->input_queue, 0, sizeof(gb->input_queue));
+    gb->input_head = 0;
+    gb->input_tail = 0;
+
+    state_save(gb, buffer, size);
+}
+
+/**
+ * Frame the segment starting at a keyframe (0 for the start of the movie) ends on
+ */
+static uint32_t segment_end(const movie_t *movie, uint32_t segment) {
+    return segment < movie->keyframe_count ? movie->keyframes[segment].frame : movie->end_frame;
+}
+
+/**
+ * Play one segment and check it against the recording
+ */
+static void play_segment(movie_t *movie, gb_t *gb, uint32_t segment, movie_segment_result_t *result) {
+    clock_t start = clock();
+
+    memset(result, 0, sizeof(*result));
+
+    if (!movie_start_at(movie, gb, segment)) {
+        result->status = MOVIE_VERIFY_STATE;
+        result->frame = segment ? movie->keyframes[segment - 1].frame : movie->start_frame;
+        return;
+    }
+
+    uint32_t end = segment_end(movie, segment);
+
+    while (!movie->desynced && gpu_frame_count(gb) < end) {
+        movie_feed_input(movie, gb);
+        gb_run(gb);
+    }
+
+    result->checked = movie->checked;
+
+    if (movie->desynced) {
+        result->status = MOVIE_VERIFY_DESYNC;
+        result->frame = movie->checkpoints[movie->next_checkpoint].frame;
+    } else if (segment < movie->keyframe_count) {
+        // The next segment starts from the recorded state, so this one has to end on it
+        movie_keyframe_t *keyframe = &movie->keyframes[segment];
+        size_t size = state_size(gb);
+
+        uint8_t *actual = malloc(size);
+        uint8_t *expected = malloc(size);
+
+        save_without_queue(gb, actual, size);
+
+        if (!state_load(gb, keyframe->state, keyframe->state_size)) {
+            memset(expected, 0, size);
+        } else {
+            save_without_queue(gb, expected, size);
+        }
+
+        if (memcmp(actual, expected, size)) {
+            result->status = MOVIE_VERIFY_STATE;
+            result->frame = end;
+        }
+
+        free(actual);
+        free(expected);
+    }
+
+    result->seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+#ifdef _WIN32
+
+/**
+ * No fork, so play the segments one after another
+ */
+static void play_segments(movie_t *movie, gb_t *gb, uint32_t count, uint32_t jobs, movie_segment_result_t *results) {
+    (void)jobs;
+
+    for (uint32_t i = 0; i < count; i++) {
+        play_segment(movie, gb, i, &results[i]);
+    }
+}
+
+#else
+
+/**
+ * Play each segment in a child process of its own, up to jobs at a time.
+ * The renderer keeps per process state, so forking gives every segment a
+ * clean machine without sharing anything. A child that dies counts as failed
+ */
+static void play_segments(movie_t *movie, gb_t *gb, uint32_t count, uint32_t jobs, movie_segment_result_t *results) {
+    pid_t *pids = calloc(count, sizeof(pid_t));
+    int *pipes = calloc(count, sizeof(int));
+
+    uint32_t next = 0;
+    uint32_t running = 0;
+
+    // Anything still buffered would be written again by every child
+    fflush(stdout);
+    fflush(stderr);
+
+    while (next < count || running) {
+        while (next < count && running < jobs) {
+            int fds[2];
+
+            if (pipe(fds)) {
+                printf("Failed to create a pipe for segment %u\n", next);
+                abort();
+            }
+
+            pid_t pid = fork();
+
+            if (pid < 0) {
+                printf("Failed to fork for segment %u\n", next);
+                abort();
+            }
+
+            if (pid == 0) {
+                close(fds[0]);
+
+                movie_segment_result_t result;
+                play_segment(movie, gb, next, &result);
+
+                // Smaller than PIPE_BUF, so written in one go without a reader
+                ssize_t written = write(fds[1], &result, sizeof(result));
+                _exit(written == sizeof(result) ? 0 : 1);
+            }
+
+            close(fds[1]);
+
+            pids[next] = pid;
+            pipes[next] = fds[0];
+
+            next++;
+            running++;
+        }
+
+        int status;
+        pid_t pid = waitpid(-1, &status, 0);
+
+        if (pid < 0) {
+            break;
+        }
+
+        for (uint32_t i = 0; i < next; i++) {
+            if (pids[i] != pid) {
+                continue;
+            }
+
+            if (read(pipes[i], &results[i], sizeof(results[i])) != sizeof(results[i])) {
+                memset(&results[i], 0, sizeof(results[i]));
+                results[i].status = MOVIE_VERIFY_CRASHED;
+                results[i].frame = i ? movie->keyframes[i - 1].frame : movie->start_frame;
+            }
+
+            close(pipes[i]);
+            pids[i] = 0;
+            running--;
+            break;
+        }
+    }
+
+    free(pids);
+    free(pipes);
+}
+
+#endif
+
+/**
+ * Play the whole movie once, storing keyframes as it goes, and write it back
+ */
+static int add_keyframes(movie_t *movie, gb_t *gb, const char *path, uint32_t keyframe_interval) {
+    int64_t start = pacer_now_ns();
+
+    printf("Movie has no keyframes, playing it through to add them\n");
+
+    if (!movie_start_at(movie, gb, 0)) {
+        return 1;
+    }
+
+    movie->keyframe_interval = keyframe_interval;
+
+    while (!movie_finished(movie, gb)) {
+        movie_feed_input(movie, gb);
+        gb_run(gb);
+        movie_keyframe(movie, gb);
+    }
+
+    movie_print_result(movie, stdout);
+
+    if (movie->desynced) {
+        return 1;
+    }
+
+    printf("Played %u frames in %.3f s, added %u keyframes\n",
+        movie->end_frame - movie->start_frame, (pacer_now_ns() - start) / 1e9, movie->keyframe_count);
+
+    if (movie->keyframe_count && !movie_write(movie, path)) {
+        printf("Failed to write movie %s\n", path);
+        return 1;
+    }
+
+    return 0;
+}
+
+int movie_verify(movie_t *movie, gb_t *gb, const char *path, uint32_t jobs, uint32_t keyframe_interval) {
+    if (!movie->keyframe_count) {
+        return keyframe_interval ? add_keyframes(movie, gb, path, keyframe_interval) : 1;
+    }
+
+    if (!jobs) {
+#ifdef _WIN32
+        jobs = 1;
+#else
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        jobs = cores > 0 ? cores : 1;
+#endif
+    }
+
+    uint32_t count = movie->keyframe_count + 1;
+    movie_segment_result_t *results = calloc(count, sizeof(movie_segment_result_t));
+
+    int64_t start = pacer_now_ns();
+
+    play_segments(movie, gb, count, jobs, results);
+
+    double elapsed = (pacer_now_ns() - start) / 1e9;
+    double serial = 0;
+
+    uint32_t checked = 0;
+    int32_t first_failure = -1;
+
+    static const char *status_names[] = { "ok", "desynced", "end state differs", "crashed" };
+
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t from = i ? movie->keyframes[i - 1].frame : movie->start_frame;
+        uint32_t to = segment_end(movie, i);
+
+        printf("Segment %u, frames %u-%u: %s", i, from, to, status_names[results[i].status]);
+
+        if (results[i].status != MOVIE_VERIFY_PASSED) {
+            printf(" at frame %u", results[i].frame);
+
+            if (first_failure < 0) {
+                first_failure = i;
+            }
+        }
+
+        printf(" (%u checkpoints, %.3f s)\n", results[i].checked, results[i].seconds);
+
+        checked += results[i].checked;
+        serial += results[i].seconds;
+    }
+
+    if (first_failure >= 0) {
+        printf("Movie failed verification, first diverging frame %u\n", results[first_failure].frame);
+    } else {
+        printf("Movie matched: %u frames, %u of %u checkpoints checked\n",
+            movie->end_frame - movie->start_frame, checked, movie->checkpoint_count);
+    }
+
+    printf("Verified %u segments on %u jobs in %.3f s, %.3f s of processor time (%.1fx faster than one after another)\n",
+        count, jobs < count ? jobs : count, elapsed, serial, elapsed > 0 ? serial / elapsed : 0);
+
+    free(results);
+
+    return first_failure >= 0;
+}
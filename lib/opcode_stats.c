@@ -0,0 +1,183 @@
+#include <opcode_stats.h>
+
+#if GB_OPCODE_STATS
+
+#include <string.h>
+#include <stdlib.h>
+#include <cpu.h>
+
+#define OPCODE_PREFIX_CB 0xCB
+
+// One line of the report
+typedef struct {
+    uint8_t opcode;
+    uint8_t cb;
+    uint64_t count;
+    uint64_t samples;
+    // Mean sampled cost in ticks and the estimated total from it
+    double cost;
+    double total;
+} opcode_row_t;
+
+void opcode_stats_init(gb_opcode_stats_t *stats, uint32_t sample_interval) {
+    memset(stats, 0, sizeof(*stats));
+
+    stats->sample_interval = sample_interval;
+    stats->countdown = sample_interval;
+}
+
+uint64_t opcode_stats_begin(gb_opcode_stats_t *stats) {
+    if (!stats->sample_interval || --stats->countdown) {
+        return 0;
+    }
+
+    stats->countdown = stats->sample_interval;
+
+    return stats_ticks();
+}
+
+void opcode_stats_end(gb_opcode_stats_t *stats, uint8_t opcode, uint64_t start) {
+    uint64_t *counts = stats->counts;
+    uint64_t *ticks = stats->ticks;
+    uint64_t *samples = stats->samples;
+
+    // The prefix byte itself is only a table lookup, count the real handler
+    if (opcode == OPCODE_PREFIX_CB) {
+        opcode = stats->cb_opcode;
+        counts = stats->cb_counts;
+        ticks = stats->cb_ticks;
+        samples = stats->cb_samples;
+    }
+
+    counts[opcode]++;
+
+    if (start) {
+        ticks[opcode] += stats_ticks() - start;
+        samples[opcode]++;
+    }
+}
+
+/**
+ * Ticks between two back to back reads of the clock, taken off every sample
+ */
+static double clock_overhead() {
+    uint64_t best = UINT64_MAX;
+
+    for (int i = 0; i < 1000; i++) {
+        uint64_t start = stats_ticks();
+        uint64_t end = stats_ticks();
+
+        if (end - start < best) {
+            best = end - start;
+        }
+    }
+
+    return best;
+}
+
+static int compare_rows(const void *a, const void *b) {
+    const opcode_row_t *row_a = a;
+    const opcode_row_t *row_b = b;
+
+    if (row_a->total != row_b->total) {
+        return row_a->total < row_b->total ? 1 : -1;
+    }
+
+    if (row_a->count != row_b->count) {
+        return row_a->count < row_b->count ? 1 : -1;
+    }
+
+    return (row_a->cb << 8 | row_a->opcode) - (row_b->cb << 8 | row_b->opcode);
+}
+
+/**
+ * Add a row per executed opcode of one table
+ */
+static uint32_t add_rows(opcode_row_t *rows, uint32_t count, uint8_t cb, const uint64_t *counts,
+        const uint64_t *ticks, const uint64_t *samples, double overhead) {
+    for (int i = 0; i < 256; i++) {
+        if (!counts[i]) {
+            continue;
+        }
+
+        opcode_row_t *row = &rows[count++];
+
+        row->opcode = i;
+        row->cb = cb;
+        row->count = counts[i];
+        row->samples = samples[i];
+        row->cost = 0;
+
+        if (samples[i]) {
+            row->cost = (double)ticks[i] / samples[i] - overhead;
+            row->cost = row->cost > 0 ? row->cost : 0;
+        }
+
+        // Sorted by count alone when nothing was sampled
+        row->total = row->cost * row->count;
+    }
+
+    return count;
+}
+
+void opcode_stats_print(const gb_opcode_stats_t *stats, const char *rom, FILE *f) {
+    opcode_row_t rows[512];
+    double overhead = stats->sample_interval ? clock_overhead() : 0;
+
+    uint32_t count = add_rows(rows, 0, 0, stats->counts, stats->ticks, stats->samples, overhead);
+    count = add_rows(rows, count, 1, stats->cb_counts, stats->cb_ticks, stats->cb_samples, overhead);
+
+    uint64_t executed = 0;
+    double total = 0;
+
+    for (uint32_t i = 0; i < count; i++) {
+        executed += rows[i].count;
+        total += rows[i].total;
+    }
+
+    if (!executed) {
+        fprintf(f, "No instructions executed to report opcode stats for\n");
+        return;
+    }
+
+    qsort(rows, count, sizeof(opcode_row_t), compare_rows);
+
+    double tick_ns = stats_tick_ns();
+
+    fprintf(f, "Opcode stats for %s: %llu instructions, %u distinct opcodes", rom, (unsigned long long)executed, count);
+
+    if (stats->sample_interval) {
+        fprintf(f, ", one in %u timed, %.1f ns clock overhead taken off\n", stats->sample_interval, overhead * tick_ns);
+    } else {
+        fprintf(f, ", counts only\n");
+    }
+
+    fprintf(f, "  %-7s %-10s %14s %7s", "opcode", "handler", "count", "share");
+
+    if (stats->sample_interval) {
+        fprintf(f, " %10s %12s %7s", "ns each", "ms total", "time");
+    }
+
+    fprintf(f, "\n");
+
+    for (uint32_t i = 0; i < count; i++) {
+        const opcode_row_t *row = &rows[i];
+        char label[8];
+
+        snprintf(label, sizeof(label), row->cb ? "CB %02X" : "%02X", row->opcode);
+
+        fprintf(f, "  %-7s %-10s %14llu %6.2f%%", label,
+            cpu_opcode_name(row->opcode, row->cb), (unsigned long long)row->count, 100.0 * row->count / executed);
+
+        if (stats->sample_interval && !row->samples) {
+            fprintf(f, " %10s %12s %7s", "-", "-", "-");
+        } else if (stats->sample_interval) {
+            fprintf(f, " %10.1f %12.3f %6.2f%%", row->cost * tick_ns, row->total * tick_ns / 1e6,
+                total > 0 ? 100.0 * row->total / total : 0);
+        }
+
+        fprintf(f, "\n");
+    }
+}
+
+#endif
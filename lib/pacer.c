@@ -0,0 +1,117 @@
+#include <pacer.h>
+
+int64_t pacer_now_ns() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/**
+ * Sleep for a number of nanoseconds
+ */
+static void sleep_ns(int64_t ns) {
+    struct timespec duration = {
+        .tv_sec = ns / 1000000000,
+        .tv_nsec = ns % 1000000000,
+    };
+
+    nanosleep(&duration, NULL);
+}
+
+/**
+ * Record the time between this frame and the last
+ */
+static void record_interval(pacer_t *pacer, int64_t now) {
+    int64_t interval = now - pacer->last_frame_ns;
+    pacer->last_frame_ns = now;
+
+    pacer->frames++;
+
+    // Welford's running mean and variance
+    double delta = interval - pacer->interval_mean_ns;
+    pacer->interval_mean_ns += delta / pacer->frames;
+    pacer->interval_m2 += delta * (interval - pacer->interval_mean_ns);
+
+    if (pacer->frames == 1 || interval < pacer->interval_min_ns) {
+        pacer->interval_min_ns = interval;
+    }
+
+    if (interval > pacer->interval_max_ns) {
+        pacer->interval_max_ns = interval;
+    }
+}
+
+void pacer_init(pacer_t *pacer, double speed) {
+    pacer->frames = 0;
+    pacer->interval_mean_ns = 0;
+    pacer->interval_m2 = 0;
+    pacer->interval_min_ns = 0;
+    pacer->interval_max_ns = 0;
+    pacer->late_frames = 0;
+    pacer->resyncs = 0;
+
+    pacer->last_frame_ns = pacer_now_ns();
+    pacer->next_deadline_ns = pacer->last_frame_ns;
+
+    pacer_set_speed(pacer, speed);
+}
+
+void pacer_set_speed(pacer_t *pacer, double speed) {
+    pacer->speed = speed;
+    pacer->frame_ns = speed == PACER_SPEED_UNLIMITED ? 0 : (int64_t)(1e9 / (PACER_FRAME_RATE * speed));
+
+    // Start the new rate from the next frame
+    pacer->next_deadline_ns = pacer->last_frame_ns + pacer->frame_ns;
+}
+
+void pacer_wait_frame(pacer_t *pacer) {
+    if (pacer->speed == PACER_SPEED_UNLIMITED) {
+        record_interval(pacer, pacer_now_ns());
+        return;
+    }
+
+    int64_t deadline = pacer->next_deadline_ns;
+    int64_t now = pacer_now_ns();
+
+    // Coarse sleep, leaving a margin for the scheduler to wake us late
+    if (deadline - now > PACER_SPIN_NS) {
+        sleep_ns(deadline - now - PACER_SPIN_NS);
+    }
+
+    // Spin for the remainder
+    do {
+        now = pacer_now_ns();
+    } while (now < deadline);
+
+    if (now - deadline > PACER_SPIN_NS) {
+        pacer->late_frames++;
+    }
+
+    record_interval(pacer, now);
+
+    pacer->next_deadline_ns += pacer->frame_ns;
+
+    if (now - pacer->next_deadline_ns > PACER_RESYNC_FRAMES * pacer->frame_ns) {
+        // Too far behind (e.g. the process was suspended), don't run a burst of frames to catch up
+        pacer->next_deadline_ns = now + pacer->frame_ns;
+        pacer->resyncs++;
+    }
+}
+
+void pacer_print_stats(const pacer_t *pacer, FILE *f) {
+    double stddev = pacer->frames > 1 ? sqrt(pacer->interval_m2 / (pacer->frames - 1)) : 0;
+
+    fprintf(f, "Frames: %llu\n", (unsigned long long)pacer->frames);
+
+    if (pacer->speed == PACER_SPEED_UNLIMITED) {
+        fprintf(f, "Target: unlimited\n");
+    } else {
+        fprintf(f, "Target: %.3f ms (%.2fx)\n", pacer->frame_ns / 1e6, pacer->speed);
+    }
+
+    fprintf(f, "Frame time: mean %.3f ms, stddev %.3f ms, min %.3f ms, max %.3f ms\n",
+        pacer->interval_mean_ns / 1e6, stddev / 1e6, pacer->interval_min_ns / 1e6, pacer->interval_max_ns / 1e6);
+
+    fprintf(f, "Late frames: %llu, resyncs: %llu\n", (unsigned long long)pacer->late_frames, (unsigned long long)pacer->resyncs);
+}
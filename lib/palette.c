@@ -0,0 +1,162 @@
+#include <palette.h>
+
+#if defined(__SSE2__)
+    #include <emmintrin.h>
+    #define PALETTE_SIMD_SSE2 1
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    #include <arm_neon.h>
+    #define PALETTE_SIMD_NEON 1
+#endif
+
+const palette_t palette_grey = {
+    .colours = {
+        { 255, 255, 255, 255 },
+        { 170, 170, 170, 255 },
+        { 85, 85, 85, 255 },
+        { 0, 0, 0, 255 },
+    }
+};
+
+/**
+ * Grey level of a palette colour
+ */
+static uint8_t grey_value(const uint8_t colour[4]) {
+    return (colour[0] * 77 + colour[1] * 150 + colour[2] * 29) >> 8;
+}
+
+uint8_t palette_format_size(uint8_t format) {
+    switch (format) {
+        case PALETTE_FORMAT_GREY:
+            return 1;
+
+        case PALETTE_FORMAT_RGB:
+            return 3;
+
+        default:
+            return 4;
+    }
+}
+
+#if PALETTE_SIMD_SSE2
+
+/**
+ * Look up 16 shades in a 4 entry channel table
+ */
+static __m128i lookup_channel(__m128i shades, const uint8_t table[4]) {
+    __m128i out = _mm_and_si128(_mm_cmpeq_epi8(shades, _mm_setzero_si128()), _mm_set1_epi8(table[0]));
+
+    for (uint8_t i = 1; i < 4; i++) {
+        __m128i match = _mm_cmpeq_epi8(shades, _mm_set1_epi8(i));
+        out = _mm_or_si128(out, _mm_and_si128(match, _mm_set1_epi8(table[i])));
+    }
+
+    return out;
+}
+
+/**
+ * Convert as many whole blocks of 16 pixels as possible, returning the number converted
+ */
+static uint32_t convert_simd(const uint8_t tables[4][4], const uint8_t *frame, uint32_t pixels, uint8_t format, uint8_t *out) {
+    uint32_t i = 0;
+
+    if (format == PALETTE_FORMAT_GREY) {
+        for (; i + 16 <= pixels; i += 16) {
+            __m128i shades = _mm_loadu_si128((const __m128i *)(frame + i));
+            _mm_storeu_si128((__m128i *)(out + i), lookup_channel(shades, tables[0]));
+        }
+    } else if (format == PALETTE_FORMAT_RGBA) {
+        for (; i + 16 <= pixels; i += 16) {
+            __m128i shades = _mm_loadu_si128((const __m128i *)(frame + i));
+
+            __m128i r = lookup_channel(shades, tables[0]);
+            __m128i g = lookup_channel(shades, tables[1]);
+            __m128i b = lookup_channel(shades, tables[2]);
+            __m128i a = lookup_channel(shades, tables[3]);
+
+            __m128i rg_low = _mm_unpacklo_epi8(r, g);
+            __m128i rg_high = _mm_unpackhi_epi8(r, g);
+            __m128i ba_low = _mm_unpacklo_epi8(b, a);
+            __m128i ba_high = _mm_unpackhi_epi8(b, a);
+
+            __m128i *dest = (__m128i *)(out + i * 4);
+
+            _mm_storeu_si128(dest, _mm_unpacklo_epi16(rg_low, ba_low));
+            _mm_storeu_si128(dest + 1, _mm_unpackhi_epi16(rg_low, ba_low));
+            _mm_storeu_si128(dest + 2, _mm_unpacklo_epi16(rg_high, ba_high));
+            _mm_storeu_si128(dest + 3, _mm_unpackhi_epi16(rg_high, ba_high));
+        }
+    }
+
+    return i;
+}
+
+#elif PALETTE_SIMD_NEON
+
+/**
+ * Convert as many whole blocks of 16 pixels as possible, returning the number converted
+ */
+static uint32_t convert_simd(const uint8_t tables[4][4], const uint8_t *frame, uint32_t pixels, uint8_t format, uint8_t *out) {
+    uint8x16_t lookup[4];
+    uint32_t i = 0;
+
+    for (uint8_t channel = 0; channel < 4; channel++) {
+        uint8_t table[16] = { 0 };
+        memcpy(table, tables[channel], 4);
+        lookup[channel] = vld1q_u8(table);
+    }
+
+    if (format == PALETTE_FORMAT_GREY) {
+        for (; i + 16 <= pixels; i += 16) {
+            vst1q_u8(out + i, vqtbl1q_u8(lookup[0], vld1q_u8(frame + i)));
+        }
+    } else if (format == PALETTE_FORMAT_RGBA) {
+        for (; i + 16 <= pixels; i += 16) {
+            uint8x16_t shades = vld1q_u8(frame + i);
+            uint8x16x4_t rgba;
+
+            for (uint8_t channel = 0; channel < 4; channel++) {
+                rgba.val[channel] = vqtbl1q_u8(lookup[channel], shades);
+            }
+
+            vst4q_u8(out + i * 4, rgba);
+        }
+    }
+
+    return i;
+}
+
+#else
+
+/**
+ * No vector unit, everything is converted by the scalar loop
+ */
+static uint32_t convert_simd(const uint8_t tables[4][4], const uint8_t *frame, uint32_t pixels, uint8_t format, uint8_t *out) {
+    return 0;
+}
+
+#endif
+
+void palette_convert(const palette_t *palette, const uint8_t *frame, uint32_t pixels, uint8_t format, uint8_t *out) {
+    uint8_t size = palette_format_size(format);
+
+    // Per channel lookup tables, indexed by shade
+    uint8_t tables[4][4];
+
+    for (uint8_t shade = 0; shade < 4; shade++) {
+        for (uint8_t channel = 0; channel < 4; channel++) {
+            tables[channel][shade] = format == PALETTE_FORMAT_GREY
+                ? grey_value(palette->colours[shade])
+                : palette->colours[shade][channel];
+        }
+    }
+
+    uint32_t i = convert_simd(tables, frame, pixels, format, out);
+
+    for (; i < pixels; i++) {
+        uint8_t shade = frame[i] & 0b11;
+
+        for (uint8_t channel = 0; channel < size; channel++) {
+            out[i * size + channel] = tables[channel][shade];
+        }
+    }
+}
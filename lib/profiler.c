@@ -0,0 +1,534 @@
+#include <profiler.h>
+#include <scheduler.h>
+#include <gb_memory.h>
+
+// Longest name printed for a location
+#define PROFILE_NAME_SIZE 256
+
+// A line of the hot spot report
+typedef struct {
+    char *name;
+    uint64_t self;
+    uint64_t total;
+} profile_row_t;
+
+// A folded stack before duplicates are merged
+typedef struct {
+    char *stack;
+    uint64_t count;
+} profile_line_t;
+
+static uint32_t hash_pair(uint32_t a, uint32_t b) {
+    uint32_t hash = a * 0x9E3779B1 ^ b * 0x85EBCA77;
+    return hash ^ (hash >> 15);
+}
+
+/**
+ * Banked location of a guest address, by what is mapped there now
+ */
+static uint32_t profiler_location(gb_t *gb, uint16_t address) {
+    return PROFILE_LOCATION(mem_bank(gb, address), address);
+}
+
+/**
+ * Memory regions, for symbols not to spill over into the next one
+ */
+static uint8_t region(uint16_t address) {
+    static const uint16_t starts[] = { 0x4000, 0x8000, 0xA000, 0xC000, 0xD000, 0xE000, 0xFF80 };
+
+    uint8_t i = 0;
+
+    while (i < sizeof(starts) / sizeof(starts[0]) && address >= starts[i]) {
+        i++;
+    }
+
+    return i;
+}
+
+/**
+ * The nearest symbol at or before a location, in the same bank and region
+ */
+static const profile_symbol_t* find_symbol(profiler_t *profiler, uint32_t location) {
+    uint32_t low = 0;
+    uint32_t high = profiler->symbol_count;
+
+    // First symbol after the location
+    while (low < high) {
+        uint32_t mid = (low + high) / 2;
+
+        if (profiler->symbols[mid].location <= location) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+
+    if (low == 0) {
+        return NULL;
+    }
+
+    const profile_symbol_t *symbol = &profiler->symbols[low - 1];
+
+    if (PROFILE_BANK(symbol->location) != PROFILE_BANK(location)
+            || region(PROFILE_ADDRESS(symbol->location)) != region(PROFILE_ADDRESS(location))) {
+        return NULL;
+    }
+
+    return symbol;
+}
+
+/**
+ * Name of the routine a location is in, or its bank and address
+ */
+static const char* location_name(profiler_t *profiler, uint32_t location, char name[PROFILE_NAME_SIZE]) {
+    const profile_symbol_t *symbol = find_symbol(profiler, location);
+
+    if (symbol) {
+        return symbol->name;
+    }
+
+    if (PROFILE_BANK(location) == MEM_BANK_BOOT) {
+        snprintf(name, PROFILE_NAME_SIZE, "boot:%04X", PROFILE_ADDRESS(location));
+        return name;
+    }
+
+    snprintf(name, PROFILE_NAME_SIZE, "%02X:%04X", PROFILE_BANK(location), PROFILE_ADDRESS(location));
+
+    return name;
+}
+
+/**
+ * Double the node table, putting every node back in
+ */
+static void grow_node_table(profiler_t *profiler) {
+    free(profiler->node_table);
+
+    profiler->node_table_size *= 2;
+    profiler->node_table = calloc(profiler->node_table_size, sizeof(uint32_t));
+
+    uint32_t mask = profiler->node_table_size - 1;
+
+    for (uint32_t i = 1; i < profiler->node_count; i++) {
+        uint32_t slot = hash_pair(profiler->nodes[i].parent, profiler->nodes[i].location) & mask;
+
+        while (profiler->node_table[slot]) {
+            slot = (slot + 1) & mask;
+        }
+
+        profiler->node_table[slot] = i;
+    }
+}
+
+/**
+ * Find or add the node for a routine called from a parent
+ */
+static uint32_t child_node(profiler_t *profiler, uint32_t parent, uint32_t location) {
+    uint32_t mask = profiler->node_table_size - 1;
+    uint32_t slot = hash_pair(parent, location) & mask;
+
+    // Node 0 is the root, never a child, so 0 marks an empty slot
+    while (profiler->node_table[slot]) {
+        const profile_node_t *node = &profiler->nodes[profiler->node_table[slot]];
+
+        if (node->parent == parent && node->location == location) {
+            return profiler->node_table[slot];
+        }
+
+        slot = (slot + 1) & mask;
+    }
+
+    if (profiler->node_count == profiler->node_capacity) {
+        profiler->node_capacity *= 2;
+        profiler->nodes = realloc(profiler->nodes, sizeof(profile_node_t) * profiler->node_capacity);
+    }
+
+    uint32_t index = profiler->node_count++;
+
+    profiler->nodes[index].parent = parent;
+    profiler->nodes[index].location = location;
+    profiler->node_table[slot] = index;
+
+    // Keep the table at most half full
+    if (profiler->node_count * 2 > profiler->node_table_size) {
+        grow_node_table(profiler);
+    }
+
+    return index;
+}
+
+static profile_sample_t* sample_slot(profile_sample_t *table, uint32_t size, uint32_t node, uint32_t location) {
+    uint32_t mask = size - 1;
+    uint32_t slot = hash_pair(node, location) & mask;
+
+    while (table[slot].count && (table[slot].node != node || table[slot].location != location)) {
+        slot = (slot + 1) & mask;
+    }
+
+    return &table[slot];
+}
+
+static void grow_sample_table(profiler_t *profiler) {
+    profile_sample_t *old = profiler->samples;
+    uint32_t old_size = profiler->sample_table_size;
+
+    profiler->sample_table_size *= 2;
+    profiler->samples = calloc(profiler->sample_table_size, sizeof(profile_sample_t));
+
+    for (uint32_t i = 0; i < old_size; i++) {
+        if (old[i].count) {
+            *sample_slot(profiler->samples, profiler->sample_table_size, old[i].node, old[i].location) = old[i];
+        }
+    }
+
+    free(old);
+}
+
+int profiler_init(profiler_t *profiler, gb_t *gb, uint32_t interval, uint8_t calls) {
+    memset(profiler, 0, sizeof(*profiler));
+
+    if (interval == 0) {
+        printf("Profile interval must be at least 1 cycle\n");
+        return 0;
+    }
+
+    profiler->interval = interval;
+    profiler->calls = calls;
+
+    profiler->node_capacity = 256;
+    profiler->nodes = malloc(sizeof(profile_node_t) * profiler->node_capacity);
+    profiler->node_count = 1;
+    profiler->nodes[0].parent = 0;
+    profiler->nodes[0].location = 0;
+
+    profiler->node_table_size = 512;
+    profiler->node_table = calloc(profiler->node_table_size, sizeof(uint32_t));
+
+    profiler->sample_table_size = 4096;
+    profiler->samples = calloc(profiler->sample_table_size, sizeof(profile_sample_t));
+
+    gb->profiler = profiler;
+    sched_schedule(gb, SCHED_EVENT_PROFILE, gb->cycles + interval);
+
+    return 1;
+}
+
+void profiler_free(profiler_t *profiler, gb_t *gb) {
+    if (gb->profiler == profiler) {
+        gb->profiler = NULL;
+        sched_cancel(gb, SCHED_EVENT_PROFILE);
+    }
+
+    for (uint32_t i = 0; i < profiler->symbol_count; i++) {
+        free(profiler->symbols[i].name);
+    }
+
+    free(profiler->symbols);
+    free(profiler->nodes);
+    free(profiler->node_table);
+    free(profiler->samples);
+
+    memset(profiler, 0, sizeof(*profiler));
+}
+
+static int compare_symbols(const void *a, const void *b) {
+    uint32_t location_a = ((const profile_symbol_t *)a)->location;
+    uint32_t location_b = ((const profile_symbol_t *)b)->location;
+
+    return location_a < location_b ? -1 : location_a > location_b;
+}
+
+int profiler_load_symbols(profiler_t *profiler, const char *path) {
+    FILE *f = fopen(path, "r");
+
+    if (!f) {
+        return 0;
+    }
+
+    char line[512];
+    uint32_t capacity = profiler->symbol_count;
+
+    while (fgets(line, sizeof(line), f)) {
+        unsigned int bank;
+        unsigned int address;
+        char name[PROFILE_NAME_SIZE];
+
+        // Anything else, comments and blank lines included, is skipped
+        if (sscanf(line, " %x:%x %255s", &bank, &address, name) != 3 || address > 0xFFFF) {
+            continue;
+        }
+
+        if (profiler->symbol_count == capacity) {
+            capacity = capacity ? capacity * 2 : 256;
+            profiler->symbols = realloc(profiler->symbols, sizeof(profile_symbol_t) * capacity);
+        }
+
+        profile_symbol_t *symbol = &profiler->symbols[profiler->symbol_count++];
+
+        symbol->location = PROFILE_LOCATION(bank, address);
+        symbol->name = strdup(name);
+    }
+
+    fclose(f);
+
+    qsort(profiler->symbols, profiler->symbol_count, sizeof(profile_symbol_t), compare_symbols);
+
+    return 1;
+}
+
+void profiler_sample_event(gb_t *gb) {
+    profiler_t *profiler = gb->profiler;
+
+    if (!profiler) {
+        return;
+    }
+
+    sched_schedule(gb, SCHED_EVENT_PROFILE, gb->cycles + profiler->interval);
+
+    uint32_t node = profiler->depth ? profiler->stack[profiler->depth - 1].node : 0;
+    uint32_t location = profiler_location(gb, gb->cpu.pc);
+
+    profile_sample_t *sample = sample_slot(profiler->samples, profiler->sample_table_size, node, location);
+
+    if (!sample->count) {
+        sample->node = node;
+        sample->location = location;
+        profiler->sample_count++;
+    }
+
+    sample->count++;
+    profiler->total++;
+
+    if (profiler->sample_count * 2 > profiler->sample_table_size) {
+        grow_sample_table(profiler);
+    }
+}
+
+void profiler_call(gb_t *gb) {
+    profiler_t *profiler = gb->profiler;
+
+    if (!profiler->calls) {
+        return;
+    }
+
+    if (profiler->depth == PROFILE_MAX_DEPTH) {
+        profiler->too_deep++;
+        return;
+    }
+
+    uint32_t parent = profiler->depth ? profiler->stack[profiler->depth - 1].node : 0;
+
+    profile_frame_t *frame = &profiler->stack[profiler->depth++];
+
+    frame->node = child_node(profiler, parent, profiler_location(gb, gb->cpu.pc));
+    frame->sp = gb->cpu.sp;
+}
+
+void profiler_ret(gb_t *gb) {
+    profiler_t *profiler = gb->profiler;
+
+    // Pops every routine whose return address is now off the stack, so
+    // routines that drop their return address and jump away are left too
+    while (profiler->depth && profiler->stack[profiler->depth - 1].sp < gb->cpu.sp) {
+        profiler->depth--;
+    }
+}
+
+void profiler_state_loaded(gb_t *gb) {
+    if (gb->profiler) {
+        // Keep the phase of a sample the state already has pending
+        if (gb->event_cycles[SCHED_EVENT_PROFILE] == SCHED_NEVER) {
+            sched_schedule(gb, SCHED_EVENT_PROFILE, gb->cycles + gb->profiler->interval);
+        }
+    } else {
+        sched_cancel(gb, SCHED_EVENT_PROFILE);
+    }
+}
+
+/**
+ * Append the routines a node was called through, outermost first
+ */
+static size_t append_stack(profiler_t *profiler, uint32_t node, char *out, size_t size) {
+    if (node == 0) {
+        return 0;
+    }
+
+    size_t length = append_stack(profiler, profiler->nodes[node].parent, out, size);
+    char name[PROFILE_NAME_SIZE];
+
+    length += snprintf(out + length, length < size ? size - length : 0, "%s%s",
+        length ? ";" : "", location_name(profiler, profiler->nodes[node].location, name));
+
+    return length < size ? length : size - 1;
+}
+
+static int compare_lines(const void *a, const void *b) {
+    return strcmp(((const profile_line_t *)a)->stack, ((const profile_line_t *)b)->stack);
+}
+
+int profiler_write_folded(profiler_t *profiler, const char *path) {
+    FILE *f = fopen(path, "w");
+
+    if (!f) {
+        return 0;
+    }
+
+    profile_line_t *lines = malloc(sizeof(profile_line_t) * (profiler->sample_count + 1));
+    uint32_t line_count = 0;
+
+    size_t size = PROFILE_MAX_DEPTH * PROFILE_NAME_SIZE;
+    char *stack = malloc(size);
+
+    for (uint32_t i = 0; i < profiler->sample_table_size; i++) {
+        const profile_sample_t *sample = &profiler->samples[i];
+
+        if (!sample->count) {
+            continue;
+        }
+
+        char name[PROFILE_NAME_SIZE];
+        const char *leaf = location_name(profiler, sample->location, name);
+
+        stack[0] = '\0';
+        size_t length = append_stack(profiler, sample->node, stack, size);
+
+        // The sample is usually in the routine called last, named once
+        const char *last = strrchr(stack, ';');
+        last = last ? last + 1 : stack;
+
+        if (!length || strcmp(last, leaf)) {
+            snprintf(stack + length, size - length, "%s%s", length ? ";" : "", leaf);
+        }
+
+        lines[line_count].stack = strdup(stack);
+        lines[line_count].count = sample->count;
+        line_count++;
+    }
+
+    // Different locations in one routine make the same line
+    qsort(lines, line_count, sizeof(profile_line_t), compare_lines);
+
+    for (uint32_t i = 0; i < line_count; i++) {
+        uint64_t count = lines[i].count;
+
+        while (i + 1 < line_count && !strcmp(lines[i].stack, lines[i + 1].stack)) {
+            count += lines[++i].count;
+        }
+
+        fprintf(f, "%s %llu\n", lines[i].stack, (unsigned long long)count);
+    }
+
+    for (uint32_t i = 0; i < line_count; i++) {
+        free(lines[i].stack);
+    }
+
+    free(lines);
+    free(stack);
+    fclose(f);
+
+    return 1;
+}
+
+static profile_row_t* find_row(profile_row_t *rows, uint32_t *count, const char *name) {
+    for (uint32_t i = 0; i < *count; i++) {
+        if (!strcmp(rows[i].name, name)) {
+            return &rows[i];
+        }
+    }
+
+    profile_row_t *row = &rows[(*count)++];
+
+    row->name = strdup(name);
+    row->self = 0;
+    row->total = 0;
+
+    return row;
+}
+
+static int compare_rows(const void *a, const void *b) {
+    const profile_row_t *row_a = a;
+    const profile_row_t *row_b = b;
+
+    if (row_a->self != row_b->self) {
+        return row_a->self < row_b->self ? 1 : -1;
+    }
+
+    return row_a->total < row_b->total ? 1 : row_a->total > row_b->total ? -1 : 0;
+}
+
+void profiler_print(profiler_t *profiler, FILE *f) {
+    if (!profiler->total) {
+        fprintf(f, "No profile samples taken\n");
+        return;
+    }
+
+    // At most a row per location and one per called routine
+    profile_row_t *rows = malloc(sizeof(profile_row_t) * (profiler->sample_count + profiler->node_count));
+    uint32_t row_count = 0;
+
+    for (uint32_t i = 0; i < profiler->sample_table_size; i++) {
+        const profile_sample_t *sample = &profiler->samples[i];
+
+        if (!sample->count) {
+            continue;
+        }
+
+        char name[PROFILE_NAME_SIZE];
+        profile_row_t *leaf = find_row(rows, &row_count, location_name(profiler, sample->location, name));
+
+        leaf->self += sample->count;
+        leaf->total += sample->count;
+
+        // Count each routine on the stack once, recursion included
+        const profile_row_t *seen[PROFILE_MAX_DEPTH + 1];
+        uint32_t seen_count = 0;
+
+        seen[seen_count++] = leaf;
+
+        for (uint32_t node = sample->node; node; node = profiler->nodes[node].parent) {
+            profile_row_t *row = find_row(rows, &row_count, location_name(profiler, profiler->nodes[node].location, name));
+            uint8_t counted = 0;
+
+            for (uint32_t j = 0; j < seen_count; j++) {
+                counted |= seen[j] == row;
+            }
+
+            if (!counted) {
+                row->total += sample->count;
+                seen[seen_count++] = row;
+            }
+        }
+    }
+
+    qsort(rows, row_count, sizeof(profile_row_t), compare_rows);
+
+    fprintf(f, "Profile: %llu samples, one every %u cycles, %u locations",
+        (unsigned long long)profiler->total, profiler->interval, profiler->sample_count);
+
+    if (profiler->calls) {
+        fprintf(f, ", %u call paths", profiler->node_count - 1);
+    }
+
+    if (profiler->too_deep) {
+        fprintf(f, ", %llu calls too deep to follow", (unsigned long long)profiler->too_deep);
+    }
+
+    fprintf(f, "\n  %7s %7s  %s\n", "self", profiler->calls ? "total" : "", "routine");
+
+    for (uint32_t i = 0; i < row_count && i < PROFILE_REPORT_LINES; i++) {
+        fprintf(f, "  %6.2f%% ", 100.0 * rows[i].self / profiler->total);
+
+        if (profiler->calls) {
+            fprintf(f, "%6.2f%% ", 100.0 * rows[i].total / profiler->total);
+        } else {
+            fprintf(f, "%7s ", "");
+        }
+
+        fprintf(f, " %s\n", rows[i].name);
+    }
+
+    for (uint32_t i = 0; i < row_count; i++) {
+        free(rows[i].name);
+    }
+
+    free(rows);
+}
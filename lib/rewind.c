@@ -0,0 +1,289 @@
+#include <rewind.h>
+#include <state.h>
+#include <gpu.h>
+
+/**
+ * Write a LEB128 varint
+ */
+static uint8_t *write_varint(uint8_t *out, size_t value) {
+    while (value >= 0x80) {
+        *out++ = value | 0x80;
+        value >>= 7;
+    }
+
+    *out++ = value;
+
+    return out;
+}
+
+static const uint8_t *read_varint(const uint8_t *in, size_t *value) {
+    uint8_t shift = 0;
+    *value = 0;
+
+    do {
+        *value |= (size_t)(*in & 0x7F) << shift;
+        shift += 7;
+    } while (*in++ & 0x80);
+
+    return in;
+}
+
+static uint64_t load_word(const uint8_t *p) {
+    uint64_t word;
+    memcpy(&word, p, sizeof(word));
+
+    return word;
+}
+
+/**
+ * Encode a XOR b as runs of (unchanged count, literal count, literals).
+ * Literal runs end at REWIND_MIN_RUN unchanged bytes. Returns the encoded size
+ */
+static size_t delta_encode(const uint8_t *a, const uint8_t *b, size_t size, uint8_t *out) {
+    uint8_t *start_out = out;
+    size_t i = 0;
+
+    while (i < size) {
+        size_t start = i;
+
+        // Most of a snapshot is unchanged, skip it a word at a time
+        while (i + 8 <= size && load_word(a + i) == load_word(b + i)) {
+            i += 8;
+        }
+
+        while (i < size && a[i] == b[i]) {
+            i++;
+        }
+
+        size_t unchanged = i - start;
+        size_t literal_start = i;
+        size_t same = 0;
+
+        while (i < size && same < REWIND_MIN_RUN) {
+            same = a[i] == b[i] ? same + 1 : 0;
+            i++;
+        }
+
+        // Trailing unchanged bytes start the next run
+        i -= same;
+
+        out = write_varint(out, unchanged);
+        out = write_varint(out, i - literal_start);
+
+        for (size_t j = literal_start; j < i; j++) {
+            *out++ = a[j] ^ b[j];
+        }
+    }
+
+    return out - start_out;
+}
+
+/**
+ * Largest delta_encode output for a snapshot size
+ */
+static size_t delta_bound(size_t size) {
+    // Every run but the last covers at least REWIND_MIN_RUN bytes, with two varints
+    return size + (size / REWIND_MIN_RUN + 1) * 2 * 10;
+}
+
+/**
+ * XOR an encoded delta into a snapshot
+ */
+static void delta_apply(uint8_t *state, const uint8_t *in, size_t in_size) {
+    const uint8_t *end = in + in_size;
+    size_t position = 0;
+
+    while (in < end) {
+        size_t unchanged, literals;
+
+        in = read_varint(in, &unchanged);
+        in = read_varint(in, &literals);
+
+        position += unchanged;
+
+        for (size_t j = 0; j < literals; j++) {
+            state[position++] ^= *in++;
+        }
+    }
+}
+
+static rewind_entry_t *oldest_entry(rewind_t *history) {
+    return &history->entries[history->entry_first];
+}
+
+static rewind_entry_t *newest_entry(rewind_t *history) {
+    return &history->entries[(history->entry_first + history->entry_count - 1) % REWIND_MAX_ENTRIES];
+}
+
+static void evict_oldest(rewind_t *history) {
+    history->ring_bytes -= oldest_entry(history)->size;
+    history->entry_first = (history->entry_first + 1) % REWIND_MAX_ENTRIES;
+    history->entry_count--;
+    history->evictions++;
+}
+
+/**
+ * Make room for size bytes at the ring head, dropping the oldest history.
+ * Returns 0 if it could never fit
+ */
+static int ring_reserve(rewind_t *history, size_t size) {
+    if (size > history->ring_size) {
+        while (history->entry_count) {
+            evict_oldest(history);
+        }
+
+        return 0;
+    }
+
+    if (history->entry_count == REWIND_MAX_ENTRIES) {
+        evict_oldest(history);
+    }
+
+    if (history->ring_head + size > history->ring_size) {
+        // Wrap, dropping the older entries left in the tail
+        while (history->entry_count && oldest_entry(history)->offset >= history->ring_head) {
+            evict_oldest(history);
+        }
+
+        history->ring_head = 0;
+    }
+
+    // Entries from the last lap sit after the head, oldest first
+    while (history->entry_count && oldest_entry(history)->offset >= history->ring_head && oldest_entry(history)->offset < history->ring_head + size) {
+        evict_oldest(history);
+    }
+
+    return 1;
+}
+
+int rewind_init(rewind_t *history, gb_t *gb, size_t budget, uint32_t interval) {
+    memset(history, 0, sizeof(*history));
+
+    history->state_size = state_size(gb);
+    history->interval = interval ? interval : 1;
+    history->ring_size = budget;
+
+    history->state = malloc(history->state_size);
+    history->scratch = malloc(history->state_size);
+    history->encoded = malloc(delta_bound(history->state_size));
+    history->ring = malloc(budget);
+    history->entries = malloc(sizeof(rewind_entry_t) * REWIND_MAX_ENTRIES);
+
+    if (!history->state || !history->scratch || !history->encoded || !history->ring || !history->entries) {
+        printf("Failed to allocate %zu bytes of rewind history\n", budget);
+        rewind_free(history);
+        return 0;
+    }
+
+    return 1;
+}
+
+void rewind_free(rewind_t *history) {
+    free(history->state);
+    free(history->scratch);
+    free(history->encoded);
+    free(history->ring);
+    free(history->entries);
+
+    memset(history, 0, sizeof(*history));
+}
+
+void rewind_frame(rewind_t *history, gb_t *gb) {
+    uint32_t frame = gpu_frame_count(gb);
+
+    if (!history->have_state) {
+        state_save(gb, history->state, history->state_size);
+        history->state_frame = frame;
+        history->have_state = 1;
+        return;
+    }
+
+    if (frame < history->state_frame + history->interval) {
+        return;
+    }
+
+    state_save(gb, history->scratch, history->state_size);
+
+    size_t size = delta_encode(history->scratch, history->state, history->state_size, history->encoded);
+
+    history->snapshots++;
+    history->delta_bytes += size;
+    history->delta_frames += frame - history->state_frame;
+
+    if (ring_reserve(history, size)) {
+        rewind_entry_t *entry = &history->entries[(history->entry_first + history->entry_count) % REWIND_MAX_ENTRIES];
+
+        entry->offset = history->ring_head;
+        entry->size = size;
+        entry->frame = history->state_frame;
+
+        memcpy(history->ring + history->ring_head, history->encoded, size);
+
+        history->ring_head += size;
+        history->ring_bytes += size;
+        history->entry_count++;
+    }
+
+    // The new snapshot becomes the whole one
+    uint8_t *previous = history->state;
+    history->state = history->scratch;
+    history->scratch = previous;
+    history->state_frame = frame;
+}
+
+int rewind_seek(rewind_t *history, gb_t *gb, uint32_t frame) {
+    if (!history->have_state) {
+        return 0;
+    }
+
+    while (history->state_frame > frame && history->entry_count) {
+        rewind_entry_t *entry = newest_entry(history);
+
+        delta_apply(history->state, history->ring + entry->offset, entry->size);
+
+        history->state_frame = entry->frame;
+        history->ring_head = entry->offset;
+        history->ring_bytes -= entry->size;
+        history->entry_count--;
+    }
+
+    if (!history->entry_count) {
+        history->ring_head = 0;
+    }
+
+    state_load(gb, history->state, history->state_size);
+
+    return history->state_frame <= frame;
+}
+
+int rewind_step_back(rewind_t *history, gb_t *gb) {
+    uint32_t frame = gpu_frame_count(gb);
+
+    if (!history->have_state || (frame <= history->state_frame && !history->entry_count)) {
+        return 0;
+    }
+
+    // Back to the newest snapshot first if the machine has moved on from it
+    return rewind_seek(history, gb, frame > history->state_frame ? history->state_frame : history->state_frame - 1);
+}
+
+uint32_t rewind_oldest_frame(const rewind_t *history) {
+    if (history->entry_count) {
+        return history->entries[history->entry_first].frame;
+    }
+
+    return history->state_frame;
+}
+
+void rewind_print_stats(const rewind_t *history, FILE *f) {
+    uint32_t frames = history->state_frame - rewind_oldest_frame(history);
+
+    fprintf(f, "Rewind: %u snapshots covering %u frames (%.1f s) in %llu of %zu bytes\n",
+        history->entry_count, frames, frames / 59.7275, (unsigned long long)history->ring_bytes, history->ring_size);
+
+    if (history->delta_frames) {
+        fprintf(f, "Rewind: %.1f bytes per frame, %.1f bytes per snapshot of %zu, %llu evicted\n",
+            (double)history->delta_bytes / history->delta_frames, (double)history->delta_bytes / history->snapshots,
+            history->state_size, (unsigned long long)history->evictions);
+    }
+}
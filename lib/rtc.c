@@ -0,0 +1,154 @@
+#include <rtc.h>
+
+// Writable bits of each register
+static const uint8_t rtc_masks[5] = {
+    0x3F,   // RTC_REG_S
+    0x3F,   // RTC_REG_M
+    0x1F,   // RTC_REG_H
+    0xFF,   // RTC_REG_DL
+    RTC_DH_DAY_HIGH | RTC_DH_HALT | RTC_DH_CARRY,   // RTC_REG_DH
+};
+
+/**
+ * Current time in clock ticks
+ */
+static uint64_t rtc_now(gb_t *gb) {
+    return gb->rtc_host_time ? (uint64_t)time(NULL) : gb->cycles;
+}
+
+/**
+ * Clock ticks per second
+ */
+static uint64_t rtc_rate(gb_t *gb) {
+    return gb->rtc_host_time ? 1 : RTC_CLOCK_HZ;
+}
+
+/**
+ * Add whole seconds to a set of clock registers
+ */
+static void rtc_advance(uint8_t *rtc, uint64_t seconds) {
+    uint64_t s = rtc[0] + seconds;
+    uint64_t m = rtc[1] + s / 60;
+    uint64_t h = rtc[2] + m / 60;
+    uint64_t d = (rtc[3] | ((rtc[4] & RTC_DH_DAY_HIGH) << 8)) + h / 24;
+
+    rtc[0] = s % 60;
+    rtc[1] = m % 60;
+    rtc[2] = h % 24;
+
+    if (d > 0x1FF) {
+        // Day counter overflow sticks until cleared
+        rtc[4] |= RTC_DH_CARRY;
+    }
+
+    rtc[3] = d & 0xFF;
+    rtc[4] = (rtc[4] & ~RTC_DH_DAY_HIGH) | ((d >> 8) & RTC_DH_DAY_HIGH);
+}
+
+/**
+ * Bring the registers up to date, keeping the part second in the base
+ */
+static void rtc_sync(gb_t *gb) {
+    uint64_t now = rtc_now(gb);
+
+    if (gb->rtc[4] & RTC_DH_HALT || now < gb->rtc_base_tick) {
+        gb->rtc_base_tick = now;
+        return;
+    }
+
+    uint64_t seconds = (now - gb->rtc_base_tick) / rtc_rate(gb);
+
+    rtc_advance(gb->rtc, seconds);
+    gb->rtc_base_tick += seconds * rtc_rate(gb);
+}
+
+static void write_le(uint8_t *out, uint64_t value, uint8_t bytes) {
+    for (uint8_t i = 0; i < bytes; i++) {
+        out[i] = (value >> (i * 8)) & 0xFF;
+    }
+}
+
+static uint64_t read_le(const uint8_t *in, uint8_t bytes) {
+    uint64_t value = 0;
+
+    for (uint8_t i = 0; i < bytes; i++) {
+        value |= (uint64_t)in[i] << (i * 8);
+    }
+
+    return value;
+}
+
+void rtc_init(gb_t *gb) {
+    memset(gb->rtc, 0, sizeof(gb->rtc));
+    memset(gb->rtc_latched, 0, sizeof(gb->rtc_latched));
+
+    gb->rtc_latch_write = 0xFF;
+    gb->rtc_host_time = 0;
+    gb->rtc_base_tick = gb->cycles;
+    gb->rtc_footer = NULL;
+}
+
+void rtc_use_host_time(gb_t *gb) {
+    rtc_sync(gb);
+
+    gb->rtc_host_time = 1;
+    gb->rtc_base_tick = rtc_now(gb);
+}
+
+void rtc_latch(gb_t *gb) {
+    rtc_sync(gb);
+    memcpy(gb->rtc_latched, gb->rtc, sizeof(gb->rtc));
+
+    rtc_store(gb);
+}
+
+uint8_t rtc_read(gb_t *gb, uint8_t reg) {
+    return gb->rtc_latched[reg - RTC_REG_S];
+}
+
+void rtc_write(gb_t *gb, uint8_t reg, uint8_t value) {
+    rtc_sync(gb);
+
+    gb->rtc[reg - RTC_REG_S] = value & rtc_masks[reg - RTC_REG_S];
+
+    if (reg == RTC_REG_S) {
+        // Writing seconds restarts the current second
+        gb->rtc_base_tick = rtc_now(gb);
+    }
+
+    rtc_store(gb);
+}
+
+void rtc_load(gb_t *gb, uint8_t *footer) {
+    for (uint8_t i = 0; i < 5; i++) {
+        gb->rtc[i] = read_le(footer + i * 4, 4) & rtc_masks[i];
+        gb->rtc_latched[i] = read_le(footer + 20 + i * 4, 4) & rtc_masks[i];
+    }
+
+    // Zero for a new save. Some writers only store 32 bits, the rest is then zero
+    uint64_t stored = read_le(footer + 40, 8);
+    uint64_t now = time(NULL);
+
+    if (stored && now > stored && !(gb->rtc[4] & RTC_DH_HALT)) {
+        // Keep time while the emulator was closed
+        rtc_advance(gb->rtc, now - stored);
+    }
+
+    gb->rtc_base_tick = rtc_now(gb);
+    gb->rtc_footer = footer;
+}
+
+void rtc_store(gb_t *gb) {
+    if (!gb->rtc_footer) {
+        return;
+    }
+
+    rtc_sync(gb);
+
+    for (uint8_t i = 0; i < 5; i++) {
+        write_le(gb->rtc_footer + i * 4, gb->rtc[i], 4);
+        write_le(gb->rtc_footer + 20 + i * 4, gb->rtc_latched[i], 4);
+    }
+
+    write_le(gb->rtc_footer + 40, time(NULL), 8);
+}
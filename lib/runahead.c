@@ -0,0 +1,217 @@
+#include <runahead.h>
+#include <gpu.h>
+#include <gb_memory.h>
+#include <pacer.h>
+#include <state.h>
+#include <mbc.h>
+
+// What the main machine has outside its state, set aside while it runs
+// frames that are thrown away
+typedef struct {
+    struct trace *trace;
+    struct profiler *profiler;
+    uint8_t *mbc_ram;
+    uint8_t *rtc_footer;
+
+#if GB_STATS
+    gb_stats_t stats;
+#endif
+
+#if GB_OPCODE_STATS
+    gb_opcode_stats_t opcode_stats;
+#endif
+} runahead_host_t;
+
+/**
+ * A second machine for the same cartridge. The ROM is shared, but RAM is
+ * its own so speculative writes never reach the save file
+ */
+static gb_t *create_secondary(gb_t *gb) {
+    gb_t *ahead = calloc(1, sizeof(*ahead));
+
+    mem_init(ahead);
+
+    mbc_share_cartridge(ahead, gb);
+
+    // Everything else comes with each state
+    return ahead;
+}
+
+static void free_secondary(gb_t *ahead) {
+    free(ahead->vram);
+    free(ahead->ram);
+    free(ahead->io_registers);
+    free(ahead->hram);
+    free(ahead->oam);
+    free(ahead->mbc_ram);
+    free(ahead);
+}
+
+int runahead_init(runahead_t *runahead, gb_t *gb, uint8_t frames, uint8_t secondary) {
+    memset(runahead, 0, sizeof(*runahead));
+
+    if (frames == 0 || frames > RUNAHEAD_MAX_FRAMES) {
+        printf("Run ahead must be 1 to %u frames\n", RUNAHEAD_MAX_FRAMES);
+        return 0;
+    }
+
+    runahead->frames = frames;
+    runahead->state_size = state_size(gb);
+    runahead->state = malloc(runahead->state_size);
+    runahead->budget_ns = 1e9 / PACER_FRAME_RATE;
+
+    if (secondary) {
+        runahead->ahead = create_secondary(gb);
+    } else if (gb->mbc_ram_size) {
+        runahead->ram = malloc(gb->mbc_ram_size);
+    }
+
+    return 1;
+}
+
+/**
+ * Detach the main machine from everything outside its state while running
+ * ahead. When running ahead on it, writes to cartridge RAM go to a copy,
+ * which the restore replaces anyway, and the clock isn't stored in the
+ * save file
+ */
+static void set_aside(runahead_t *runahead, gb_t *gb, runahead_host_t *host) {
+    host->trace = gb->trace;
+    host->profiler = gb->profiler;
+    host->mbc_ram = gb->mbc_ram;
+    host->rtc_footer = gb->rtc_footer;
+
+#if GB_STATS
+    host->stats = gb->stats;
+#endif
+
+#if GB_OPCODE_STATS
+    host->opcode_stats = gb->opcode_stats;
+#endif
+
+    gb->trace = NULL;
+    gb->profiler = NULL;
+
+    if (runahead->ahead) {
+        return;
+    }
+
+    gb->rtc_footer = NULL;
+
+    if (runahead->ram) {
+        memcpy(runahead->ram, gb->mbc_ram, gb->mbc_ram_size);
+        gb->mbc_ram = runahead->ram;
+        mbc_update_banks(gb);
+    }
+}
+
+/**
+ * Reattach the main machine, before its state is restored
+ */
+static void put_back(gb_t *gb, const runahead_host_t *host) {
+    gb->trace = host->trace;
+    gb->profiler = host->profiler;
+
+    gb->mbc_ram = host->mbc_ram;
+    gb->rtc_footer = host->rtc_footer;
+    mbc_update_banks(gb);
+
+#if GB_STATS
+    // The time ahead is charged to whatever the host does between frames
+    gb->stats = host->stats;
+#endif
+
+#if GB_OPCODE_STATS
+    gb->opcode_stats = host->opcode_stats;
+#endif
+}
+
+void runahead_free(runahead_t *runahead) {
+    if (runahead->ahead) {
+        free_secondary(runahead->ahead);
+    }
+
+    free(runahead->state);
+    free(runahead->ram);
+
+    memset(runahead, 0, sizeof(*runahead));
+}
+
+const uint8_t* runahead_frame(runahead_t *runahead, gb_t *gb) {
+    int64_t start = pacer_now_ns();
+
+    gb_run(gb);
+
+    int64_t ran = pacer_now_ns();
+
+    state_save(gb, runahead->state, runahead->state_size);
+
+    gb_t *target = gb;
+
+    if (runahead->ahead) {
+        target = runahead->ahead;
+        state_load(target, runahead->state, runahead->state_size);
+    }
+
+    int64_t saved = pacer_now_ns();
+
+    runahead_host_t host;
+    set_aside(runahead, gb, &host);
+
+    runahead->running_ahead = 1;
+
+    for (uint8_t i = 0; i < runahead->frames; i++) {
+        gb_run(target);
+    }
+
+    runahead->running_ahead = 0;
+
+    put_back(gb, &host);
+
+    memcpy(runahead->frame, gpu_get_frame(target), sizeof(runahead->frame));
+
+    int64_t ahead = pacer_now_ns();
+
+    if (runahead->ahead) {
+        // Rendering state followed the second machine, bring it back
+        gpu_state_loaded(gb);
+    } else {
+        state_load(gb, runahead->state, runahead->state_size);
+    }
+
+    int64_t end = pacer_now_ns();
+
+    runahead->frame_count++;
+    runahead->run_ns += ran - start;
+    runahead->save_ns += saved - ran;
+    runahead->ahead_ns += ahead - saved;
+    runahead->restore_ns += end - ahead;
+
+    if (end - start > runahead->max_ns) {
+        runahead->max_ns = end - start;
+    }
+
+    if (end - start > runahead->budget_ns) {
+        runahead->over_budget++;
+    }
+
+    return runahead->frame;
+}
+
+void runahead_print_stats(const runahead_t *runahead, FILE *f) {
+    if (!runahead->frame_count) {
+        return;
+    }
+
+    double count = runahead->frame_count;
+    double total = (runahead->run_ns + runahead->save_ns + runahead->ahead_ns + runahead->restore_ns) / count;
+
+    fprintf(f, "Run ahead %u frames%s, per frame: run %.3f ms, %s %.3f ms, ahead %.3f ms, restore %.3f ms\n",
+        runahead->frames, runahead->ahead ? " on a second instance" : "",
+        runahead->run_ns / count / 1e6, runahead->ahead ? "copy" : "save", runahead->save_ns / count / 1e6,
+        runahead->ahead_ns / count / 1e6, runahead->restore_ns / count / 1e6);
+
+    fprintf(f, "Run ahead total: mean %.3f ms, max %.3f ms, %.0f%% of a %.3f ms frame, %llu of %llu frames over\n",
+        total / 1e6, runahead->max_ns / 1e6, total * 100 / runahead->budget_ns, runahead->budget_ns / 1e6,
+        (unsigned long long)runahead->over_budget, (unsigned long long)runahead->frame_count);
+}
@@ -0,0 +1,247 @@
+#include <save.h>
+#include <rtc.h>
+
+#ifdef _WIN32
+    #include <windows.h>
+
+    static HANDLE save_file = INVALID_HANDLE_VALUE;
+    static HANDLE save_mapping = NULL;
+#else
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+
+    static int save_fd = -1;
+#endif
+
+static uint8_t *save_data = NULL;
+static size_t save_size = 0;
+
+static pthread_t flush_thread;
+static pthread_mutex_t flush_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t flush_cond = PTHREAD_COND_INITIALIZER;
+static uint8_t flush_requested = 0;
+static uint8_t flush_running = 0;
+
+/**
+ * Path of the save file for a ROM, with the extension replaced by .sav
+ */
+static char* save_path(const char *rom_filename) {
+    size_t length = strlen(rom_filename);
+    const char *dot = strrchr(rom_filename, '.');
+
+    // Only an extension if it's in the file name, not a directory
+    if (dot && !strchr(dot, '/') && !strchr(dot, '\\')) {
+        length = dot - rom_filename;
+    }
+
+    char *path = malloc(length + 5);
+    memcpy(path, rom_filename, length);
+    strcpy(path + length, ".sav");
+
+    return path;
+}
+
+#ifdef _WIN32
+
+/**
+ * Open and map the save file, growing it to at least min_size
+ */
+static uint8_t* map_save_file(const char *path, size_t min_size, size_t *size) {
+    save_file = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+
+    if (save_file == INVALID_HANDLE_VALUE) {
+        return NULL;
+    }
+
+    LARGE_INTEGER file_size;
+    GetFileSizeEx(save_file, &file_size);
+
+    *size = (size_t)file_size.QuadPart > min_size ? (size_t)file_size.QuadPart : min_size;
+
+    // Mapping past the end of the file extends it with zeros
+    save_mapping = CreateFileMappingA(save_file, NULL, PAGE_READWRITE, 0, (DWORD)*size, NULL);
+
+    if (!save_mapping) {
+        return NULL;
+    }
+
+    return MapViewOfFile(save_mapping, FILE_MAP_ALL_ACCESS, 0, 0, *size);
+}
+
+static void flush_save_file() {
+    FlushViewOfFile(save_data, save_size);
+    FlushFileBuffers(save_file);
+}
+
+static void unmap_save_file() {
+    UnmapViewOfFile(save_data);
+    CloseHandle(save_mapping);
+    CloseHandle(save_file);
+}
+
+#else
+
+/**
+ * Open and map the save file, growing it to at least min_size
+ */
+static uint8_t* map_save_file(const char *path, size_t min_size, size_t *size) {
+    save_fd = open(path, O_RDWR | O_CREAT, 0644);
+
+    if (save_fd < 0) {
+        return NULL;
+    }
+
+    struct stat st;
+
+    if (fstat(save_fd, &st)) {
+        return NULL;
+    }
+
+    *size = (size_t)st.st_size;
+
+    if (*size < min_size) {
+        // Extends with zeros, keeping whatever is there
+        if (ftruncate(save_fd, min_size)) {
+            return NULL;
+        }
+
+        *size = min_size;
+    }
+
+    uint8_t *data = mmap(NULL, *size, PROT_READ | PROT_WRITE, MAP_SHARED, save_fd, 0);
+
+    return data == MAP_FAILED ? NULL : data;
+}
+
+static void flush_save_file() {
+    msync(save_data, save_size, MS_SYNC);
+}
+
+static void unmap_save_file() {
+    munmap(save_data, save_size);
+    close(save_fd);
+}
+
+#endif
+
+/**
+ * Write the save file back every interval, or sooner when asked
+ */
+static void* flush_loop(void *arg) {
+    pthread_mutex_lock(&flush_lock);
+
+    while (flush_running) {
+        if (!flush_requested) {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+
+            deadline.tv_sec += SAVE_FLUSH_INTERVAL_MS / 1000;
+            deadline.tv_nsec += (SAVE_FLUSH_INTERVAL_MS % 1000) * 1000000;
+
+            if (deadline.tv_nsec >= 1000000000) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000;
+            }
+
+            pthread_cond_timedwait(&flush_cond, &flush_lock, &deadline);
+        }
+
+        flush_requested = 0;
+
+        // Requests made during the flush are picked up on the next pass
+        pthread_mutex_unlock(&flush_lock);
+        flush_save_file();
+        pthread_mutex_lock(&flush_lock);
+    }
+
+    pthread_mutex_unlock(&flush_lock);
+
+    return NULL;
+}
+
+int save_open(gb_t *gb, const char *rom_filename) {
+    uint8_t has_rtc = (gb->mbc_flags & MBC_FLAG_RTC) != 0;
+
+    if (!(gb->mbc_flags & MBC_FLAG_BATTERY) || (!gb->mbc_ram_size && !has_rtc)) {
+        return 1;
+    }
+
+    // RAM, then the clock footer
+    size_t expected_size = gb->mbc_ram_size + (has_rtc ? RTC_FOOTER_SIZE : 0);
+
+    char *path = save_path(rom_filename);
+
+    save_data = map_save_file(path, expected_size, &save_size);
+
+    if (!save_data) {
+        printf("Failed to map save file %s\n", path);
+        free(path);
+        return 0;
+    }
+
+    if (save_size != expected_size) {
+        // Trailing data is left alone
+        printf("Save file %s is %lu bytes, using the first %lu\n", path, (unsigned long)save_size, (unsigned long)expected_size);
+    }
+
+    free(path);
+
+    // RAM is read and written straight through the mapping
+    free(gb->mbc_ram);
+    gb->mbc_ram = save_data;
+
+    // The mapped bank still points into the freed buffer
+    mbc_update_banks(gb);
+
+    if (has_rtc) {
+        rtc_load(gb, save_data + gb->mbc_ram_size);
+    }
+
+    flush_running = 1;
+
+    if (pthread_create(&flush_thread, NULL, flush_loop, NULL)) {
+        printf("Failed to start save flush thread\n");
+        flush_running = 0;
+    }
+
+    return 1;
+}
+
+void save_request_flush() {
+    if (!save_data) {
+        return;
+    }
+
+    pthread_mutex_lock(&flush_lock);
+    flush_requested = 1;
+    pthread_cond_signal(&flush_cond);
+    pthread_mutex_unlock(&flush_lock);
+}
+
+void save_close(gb_t *gb) {
+    if (!save_data) {
+        return;
+    }
+
+    // Timestamp the clock so it keeps time until the next run
+    rtc_store(gb);
+
+    if (flush_running) {
+        pthread_mutex_lock(&flush_lock);
+        flush_running = 0;
+        pthread_cond_signal(&flush_cond);
+        pthread_mutex_unlock(&flush_lock);
+
+        pthread_join(flush_thread, NULL);
+    }
+
+    flush_save_file();
+    unmap_save_file();
+
+    gb->mbc_ram = NULL;
+    gb->ram_bank = NULL;
+    gb->rtc_footer = NULL;
+    save_data = NULL;
+}
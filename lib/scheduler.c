@@ -0,0 +1,68 @@
+#include <scheduler.h>
+#include <gpu.h>
+#include <joypad.h>
+#include <timer.h>
+#include <profiler.h>
+
+static sched_handler_t* const sched_handlers[SCHED_EVENT_COUNT] = {
+    gpu_lcd_off_frame,      // SCHED_EVENT_LCD_OFF_FRAME
+    joypad_input_event,     // SCHED_EVENT_INPUT
+    timer_overflow_event,   // SCHED_EVENT_TIMER
+    profiler_sample_event,  // SCHED_EVENT_PROFILE
+};
+
+#if GB_STATS
+// Subsystem each event's time is charged to
+static const uint8_t sched_subsystems[SCHED_EVENT_COUNT] = {
+    STATS_PPU,              // SCHED_EVENT_LCD_OFF_FRAME
+    STATS_JOYPAD,           // SCHED_EVENT_INPUT
+    STATS_TIMER,            // SCHED_EVENT_TIMER
+    STATS_OTHER,            // SCHED_EVENT_PROFILE
+};
+#endif
+
+/**
+ * Recalculate the cycle of the next due event
+ */
+static void update_next_event(gb_t *gb) {
+    gb->next_event_cycle = SCHED_NEVER;
+
+    for (uint8_t i = 0; i < SCHED_EVENT_COUNT; i++) {
+        if (gb->event_cycles[i] < gb->next_event_cycle) {
+            gb->next_event_cycle = gb->event_cycles[i];
+        }
+    }
+}
+
+void sched_init(gb_t *gb) {
+    for (uint8_t i = 0; i < SCHED_EVENT_COUNT; i++) {
+        gb->event_cycles[i] = SCHED_NEVER;
+    }
+
+    gb->next_event_cycle = SCHED_NEVER;
+}
+
+void sched_schedule(gb_t *gb, uint8_t event, uint64_t cycle) {
+    gb->event_cycles[event] = cycle;
+    update_next_event(gb);
+}
+
+void sched_cancel(gb_t *gb, uint8_t event) {
+    gb->event_cycles[event] = SCHED_NEVER;
+    update_next_event(gb);
+}
+
+void sched_run(gb_t *gb) {
+    for (uint8_t i = 0; i < SCHED_EVENT_COUNT; i++) {
+        if (gb->event_cycles[i] <= gb->cycles) {
+            // Handlers may schedule themselves again
+            gb->event_cycles[i] = SCHED_NEVER;
+
+            STATS_ENTER(gb, sched_subsystems[i]);
+            sched_handlers[i](gb);
+            STATS_LEAVE(gb);
+        }
+    }
+
+    update_next_event(gb);
+}
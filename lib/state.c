@@ -0,0 +1,250 @@
+#include <state.h>
+#include <gb_memory.h>
+#include <gpu.h>
+#include <mbc.h>
+#include <profiler.h>
+#include <timeline.h>
+
+typedef struct {
+    uint32_t tag;
+    uint8_t *data;
+    uint32_t size;
+} state_section_t;
+
+/**
+ * Round a section up so the next one starts aligned
+ */
+static size_t state_pad(size_t size) {
+    return (size + 7) & ~(size_t)7;
+}
+
+static void write_u32(uint8_t *out, uint32_t value) {
+    memcpy(out, &value, sizeof(value));
+}
+
+static uint32_t read_u32(const uint8_t *in) {
+    uint32_t value;
+    memcpy(&value, in, sizeof(value));
+    return value;
+}
+
+/**
+ * Where each section lives in this machine
+ */
+static void state_sections(gb_t *gb, state_section_t sections[STATE_SECTION_COUNT]) {
+    state_section_t layout[STATE_SECTION_COUNT] = {
+        { STATE_TAG_CART, gb->mbc_rom + CART_TITLE, CART_HEADER_END - CART_TITLE },
+        { STATE_TAG_MACHINE, (uint8_t *)&gb->GB_STATE_START, sizeof(gb_t) - offsetof(gb_t, GB_STATE_START) },
+        { STATE_TAG_VRAM, gb->vram, VRAM_SIZE },
+        { STATE_TAG_RAM, gb->ram, RAM_SIZE },
+        { STATE_TAG_OAM, gb->oam, OAM_SIZE },
+        { STATE_TAG_IO, gb->io_registers, IO_REGISTER_SIZE },
+        { STATE_TAG_HRAM, gb->hram, HIGH_SPEED_RAM_SIZE },
+        { STATE_TAG_MBC_RAM, gb->mbc_ram, gb->mbc_ram_size },
+    };
+
+    memcpy(sections, layout, sizeof(layout));
+}
+
+size_t state_size(gb_t *gb) {
+    state_section_t sections[STATE_SECTION_COUNT];
+    state_sections(gb, sections);
+
+    size_t size = STATE_HEADER_SIZE;
+
+    for (uint8_t i = 0; i < STATE_SECTION_COUNT; i++) {
+        size += STATE_SECTION_HEADER_SIZE + state_pad(sections[i].size);
+    }
+
+    return size;
+}
+
+size_t state_save(gb_t *gb, uint8_t *buffer, size_t buffer_size) {
+    size_t size = state_size(gb);
+
+    if (buffer_size < size) {
+        return 0;
+    }
+
+    int64_t start = timeline_now();
+
+    // Lines still on the render workers are part of the frame buffer
+    gpu_sync(gb);
+
+    state_section_t sections[STATE_SECTION_COUNT];
+    state_sections(gb, sections);
+
+    memcpy(buffer, STATE_MAGIC, 4);
+    write_u32(buffer + 4, STATE_VERSION);
+    write_u32(buffer + 8, STATE_SECTION_COUNT);
+    write_u32(buffer + 12, size);
+
+    uint8_t *out = buffer + STATE_HEADER_SIZE;
+
+    for (uint8_t i = 0; i < STATE_SECTION_COUNT; i++) {
+        write_u32(out, sections[i].tag);
+        write_u32(out + 4, sections[i].size);
+        out += STATE_SECTION_HEADER_SIZE;
+
+        memcpy(out, sections[i].data, sections[i].size);
+        memset(out + sections[i].size, 0, state_pad(sections[i].size) - sections[i].size);
+        out += state_pad(sections[i].size);
+    }
+
+    timeline_span("state save", start, "bytes", size);
+    timeline_cycles("state save", gb->cycles, gb->cycles, NULL, 0);
+
+    return size;
+}
+
+/**
+ * Find each of this machine's sections in a state, checking every size.
+ * Unknown sections are skipped
+ */
+static int state_find_sections(const uint8_t *buffer, size_t size, const state_section_t *sections, const uint8_t *found[STATE_SECTION_COUNT]) {
+    if (size < STATE_HEADER_SIZE || memcmp(buffer, STATE_MAGIC, 4)) {
+        printf("Not a save state\n");
+        return 0;
+    }
+
+    if (read_u32(buffer + 4) != STATE_VERSION) {
+        printf("Save state version %u, expected %u\n", read_u32(buffer + 4), STATE_VERSION);
+        return 0;
+    }
+
+    if (read_u32(buffer + 12) > size) {
+        printf("Save state truncated\n");
+        return 0;
+    }
+
+    size = read_u32(buffer + 12);
+
+    memset(found, 0, sizeof(found[0]) * STATE_SECTION_COUNT);
+
+    uint32_t section_count = read_u32(buffer + 8);
+    size_t offset = STATE_HEADER_SIZE;
+
+    for (uint32_t n = 0; n < section_count; n++) {
+        if (offset + STATE_SECTION_HEADER_SIZE > size) {
+            printf("Save state truncated\n");
+            return 0;
+        }
+
+        uint32_t tag = read_u32(buffer + offset);
+        uint32_t section_size = read_u32(buffer + offset + 4);
+        offset += STATE_SECTION_HEADER_SIZE;
+
+        if (offset + state_pad(section_size) > size) {
+            printf("Save state truncated\n");
+            return 0;
+        }
+
+        for (uint8_t i = 0; i < STATE_SECTION_COUNT; i++) {
+            if (sections[i].tag != tag) {
+                continue;
+            }
+
+            if (sections[i].size != section_size) {
+                printf("Save state section %.4s is %u bytes, expected %u\n", (const char *)&buffer[offset - STATE_SECTION_HEADER_SIZE], section_size, sections[i].size);
+                return 0;
+            }
+
+            found[i] = buffer + offset;
+        }
+
+        offset += state_pad(section_size);
+    }
+
+    for (uint8_t i = 0; i < STATE_SECTION_COUNT; i++) {
+        if (!found[i]) {
+            printf("Save state is missing a section\n");
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+int state_load(gb_t *gb, const uint8_t *buffer, size_t size) {
+    state_section_t sections[STATE_SECTION_COUNT];
+    state_sections(gb, sections);
+
+    const uint8_t *found[STATE_SECTION_COUNT];
+
+    if (!state_find_sections(buffer, size, sections, found)) {
+        return 0;
+    }
+
+    // Only the header is stored, to check the state is for this cartridge
+    if (memcmp(found[0], sections[0].data, sections[0].size)) {
+        printf("Save state is for a different cartridge\n");
+        return 0;
+    }
+
+    int64_t start = timeline_now();
+
+    // Workers mustn't draw into the restored frame buffer
+    gpu_sync(gb);
+
+    for (uint8_t i = 1; i < STATE_SECTION_COUNT; i++) {
+        memcpy(sections[i].data, found[i], sections[i].size);
+    }
+
+    // Pointers into the cartridge follow the restored bank registers
+    mbc_update_banks(gb);
+    gpu_state_loaded(gb);
+
+    // Samples follow this session, whether or not the state was profiled
+    profiler_state_loaded(gb);
+
+    timeline_span("state load", start, "bytes", size);
+    timeline_cycles("state load", gb->cycles, gb->cycles, NULL, 0);
+
+    return 1;
+}
+
+int state_save_file(gb_t *gb, const char *path) {
+    size_t size = state_size(gb);
+    uint8_t *buffer = malloc(size);
+
+    state_save(gb, buffer, size);
+
+    FILE *f = fopen(path, "wb");
+
+    if (!f) {
+        printf("Failed to open %s\n", path);
+        free(buffer);
+        return 0;
+    }
+
+    size_t written = fwrite(buffer, 1, size, f);
+
+    fclose(f);
+    free(buffer);
+
+    return written == size;
+}
+
+int state_load_file(gb_t *gb, const char *path) {
+    FILE *f = fopen(path, "rb");
+
+    if (!f) {
+        printf("Failed to open %s\n", path);
+        return 0;
+    }
+
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    uint8_t *buffer = malloc(size);
+    size_t read = fread(buffer, 1, size, f);
+
+    fclose(f);
+
+    int loaded = read == (size_t)size && state_load(gb, buffer, size);
+
+    free(buffer);
+
+    return loaded;
+}
@@ -0,0 +1,131 @@
+#include <stats.h>
+
+#if GB_STATS || GB_OPCODE_STATS
+
+#include <string.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+    #include <x86intrin.h>
+    #define STATS_TSC 1
+#else
+    #define STATS_TSC 0
+#endif
+
+static uint64_t monotonic_ns() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+
+    return (uint64_t)t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+/**
+ * The time stamp counter where there is one, it's a fraction of the cost of clock_gettime
+ */
+uint64_t stats_ticks() {
+#if STATS_TSC
+    return __rdtsc();
+#else
+    return monotonic_ns();
+#endif
+}
+
+double stats_tick_ns() {
+#if STATS_TSC
+    static double tick_ns = 0;
+
+    if (tick_ns == 0) {
+        // Measure the counter against the monotonic clock, once
+        uint64_t start_ns = monotonic_ns();
+        uint64_t start_ticks = stats_ticks();
+
+        while (monotonic_ns() - start_ns < 20000000);
+
+        tick_ns = (double)(monotonic_ns() - start_ns) / (stats_ticks() - start_ticks);
+    }
+
+    return tick_ns;
+#else
+    return 1;
+#endif
+}
+
+#endif
+
+#if GB_STATS
+
+static const char *subsystem_names[STATS_SUBSYSTEM_COUNT] = {
+    "other", "cpu", "memory", "ppu", "timer", "dma", "joypad", "frontend",
+};
+
+/**
+ * Charge the time since the last change to the active subsystem
+ */
+static uint64_t charge(gb_stats_t *stats) {
+    uint64_t time = stats_ticks();
+
+    if (stats->since) {
+        stats->current[stats->active].ticks += time - stats->since;
+    }
+
+    stats->since = time;
+
+    return time;
+}
+
+void stats_enter(gb_stats_t *stats, uint8_t subsystem) {
+    charge(stats);
+
+    stats->stack[stats->depth++] = stats->active;
+    stats->active = subsystem;
+    stats->current[subsystem].calls++;
+}
+
+void stats_leave(gb_stats_t *stats) {
+    charge(stats);
+
+    stats->active = stats->stack[--stats->depth];
+}
+
+void stats_frame(gb_stats_t *stats) {
+    charge(stats);
+
+    for (uint8_t i = 0; i < STATS_SUBSYSTEM_COUNT; i++) {
+        stats->total[i].ticks += stats->current[i].ticks;
+        stats->total[i].calls += stats->current[i].calls;
+    }
+
+    memcpy(stats->last_frame, stats->current, sizeof(stats->current));
+    memset(stats->current, 0, sizeof(stats->current));
+
+    stats->frames++;
+}
+
+void stats_print(const gb_stats_t *stats, FILE *f) {
+    if (stats->frames == 0) {
+        fprintf(f, "No complete frames to report subsystem stats for\n");
+        return;
+    }
+
+    double tick_us = stats_tick_ns() / 1000;
+    uint64_t total_ticks = 0;
+
+    for (uint8_t i = 0; i < STATS_SUBSYSTEM_COUNT; i++) {
+        total_ticks += stats->total[i].ticks;
+    }
+
+    fprintf(f, "Subsystem stats over %u frames, per frame:\n", stats->frames);
+    fprintf(f, "  %-10s %12s %10s %7s %14s\n", "subsystem", "calls", "us", "share", "last frame us");
+
+    for (uint8_t i = 0; i < STATS_SUBSYSTEM_COUNT; i++) {
+        fprintf(f, "  %-10s %12.1f %10.1f %6.1f%% %14.1f\n", subsystem_names[i],
+            (double)stats->total[i].calls / stats->frames,
+            stats->total[i].ticks * tick_us / stats->frames,
+            total_ticks ? 100.0 * stats->total[i].ticks / total_ticks : 0,
+            stats->last_frame[i].ticks * tick_us);
+    }
+
+    fprintf(f, "  %-10s %12s %10.1f\n", "total", "", total_ticks * tick_us / stats->frames);
+}
+
+#endif
@@ -0,0 +1,298 @@
+#include <timeline.h>
+#include <pacer.h>
+#include <time.h>
+
+#define TIMELINE_MASK (TIMELINE_RING_SIZE - 1)
+
+// Emulated events all go on one track
+#define TIMELINE_EMULATED_TID 1
+
+static FILE *file;
+static int64_t start_ns;
+
+// Cleared on close, so late events from any thread are ignored
+static atomic_int recording;
+
+// Registered threads, published to the writer through thread_count
+static timeline_thread_t threads[TIMELINE_MAX_THREADS];
+static atomic_uint thread_count;
+static pthread_mutex_t thread_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// The calling thread's buffer, if it has one
+static _Thread_local timeline_thread_t *current_thread;
+
+static pthread_t writer_thread;
+static atomic_int running;
+
+// Owned by the writer until it is joined
+static uint8_t failed;
+static uint64_t written;
+
+/**
+ * Format one event as JSON, after a separator from the previous one
+ */
+static void write_event(const timeline_thread_t *thread, const timeline_event_t *event) {
+    uint32_t tid;
+    double start;
+    double duration;
+
+    if (event->pid == TIMELINE_PID_HOST) {
+        tid = thread->tid;
+        start = (event->start - start_ns) / 1000.0;
+        duration = event->duration / 1000.0;
+    } else {
+        tid = TIMELINE_EMULATED_TID;
+        start = event->start / TIMELINE_CYCLES_PER_US;
+        duration = event->duration / TIMELINE_CYCLES_PER_US;
+    }
+
+    int result;
+
+    if (event->type == TIMELINE_SPAN) {
+        result = fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%u,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f",
+            event->name, event->pid, tid, start, duration);
+    } else {
+        result = fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"pid\":%u,\"tid\":%u,\"ts\":%.3f",
+            event->name, event->pid, tid, start);
+    }
+
+    if (event->arg_name) {
+        fprintf(file, ",\"args\":{\"%s\":%lld}", event->arg_name, (long long)event->arg);
+    }
+
+    if (result < 0 || fputc('}', file) == EOF) {
+        failed = 1;
+    }
+
+    written++;
+}
+
+/**
+ * Write out whatever each thread has recorded. Returns 0 if there was nothing
+ */
+static int drain() {
+    uint32_t count = atomic_load_explicit(&thread_count, memory_order_acquire);
+    int drained = 0;
+
+    for (uint32_t i = 0; i < count; i++) {
+        timeline_thread_t *thread = &threads[i];
+        uint64_t head = atomic_load_explicit(&thread->head, memory_order_acquire);
+        uint64_t tail = atomic_load_explicit(&thread->tail, memory_order_relaxed);
+
+        if (head == tail) {
+            continue;
+        }
+
+        for (; tail != head; tail++) {
+            write_event(thread, &thread->ring[tail & TIMELINE_MASK]);
+        }
+
+        atomic_store_explicit(&thread->tail, tail, memory_order_release);
+        drained = 1;
+    }
+
+    return drained;
+}
+
+/**
+ * Writer thread, drains the buffers until stopped
+ */
+static void* drain_loop(void *arg) {
+    while (atomic_load(&running)) {
+        if (!drain()) {
+            struct timespec delay = { 0, TIMELINE_DRAIN_INTERVAL_MS * 1000000 };
+            nanosleep(&delay, NULL);
+        }
+    }
+
+    drain();
+
+    return NULL;
+}
+
+/**
+ * Add an event to the calling thread's buffer, if it has one
+ */
+static void push(const timeline_event_t *event) {
+    timeline_thread_t *thread = current_thread;
+
+    if (!thread || !atomic_load_explicit(&recording, memory_order_relaxed)) {
+        return;
+    }
+
+    uint64_t head = atomic_load_explicit(&thread->head, memory_order_relaxed);
+
+    if (head - atomic_load_explicit(&thread->tail, memory_order_acquire) == TIMELINE_RING_SIZE) {
+        thread->dropped++;
+        return;
+    }
+
+    thread->ring[head & TIMELINE_MASK] = *event;
+
+    atomic_store_explicit(&thread->head, head + 1, memory_order_release);
+}
+
+int timeline_open(const char *path) {
+    file = fopen(path, "w");
+
+    if (!file) {
+        printf("Failed to open timeline %s\n", path);
+        return 0;
+    }
+
+    start_ns = pacer_now_ns();
+    failed = 0;
+    written = 0;
+
+    // Name the tracks first, events follow with a leading separator
+    fprintf(file, "{\"traceEvents\":[\n");
+    fprintf(file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%u,\"args\":{\"name\":\"Host\"}},\n", TIMELINE_PID_HOST);
+    fprintf(file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%u,\"args\":{\"name\":\"Emulated\"}},\n", TIMELINE_PID_EMULATED);
+    fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%u,\"tid\":%u,\"args\":{\"name\":\"machine\"}}",
+        TIMELINE_PID_EMULATED, TIMELINE_EMULATED_TID);
+
+    atomic_store(&thread_count, 0);
+    atomic_store(&recording, 1);
+    atomic_store(&running, 1);
+
+    if (pthread_create(&writer_thread, NULL, drain_loop, NULL)) {
+        printf("Failed to start timeline writer thread\n");
+        atomic_store(&recording, 0);
+        fclose(file);
+        return 0;
+    }
+
+    return 1;
+}
+
+void timeline_thread_start(const char *name) {
+    if (!atomic_load(&recording)) {
+        return;
+    }
+
+    pthread_mutex_lock(&thread_lock);
+
+    uint32_t index = atomic_load_explicit(&thread_count, memory_order_relaxed);
+
+    if (index == TIMELINE_MAX_THREADS) {
+        pthread_mutex_unlock(&thread_lock);
+        return;
+    }
+
+    timeline_thread_t *thread = &threads[index];
+
+    thread->name = name;
+    thread->tid = index + 1;
+    thread->ring = malloc(sizeof(timeline_event_t) * TIMELINE_RING_SIZE);
+    thread->dropped = 0;
+
+    atomic_init(&thread->head, 0);
+    atomic_init(&thread->tail, 0);
+
+    atomic_store_explicit(&thread_count, index + 1, memory_order_release);
+
+    pthread_mutex_unlock(&thread_lock);
+
+    current_thread = thread;
+}
+
+int64_t timeline_now() {
+    if (!current_thread || !atomic_load_explicit(&recording, memory_order_relaxed)) {
+        return 0;
+    }
+
+    return pacer_now_ns();
+}
+
+void timeline_span(const char *name, int64_t start, const char *arg_name, int64_t arg) {
+    if (!start) {
+        return;
+    }
+
+    timeline_event_t event = {
+        .name = name,
+        .arg_name = arg_name,
+        .arg = arg,
+        .start = start,
+        .duration = pacer_now_ns() - start,
+        .type = TIMELINE_SPAN,
+        .pid = TIMELINE_PID_HOST,
+    };
+
+    push(&event);
+}
+
+void timeline_instant(const char *name, const char *arg_name, int64_t arg) {
+    int64_t now = timeline_now();
+
+    if (!now) {
+        return;
+    }
+
+    timeline_event_t event = {
+        .name = name,
+        .arg_name = arg_name,
+        .arg = arg,
+        .start = now,
+        .duration = 0,
+        .type = TIMELINE_INSTANT,
+        .pid = TIMELINE_PID_HOST,
+    };
+
+    push(&event);
+}
+
+void timeline_cycles(const char *name, uint64_t start, uint64_t end, const char *arg_name, int64_t arg) {
+    timeline_event_t event = {
+        .name = name,
+        .arg_name = arg_name,
+        .arg = arg,
+        .start = start,
+        .duration = end - start,
+        .type = start == end ? TIMELINE_INSTANT : TIMELINE_SPAN,
+        .pid = TIMELINE_PID_EMULATED,
+    };
+
+    push(&event);
+}
+
+int timeline_close() {
+    atomic_store(&recording, 0);
+    atomic_store(&running, 0);
+    pthread_join(writer_thread, NULL);
+
+    uint32_t count = atomic_load(&thread_count);
+
+    // Thread names last, the viewers don't mind the order
+    for (uint32_t i = 0; i < count; i++) {
+        fprintf(file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%u,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+            TIMELINE_PID_HOST, threads[i].tid, threads[i].name);
+
+        free(threads[i].ring);
+        threads[i].ring = NULL;
+    }
+
+    if (fprintf(file, "\n],\"displayTimeUnit\":\"ms\"}\n") < 0) {
+        failed = 1;
+    }
+
+    if (fclose(file)) {
+        failed = 1;
+    }
+
+    file = NULL;
+    current_thread = NULL;
+
+    return !failed;
+}
+
+void timeline_print_stats(FILE *f) {
+    uint32_t count = atomic_load(&thread_count);
+    uint64_t dropped = 0;
+
+    for (uint32_t i = 0; i < count; i++) {
+        dropped += threads[i].dropped;
+    }
+
+    fprintf(f, "Timeline: %llu events written, %llu dropped\n", (unsigned long long)written, (unsigned long long)dropped);
+}
@@ -1,75 +1,141 @@
 #include <timer.h>
+#include <scheduler.h>
+
+// Bit of the internal divider whose falling edge clocks TIMA, by TMC clock select
+static const uint8_t timer_clock_bit[4] = {
+    9,  // TMC_CLOCK_DIV_1024
+    3,  // TMC_CLOCK_DIV_16
+    5,  // TMC_CLOCK_DIV_64
+    7,  // TMC_CLOCK_DIV_256
+};
+
+/**
+ * Cycles since the divider was last reset. DIV is the top 8 bits
+ */
+static uint64_t divider(gb_t *gb) {
+    return gb->cycles - gb->div_base;
+}
+
+/**
+ * Whether the signal feeding TIMA is high, for detecting falling edges
+ */
+static uint8_t timer_signal(gb_t *gb, uint8_t tmc) {
+    return (tmc & TMC_ENABLE) && ((divider(gb) >> timer_clock_bit[tmc & TMC_CLOCK_SELECT]) & 1);
+}
+
+/**
+ * Bring TIMA up to date with the current cycle
+ */
+static void timer_sync(gb_t *gb) {
+    uint8_t tmc = gb->io_registers[REG_TMC & 0xFF];
 
-static uint16_t timer_increment_counter;
-static uint8_t divider_increment_counter;
+    if (tmc & TMC_ENABLE) {
+        uint8_t shift = timer_clock_bit[tmc & TMC_CLOCK_SELECT] + 1;
+
+        // One increment per falling edge crossed since the last sync. Never
+        // reaches an overflow, the scheduled event handles those first
+        gb->tima += (divider(gb) >> shift) - ((gb->tima_cycle - gb->div_base) >> shift);
+    }
 
-void timer_init() {
-    timer_increment_counter = 0;
-    divider_increment_counter = 0;
+    gb->tima_cycle = gb->cycles;
 }
 
-void timer_tick(gb_t *gb) {
-    // DIV timer
-    if (!divider_increment_counter) {
-        (gb->io_registers[REG_DIV & 0xFF])++;
+/**
+ * Schedule the falling edge that will take TIMA past 0xFF
+ */
+static void schedule_overflow(gb_t *gb) {
+    uint8_t tmc = gb->io_registers[REG_TMC & 0xFF];
+
+    if (!(tmc & TMC_ENABLE)) {
+        sched_cancel(gb, SCHED_EVENT_TIMER);
+        return;
     }
 
-    divider_increment_counter = (divider_increment_counter + 1) & 0xFF;
+    uint8_t shift = timer_clock_bit[tmc & TMC_CLOCK_SELECT] + 1;
+    uint64_t edges = 0x100 - gb->tima;
 
-    // Timer counter
+    sched_schedule(gb, SCHED_EVENT_TIMER, gb->div_base + ((((gb->tima_cycle - gb->div_base) >> shift) + edges) << shift));
+}
 
-    uint8_t tmc = mem_read_byte(gb, REG_TMC);
-    
-    if (tmc & TMC_ENABLE) {
-        timer_increment_counter++;
+static void timer_overflow(gb_t *gb) {
+    // Set counter to value in TMA
+    gb->tima = gb->io_registers[REG_TMA & 0xFF];
+
+    // Set interrupt flag
+    mem_write_byte(gb, INTERRUPT_FLAGS, mem_read_byte(gb, INTERRUPT_FLAGS) | INT_FLAG_TIMER);
+}
+
+/**
+ * Increment TIMA outside of the regular clock, from a glitched falling edge
+ */
+static void timer_increment(gb_t *gb) {
+    if (gb->tima == 0xFF) {
+        timer_overflow(gb);
+    } else {
+        gb->tima++;
     }
+}
 
-    uint8_t increment = 0;
+void timer_init(gb_t *gb) {
+    gb->div_base = gb->cycles;
+    gb->tima_cycle = gb->cycles;
+    gb->tima = 0;
 
-    switch (tmc & TMC_CLOCK_SELECT) {
-        case TMC_CLOCK_DIV_16:
-            if (timer_increment_counter >= 16) {
-                increment = 1;
-            }
+    sched_cancel(gb, SCHED_EVENT_TIMER);
+}
 
-            break;
+uint8_t timer_read(gb_t *gb, uint16_t address) {
+    if (address == REG_DIV) {
+        return (divider(gb) >> 8) & 0xFF;
+    }
 
-        case TMC_CLOCK_DIV_64:
-            if (timer_increment_counter >= 64) {
-                increment = 1;
-            }
+    timer_sync(gb);
 
-            break;
+    return gb->tima;
+}
+
+void timer_write(gb_t *gb, uint16_t address, uint8_t value) {
+    uint8_t tmc = gb->io_registers[REG_TMC & 0xFF];
+
+    timer_sync(gb);
 
-        case TMC_CLOCK_DIV_256:
-            if (timer_increment_counter >= 256) {
-                increment = 1;
+    switch (address) {
+        case REG_DIV:
+            // Resetting the divider is a falling edge if the selected bit was set
+            if (timer_signal(gb, tmc)) {
+                timer_increment(gb);
             }
 
+            gb->div_base = gb->cycles;
+            gb->tima_cycle = gb->cycles;
             break;
 
-        case TMC_CLOCK_DIV_1024:
-            if (timer_increment_counter >= 1024) {
-                increment = 1;
+        case REG_TIMA:
+            gb->tima = value;
+            break;
+
+        case REG_TMA:
+            // Only used at the next reload, the overflow time doesn't change
+            gb->io_registers[REG_TMA & 0xFF] = value;
+            return;
+
+        case REG_TMC:
+            // Disabling the timer or moving to a clear bit is also a falling edge
+            if (timer_signal(gb, tmc) && !timer_signal(gb, value)) {
+                timer_increment(gb);
             }
 
+            gb->io_registers[REG_TMC & 0xFF] = value;
             break;
     }
 
-    if (increment) {
-        timer_increment_counter = 0;
-
-        uint8_t tima_val = mem_read_byte(gb, REG_TIMA);
-        mem_write_byte(gb, REG_TIMA, (tima_val + 1) & 0xFF);
+    schedule_overflow(gb);
+}
 
-        if (tima_val == 0xFF) {
-            // Overflow
+void timer_overflow_event(gb_t *gb) {
+    timer_overflow(gb);
 
-            // Set counter to value in TMA
-            mem_write_byte(gb, REG_TIMA, mem_read_byte(gb, REG_TMA));
+    gb->tima_cycle = gb->cycles;
 
-            // Set interrupt flag
-            mem_write_byte(gb, INTERRUPT_FLAGS, mem_read_byte(gb, INTERRUPT_FLAGS) | INT_FLAG_TIMER);
-        }   
-    }
-}
\ No newline at end of file
+    schedule_overflow(gb);
+}
@@ -0,0 +1,161 @@
+#include <trace.h>
+#include <gb_memory.h>
+#include <sched.h>
+#include <time.h>
+
+#define TRACE_MASK (TRACE_RING_SIZE - 1)
+
+static void write_u32(uint8_t *out, uint32_t value) {
+    memcpy(out, &value, sizeof(value));
+}
+
+/**
+ * Write records from the ring to the file until it is empty, then sleep.
+ * Once stopped, write whatever is left and finish
+ */
+static void* drain_loop(void *arg) {
+    trace_t *trace = arg;
+    uint64_t tail = atomic_load_explicit(&trace->tail, memory_order_relaxed);
+
+    while (1) {
+        int running = atomic_load(&trace->running);
+        uint64_t head = atomic_load_explicit(&trace->head, memory_order_acquire);
+
+        if (head == tail) {
+            if (!running) {
+                break;
+            }
+
+            struct timespec delay = { 0, TRACE_DRAIN_INTERVAL_MS * 1000000 };
+            nanosleep(&delay, NULL);
+            continue;
+        }
+
+        // Up to the end of the ring, the rest on the next pass
+        uint64_t count = head - tail;
+        uint64_t start = tail & TRACE_MASK;
+
+        if (start + count > TRACE_RING_SIZE) {
+            count = TRACE_RING_SIZE - start;
+        }
+
+        if (fwrite(&trace->ring[start], sizeof(trace_record_t), count, trace->file) != count) {
+            atomic_store(&trace->failed, 1);
+        }
+
+        tail += count;
+        atomic_store_explicit(&trace->tail, tail, memory_order_release);
+    }
+
+    return NULL;
+}
+
+int trace_open(trace_t *trace, const char *path) {
+    memset(trace, 0, sizeof(*trace));
+
+    trace->file = fopen(path, "wb");
+
+    if (!trace->file) {
+        printf("Failed to open trace %s\n", path);
+        return 0;
+    }
+
+    uint8_t header[TRACE_HEADER_SIZE] = {0};
+
+    memcpy(header, TRACE_MAGIC, 4);
+    write_u32(header + 4, TRACE_VERSION);
+    write_u32(header + 8, sizeof(trace_record_t));
+
+    fwrite(header, 1, TRACE_HEADER_SIZE, trace->file);
+
+    trace->ring = malloc(sizeof(trace_record_t) * TRACE_RING_SIZE);
+
+    atomic_init(&trace->head, 0);
+    atomic_init(&trace->tail, 0);
+    atomic_init(&trace->failed, 0);
+    atomic_init(&trace->running, 1);
+
+    if (pthread_create(&trace->thread, NULL, drain_loop, trace)) {
+        printf("Failed to start trace writer thread\n");
+        fclose(trace->file);
+        free(trace->ring);
+        return 0;
+    }
+
+    return 1;
+}
+
+void trace_set_enabled(trace_t *trace, gb_t *gb, uint8_t enabled) {
+    gb->trace = enabled ? trace : NULL;
+}
+
+void trace_instruction(gb_t *gb) {
+    trace_t *trace = gb->trace;
+    uint64_t head = atomic_load_explicit(&trace->head, memory_order_relaxed);
+
+    if (head - trace->known_tail == TRACE_RING_SIZE) {
+        trace->known_tail = atomic_load_explicit(&trace->tail, memory_order_acquire);
+
+        if (head - trace->known_tail == TRACE_RING_SIZE) {
+            trace->stalls++;
+
+            // Give the writer the core, there may only be one
+            while (head - trace->known_tail == TRACE_RING_SIZE) {
+                sched_yield();
+                trace->known_tail = atomic_load_explicit(&trace->tail, memory_order_acquire);
+            }
+        }
+    }
+
+    trace_record_t *record = &trace->ring[head & TRACE_MASK];
+    uint16_t pc = gb->cpu.pc;
+
+    record->cycle = gb->cycles;
+    record->pc = pc;
+    record->bank = mem_bank(gb, pc);
+    record->sp = gb->cpu.sp;
+
+    record->a = gb->cpu.a;
+    record->f = gb->cpu.f;
+    record->b = gb->cpu.b;
+    record->c = gb->cpu.c;
+    record->d = gb->cpu.d;
+    record->e = gb->cpu.e;
+    record->h = gb->cpu.h;
+    record->l = gb->cpu.l;
+
+    // Peeked, so tracing can't disturb the machine it records
+    record->opcode[0] = mem_peek_byte(gb, pc);
+    record->opcode[1] = mem_peek_byte(gb, pc + 1);
+    record->opcode[2] = mem_peek_byte(gb, pc + 2);
+    record->ime = gb->ime;
+
+    memset(record->reserved, 0, sizeof(record->reserved));
+
+    atomic_store_explicit(&trace->head, head + 1, memory_order_release);
+}
+
+int trace_close(trace_t *trace, gb_t *gb) {
+    if (gb->trace == trace) {
+        gb->trace = NULL;
+    }
+
+    atomic_store(&trace->running, 0);
+    pthread_join(trace->thread, NULL);
+
+    int failed = atomic_load(&trace->failed) || fclose(trace->file);
+
+    free(trace->ring);
+    trace->ring = NULL;
+    trace->file = NULL;
+
+    return !failed;
+}
+
+void trace_print_stats(trace_t *trace, FILE *f) {
+    uint64_t records = atomic_load(&trace->head);
+
+    fprintf(f, "Traced %llu instructions, %.1f MB, waited on the writer %llu times\n",
+        (unsigned long long)records, records * sizeof(trace_record_t) / (1024.0 * 1024.0),
+        (unsigned long long)trace->stalls);
+}
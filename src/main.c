@@ -1,48 +1,749 @@
 #include <stdio.h>
+#include <string.h>
 #include <cpu.h>
 #include <gpu.h>
 #include <gb_memory.h>
 #include <timer.h>
+#include <scheduler.h>
+#include <display.h>
+#include <pacer.h>
+#include <save.h>
+#include <rtc.h>
+#include <boot.h>
+#include <state.h>
+#include <rewind.h>
+#include <runahead.h>
+#include <movie.h>
+#include <movie_verify.h>
+#include <profiler.h>
+#include <trace.h>
+#include <timeline.h>
+
+// Stop after this many frames, if set
+static uint32_t frame_limit = 0;
+
+static pacer_t pacer;
+
+// Set once the frame limit is reached or the window is closed
+static uint8_t quit = 0;
+
+static uint8_t rewind_enabled = 0;
+static rewind_t rewind_history;
+
+// Rewind snapshots and movie keyframes are taken between frames, so hand
+// back to the main loop after each
+static uint8_t frame_by_frame = 0;
+
+// The main loop runs and presents frames itself when running ahead
+static uint8_t runahead_frames = 0;
+static runahead_t runahead;
+
+static movie_t movie;
+
+// Print time per subsystem on exit, needs a GB_STATS build
+static uint8_t subsystem_stats = 0;
+
+// Print executions per opcode on exit, needs a GB_OPCODE_STATS build
+static uint8_t opcode_stats = 0;
+static uint32_t opcode_sample = OPCODE_STATS_DEFAULT_SAMPLE;
+
+// Guest code profile, written as folded stacks on exit
+static profiler_t profiler;
+static const char *profile_path = NULL;
+static const char *symbols_path = NULL;
+static uint32_t profile_interval = PROFILE_DEFAULT_INTERVAL;
+static uint8_t profile_calls = 0;
+
+// Instruction trace, on for frames trace_from up to trace_to (0 for no end)
+// and toggled with T
+static trace_t trace;
+static const char *trace_path = NULL;
+static uint32_t trace_from = 0;
+static uint32_t trace_to = 0;
+
+// Trace event timeline, and the host time and cycle the current frame
+// started emulating
+static const char *timeline_path = NULL;
+static int64_t frame_started = 0;
+static uint64_t frame_start_cycle = 0;
+
+static void print_usage() {
+    printf("Usage: gbemu [options] <filename>\n");
+    printf("  --render-threads <n>  Render lines on n worker threads\n");
+    printf("  --verify-render       Check the parallel renderer against the serial one\n");
+    printf("  --frames <n>          Exit after n frames, printing the final frame hash\n");
+    printf("  --frameskip <n>       Only draw one in every n + 1 frames\n");
+    printf("  --render-final-only   Only draw the last frame (needs --frames)\n");
+    printf("  --present <backend>   texture (default) or drawpixels\n");
+    printf("  --speed <x>           Run at x times real speed (at least %.2f), or unlimited\n", PACER_SPEED_MIN);
+    printf("  --pacing-stats        Print frame time statistics on exit\n");
+    printf("  --subsystem-stats     Print time and calls per frame by subsystem on exit (make STATS=1 builds)\n");
+    printf("  --opcode-stats        Print executions and cost per opcode on exit (make OPCODE_STATS=1 builds)\n");
+    printf("  --opcode-sample <n>   Time one in every n instructions for the opcode stats, 0 to only count (default %u)\n", OPCODE_STATS_DEFAULT_SAMPLE);
+    printf("  --profile <file>      Sample the guest program counter, writing folded stacks to file on exit\n");
+    printf("  --profile-interval <n> Cycles between profile samples (default %u)\n", PROFILE_DEFAULT_INTERVAL);
+    printf("  --profile-calls       Follow calls, returns and interrupts to sample whole call stacks\n");
+    printf("  --symbols <file>      RGBDS .sym file naming the profiled code (default the ROM's .sym, if any)\n");
+    printf("  --trace <file>        Write a binary trace of every instruction, toggled with T (see bin/trace_decode)\n");
+    printf("  --trace-from <n>      Start tracing at frame n (default 0)\n");
+    printf("  --trace-to <n>        Stop tracing at frame n\n");
+    printf("  --timeline <file>     Write a Chrome trace event timeline of frames, presentation, input and states\n");
+    printf("  --rtc-host            Run the cartridge clock from host time instead of emulated time\n");
+    printf("  --skip-bios           Start the cartridge directly in the post boot state\n");
+    printf("  --load-state <file>   Start from a save state\n");
+    printf("  --save-state <file>   Write a save state on exit\n");
+    printf("  --rewind <MB>         Keep MB of rewind history, played back while backspace is held\n");
+    printf("  --rewind-interval <n> Snapshot for rewind every n frames (default %u)\n", REWIND_DEFAULT_INTERVAL);
+    printf("  --run-ahead <n>       Show the frame n frames ahead to hide input lag (up to %u)\n", RUNAHEAD_MAX_FRAMES);
+    printf("  --run-ahead-secondary Run ahead on a second instance instead of saving and restoring\n");
+    printf("  --record-movie <file> Record input to a movie, written on exit\n");
+    printf("  --movie-checkpoint <n> Store frame and RAM hashes every n frames (default %u)\n", MOVIE_DEFAULT_CHECKPOINT_INTERVAL);
+    printf("  --movie-keyframe <n>  Store a state every n frames for --verify-movie (default %u, 0 for none)\n", MOVIE_DEFAULT_KEYFRAME_INTERVAL);
+    printf("  --play-movie <file>   Play a movie back headless at full speed, checking its hashes\n");
+    printf("  --verify-movie <file> Check a movie by playing the segments between its keyframes in parallel\n");
+    printf("  --jobs <n>            Segments to play at once for --verify-movie (default one per core)\n");
+}
+
+/**
+ * Switch tracing on or off for the frame about to start
+ */
+static void update_trace(gb_t *gb) {
+    if (!trace_path) {
+        return;
+    }
+
+    uint32_t next = gpu_frame_count(gb) + 1;
+
+    if (next == trace_from) {
+        trace_set_enabled(&trace, gb, 1);
+    }
+
+    if (next == trace_to) {
+        trace_set_enabled(&trace, gb, 0);
+    }
+
+    if (display_trace_toggled()) {
+        trace_set_enabled(&trace, gb, gb->trace == NULL);
+        printf("Tracing %s at frame %u\n", gb->trace ? "on" : "off", next);
+    }
+}
+
+/**
+ * Put the frame on the timeline, in host time from when it started
+ * emulating and in emulated time ending as vblank starts
+ */
+static void timeline_frame(gb_t *gb) {
+    uint32_t number = gpu_frame_count(gb);
+
+    timeline_span("emulate", frame_started, "frame", number);
+    timeline_cycles("frame", frame_start_cycle, gb->cycles, "frame", number);
+    frame_start_cycle = gb->cycles;
+
+    if (gb->gpu.lcd_on) {
+        timeline_cycles("vblank", gb->cycles, gb->cycles, NULL, 0);
+    }
+}
+
+/**
+ * Hand a frame to the present thread
+ */
+static void publish_frame(const uint8_t *frame, uint32_t number) {
+    int64_t start = timeline_now();
+
+    display_publish_frame(frame, number);
+
+    timeline_span("publish", start, "frame", number);
+}
+
+/**
+ * Wait until the next frame is due, then take input for it
+ */
+static void pace_and_poll() {
+    int64_t start = timeline_now();
+
+    pacer_wait_frame(&pacer);
+
+    timeline_span("pace", start, NULL, 0);
+
+    start = timeline_now();
+
+    if (!display_poll()) {
+        quit = 1;
+    }
+
+    timeline_span("poll", start, NULL, 0);
+
+    frame_started = timeline_now();
+}
+
+/**
+ * Pass each drawn frame to the display and wait until the next is due, stopping at the frame limit
+ */
+static int on_frame(gb_t *gb, const uint8_t *frame, uint8_t drawn) {
+    if (runahead.running_ahead) {
+        // Speculative, thrown away once shown
+        return 0;
+    }
+
+    update_trace(gb);
+    timeline_frame(gb);
+
+    if (movie.mode != MOVIE_MODE_NONE) {
+        movie_frame(&movie, gb, drawn);
+    }
+
+    if (movie.mode == MOVIE_MODE_PLAY || runahead_frames) {
+        // The main loop runs frames one at a time
+        frame_started = timeline_now();
+        return 0;
+    }
+
+    if (drawn) {
+        publish_frame(frame, gpu_frame_count(gb));
+    }
+
+    if (frame_limit && gpu_frame_count(gb) + 1 == frame_limit) {
+        quit = 1;
+        return 0;
+    }
+
+    pace_and_poll();
+
+    return !quit && !frame_by_frame;
+}
+
+/**
+ * Show the previous snapshot in place of a frame
+ */
+static void rewind_show_frame(gb_t *gb) {
+    rewind_step_back(&rewind_history, gb);
+    frame_start_cycle = gb->cycles;
+
+    publish_frame(gpu_get_frame(gb), gpu_frame_count(gb) - 1);
+
+    pace_and_poll();
+}
+
+/**
+ * Run a frame and present the one run ahead to
+ */
+static void runahead_show_frame(gb_t *gb) {
+    const uint8_t *frame = runahead_frame(&runahead, gb);
+
+    publish_frame(frame, gpu_frame_count(gb) - 1 + runahead_frames);
+
+    if (frame_limit && gpu_frame_count(gb) == frame_limit) {
+        quit = 1;
+        return;
+    }
+
+    pace_and_poll();
+}
+
+/**
+ * Print where each frame's time went, when built with GB_STATS
+ */
+static void print_subsystem_stats(gb_t *gb) {
+#if GB_STATS
+    if (subsystem_stats) {
+        stats_print(&gb->stats, stdout);
+    }
+#endif
+}
+
+/**
+ * Print the opcode histogram for the cartridge, when built with GB_OPCODE_STATS
+ */
+static void print_opcode_stats(gb_t *gb) {
+#if GB_OPCODE_STATS
+    if (opcode_stats) {
+        char title[CART_TITLE_SIZE + 1] = {0};
+
+        for (uint8_t i = 0; i < CART_TITLE_SIZE && gb->mbc_rom[CART_TITLE + i] >= ' ' && gb->mbc_rom[CART_TITLE + i] < 0x7F; i++) {
+            title[i] = gb->mbc_rom[CART_TITLE + i];
+        }
+
+        opcode_stats_print(&gb->opcode_stats, title, stdout);
+    }
+#endif
+}
+
+/**
+ * Start the profiler on a loaded cartridge, with its symbols if there are any
+ */
+static int start_profiler(gb_t *gb, const char *rom_filename) {
+    if (!profile_path) {
+        return 1;
+    }
+
+    if (!profiler_init(&profiler, gb, profile_interval, profile_calls)) {
+        return 0;
+    }
+
+    if (symbols_path) {
+        if (!profiler_load_symbols(&profiler, symbols_path)) {
+            printf("Failed to read symbols %s\n", symbols_path);
+            return 0;
+        }
+
+        return 1;
+    }
+
+    // Assemblers write foo.sym next to foo.gb
+    char *path = malloc(strlen(rom_filename) + 5);
+    strcpy(path, rom_filename);
+
+    char *extension = strrchr(path, '.');
+
+    if (extension && !strchr(extension, '/')) {
+        *extension = '\0';
+    }
+
+    strcat(path, ".sym");
+    profiler_load_symbols(&profiler, path);
+    free(path);
+
+    return 1;
+}
+
+/**
+ * Report the profile and write it out
+ */
+static void finish_profiler(gb_t *gb) {
+    if (!profile_path) {
+        return;
+    }
+
+    profiler_print(&profiler, stdout);
+
+    if (!profiler_write_folded(&profiler, profile_path)) {
+        printf("Failed to write profile %s\n", profile_path);
+    }
+
+    profiler_free(&profiler, gb);
+}
+
+/**
+ * Open the trace, tracing from the start unless a later frame was given
+ */
+static int start_trace(gb_t *gb) {
+    if (!trace_path) {
+        return 1;
+    }
+
+    if (!trace_open(&trace, trace_path)) {
+        return 0;
+    }
+
+    trace_set_enabled(&trace, gb, trace_from == 0);
+
+    return 1;
+}
+
+static void finish_trace(gb_t *gb) {
+    if (!trace_path) {
+        return;
+    }
+
+    if (!trace_close(&trace, gb)) {
+        printf("Failed to write trace %s\n", trace_path);
+    }
+
+    trace_print_stats(&trace, stdout);
+}
+
+/**
+ * Open the timeline, before any thread that records to it starts
+ */
+static int start_timeline() {
+    if (!timeline_path) {
+        return 1;
+    }
+
+    if (!timeline_open(timeline_path)) {
+        return 0;
+    }
+
+    timeline_thread_start("emulation");
+    frame_started = timeline_now();
+
+    return 1;
+}
+
+/**
+ * Write out the timeline, once the present thread has stopped
+ */
+static void finish_timeline() {
+    if (!timeline_path) {
+        return;
+    }
+
+    if (!timeline_close()) {
+        printf("Failed to write timeline %s\n", timeline_path);
+    }
+
+    timeline_print_stats(stdout);
+}
+
+/**
+ * Play a movie back as fast as possible, without a window. Returns the exit code
+ */
+static int play_movie(gb_t *gb, const char *path) {
+    if (!movie_play(&movie, gb, path)) {
+        return 1;
+    }
+
+    int64_t start = pacer_now_ns();
+    uint32_t start_frame = gpu_frame_count(gb);
+
+    // The movie may have started from a state
+    frame_start_cycle = gb->cycles;
+
+    while (!movie_finished(&movie, gb)) {
+        movie_feed_input(&movie, gb);
+        gb_run(gb);
+    }
+
+    double seconds = (pacer_now_ns() - start) / 1e9;
+    uint32_t frames = gpu_frame_count(gb) - start_frame;
+
+    movie_print_result(&movie, stdout);
+    print_subsystem_stats(gb);
+    print_opcode_stats(gb);
+    finish_profiler(gb);
+    finish_trace(gb);
+    finish_timeline();
+    printf("Played %u frames in %.3f s (%.0f fps, %.1fx real speed)\n",
+        frames, seconds, frames / seconds, frames / seconds / PACER_FRAME_RATE);
+
+    int desynced = movie.desynced;
+
+    movie_free(&movie);
+
+    return desynced;
+}
 
 int main(int argc, char *argv[]) {
-    if (argc != 2) {
-        printf("Usage: gbemu <filename>\n");
+    const char *rom_filename = NULL;
+
+    uint8_t render_mode = GPU_RENDER_SERIAL;
+    uint8_t render_threads = 0;
+
+    uint32_t frame_skip = 0;
+    uint8_t render_final_only = 0;
+
+    uint8_t display_backend = DISPLAY_BACKEND_TEXTURE;
+
+    // Negative until set, real speed by default but uncapped for batch runs
+    double speed = -1;
+    uint8_t pacing_stats = 0;
+
+    uint8_t rtc_host = 0;
+    uint8_t skip_bios = 0;
+
+    const char *load_state = NULL;
+    const char *save_state = NULL;
+
+    size_t rewind_budget = 0;
+    uint32_t rewind_interval = REWIND_DEFAULT_INTERVAL;
+
+    uint8_t runahead_secondary = 0;
+
+    const char *record_movie = NULL;
+    const char *play_movie_path = NULL;
+    const char *verify_movie = NULL;
+    uint32_t movie_checkpoint = MOVIE_DEFAULT_CHECKPOINT_INTERVAL;
+    uint32_t movie_keyframe_interval = MOVIE_DEFAULT_KEYFRAME_INTERVAL;
+    uint32_t jobs = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--render-threads") && i + 1 < argc) {
+            render_mode = render_mode == GPU_RENDER_VERIFY ? GPU_RENDER_VERIFY : GPU_RENDER_PARALLEL;
+            render_threads = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--verify-render")) {
+            render_mode = GPU_RENDER_VERIFY;
+        } else if (!strcmp(argv[i], "--frames") && i + 1 < argc) {
+            frame_limit = strtoul(argv[++i], NULL, 10);
+        } else if (!strcmp(argv[i], "--frameskip") && i + 1 < argc) {
+            frame_skip = strtoul(argv[++i], NULL, 10);
+        } else if (!strcmp(argv[i], "--render-final-only")) {
+            render_final_only = 1;
+        } else if (!strcmp(argv[i], "--present") && i + 1 < argc) {
+            i++;
+
+            if (!strcmp(argv[i], "drawpixels")) {
+                display_backend = DISPLAY_BACKEND_DRAW_PIXELS;
+            } else if (!strcmp(argv[i], "texture")) {
+                display_backend = DISPLAY_BACKEND_TEXTURE;
+            } else {
+                print_usage();
+                return 0;
+            }
+        } else if (!strcmp(argv[i], "--speed") && i + 1 < argc) {
+            i++;
+
+            if (!strcmp(argv[i], "unlimited")) {
+                speed = PACER_SPEED_UNLIMITED;
+            } else {
+                speed = atof(argv[i]);
+
+                if (speed < PACER_SPEED_MIN) {
+                    print_usage();
+                    return 0;
+                }
+            }
+        } else if (!strcmp(argv[i], "--pacing-stats")) {
+            pacing_stats = 1;
+        } else if (!strcmp(argv[i], "--subsystem-stats")) {
+            subsystem_stats = 1;
+        } else if (!strcmp(argv[i], "--opcode-stats")) {
+            opcode_stats = 1;
+        } else if (!strcmp(argv[i], "--opcode-sample") && i + 1 < argc) {
+            opcode_sample = strtoul(argv[++i], NULL, 10);
+        } else if (!strcmp(argv[i], "--profile") && i + 1 < argc) {
+            profile_path = argv[++i];
+        } else if (!strcmp(argv[i], "--profile-interval") && i + 1 < argc) {
+            profile_interval = strtoul(argv[++i], NULL, 10);
+        } else if (!strcmp(argv[i], "--profile-calls")) {
+            profile_calls = 1;
+        } else if (!strcmp(argv[i], "--symbols") && i + 1 < argc) {
+            symbols_path = argv[++i];
+        } else if (!strcmp(argv[i], "--trace") && i + 1 < argc) {
+            trace_path = argv[++i];
+        } else if (!strcmp(argv[i], "--trace-from") && i + 1 < argc) {
+            trace_from = strtoul(argv[++i], NULL, 10);
+        } else if (!strcmp(argv[i], "--trace-to") && i + 1 < argc) {
+            trace_to = strtoul(argv[++i], NULL, 10);
+        } else if (!strcmp(argv[i], "--timeline") && i + 1 < argc) {
+            timeline_path = argv[++i];
+        } else if (!strcmp(argv[i], "--rtc-host")) {
+            rtc_host = 1;
+        } else if (!strcmp(argv[i], "--skip-bios")) {
+            skip_bios = 1;
+        } else if (!strcmp(argv[i], "--load-state") && i + 1 < argc) {
+            load_state = argv[++i];
+        } else if (!strcmp(argv[i], "--save-state") && i + 1 < argc) {
+            save_state = argv[++i];
+        } else if (!strcmp(argv[i], "--rewind") && i + 1 < argc) {
+            rewind_budget = atof(argv[++i]) * 1024 * 1024;
+            rewind_enabled = 1;
+        } else if (!strcmp(argv[i], "--rewind-interval") && i + 1 < argc) {
+            rewind_interval = strtoul(argv[++i], NULL, 10);
+        } else if (!strcmp(argv[i], "--run-ahead") && i + 1 < argc) {
+            runahead_frames = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--run-ahead-secondary")) {
+            runahead_secondary = 1;
+        } else if (!strcmp(argv[i], "--record-movie") && i + 1 < argc) {
+            record_movie = argv[++i];
+        } else if (!strcmp(argv[i], "--movie-checkpoint") && i + 1 < argc) {
+            movie_checkpoint = strtoul(argv[++i], NULL, 10);
+        } else if (!strcmp(argv[i], "--play-movie") && i + 1 < argc) {
+            play_movie_path = argv[++i];
+        } else if (!strcmp(argv[i], "--movie-keyframe") && i + 1 < argc) {
+            movie_keyframe_interval = strtoul(argv[++i], NULL, 10);
+        } else if (!strcmp(argv[i], "--verify-movie") && i + 1 < argc) {
+            verify_movie = argv[++i];
+        } else if (!strcmp(argv[i], "--jobs") && i + 1 < argc) {
+            jobs = strtoul(argv[++i], NULL, 10);
+        } else if (argv[i][0] != '-' && rom_filename == NULL) {
+            rom_filename = argv[i];
+        } else {
+            print_usage();
+            return 0;
+        }
+    }
+
+    if (rom_filename == NULL || (render_final_only && frame_limit == 0)) {
+        print_usage();
         return 0;
     }
 
+    if (subsystem_stats && !GB_STATS) {
+        printf("Subsystem stats need a build with GB_STATS set, e.g. make STATS=1\n");
+        return 1;
+    }
+
+    if (opcode_stats && !GB_OPCODE_STATS) {
+        printf("Opcode stats need a build with GB_OPCODE_STATS set, e.g. make OPCODE_STATS=1\n");
+        return 1;
+    }
+
+    if (record_movie && (rewind_enabled || runahead_frames || play_movie_path || verify_movie)) {
+        printf("Movies can't be recorded while rewinding, running ahead or playing a movie\n");
+        return 1;
+    }
+
+    if ((profile_path || trace_path || timeline_path) && verify_movie) {
+        printf("Movies verified in parallel segments can't be profiled or traced, play them with --play-movie instead\n");
+        return 1;
+    }
+
+    if (verify_movie) {
+        // Render worker threads don't survive the fork into each segment
+        render_mode = GPU_RENDER_SERIAL;
+    }
+
+    if (render_mode != GPU_RENDER_SERIAL && render_threads == 0) {
+        render_threads = 2;
+    }
+
+    if (speed < 0) {
+        speed = frame_limit ? PACER_SPEED_UNLIMITED : 1;
+    }
+
+    // Render workers and the present thread record from when they start
+    if (!start_timeline()) {
+        return 1;
+    }
+
     gb_t *gb = get_gb_instance();
 
+    sched_init(gb);
     cpu_init(gb);
     mem_init(gb);
     gpu_init(gb);
-    joypad_init();
-    timer_init();
+    joypad_init(gb);
+    timer_init(gb);
 
-    mem_load_rom(gb, argv[1]);
+#if GB_OPCODE_STATS
+    opcode_stats_init(&gb->opcode_stats, opcode_sample);
+#endif
 
-    // Functions as a clock divider
-    uint8_t cycle_counter = 0;
+    if (!gpu_set_render_mode(render_mode, render_threads)) {
+        return 1;
+    }
+
+    gpu_set_frame_handler(on_frame);
+
+    gpu_set_frame_skip(frame_skip);
+
+    if (render_final_only) {
+        gpu_set_render_only_frame(gb, frame_limit - 1);
+    }
+
+    if (play_movie_path) {
+        // The movie holds everything needed to start, including cartridge RAM
+        if (!mem_load_rom(gb, rom_filename) || !start_profiler(gb, rom_filename) || !start_trace(gb)) {
+            return 1;
+        }
+
+        return play_movie(gb, play_movie_path);
+    }
+
+    if (verify_movie) {
+        if (!mem_load_rom(gb, rom_filename) || !movie_load(&movie, gb, verify_movie)) {
+            return 1;
+        }
+
+        int failed = movie_verify(&movie, gb, verify_movie, jobs, movie_keyframe_interval);
+
+        movie_free(&movie);
+
+        return failed;
+    }
+
+    if (!display_init(gb, display_backend)) {
+        return 1;
+    }
+
+    if (!mem_load_rom(gb, rom_filename) || !save_open(gb, rom_filename)) {
+        return 1;
+    }
+
+    if (rtc_host) {
+        rtc_use_host_time(gb);
+    }
+
+    if (skip_bios) {
+        boot_skip_bios(gb);
+    }
+
+    if (load_state && !state_load_file(gb, load_state)) {
+        return 1;
+    }
+
+    if (!start_profiler(gb, rom_filename) || !start_trace(gb)) {
+        return 1;
+    }
+
+    if (record_movie && !movie_record(&movie, gb, movie_checkpoint, movie_keyframe_interval, skip_bios, load_state == NULL)) {
+        return 1;
+    }
+
+    if (rewind_enabled && !rewind_init(&rewind_history, gb, rewind_budget, rewind_interval)) {
+        return 1;
+    }
+
+    if (runahead_frames && !runahead_init(&runahead, gb, runahead_frames, runahead_secondary)) {
+        return 1;
+    }
+
+    frame_by_frame = rewind_enabled || record_movie;
+
+    pacer_init(&pacer, speed);
+    frame_started = timeline_now();
+    frame_start_cycle = gb->cycles;
+
+    while (!quit) {
+        if (rewind_enabled && display_rewind_held()) {
+            rewind_show_frame(gb);
+            continue;
+        }
+
+        if (runahead_frames) {
+            runahead_show_frame(gb);
+        } else {
+            gb_run(gb);
+        }
 
-    // Main tick loop
-    for (;;) {
-        if (cycle_counter == 0) {
-            // Divide the cpu clock by 4
-            cpu_tick(gb);
+        if (rewind_enabled) {
+            rewind_frame(&rewind_history, gb);
         }
 
-        mem_dma(gb);
+        if (record_movie) {
+            movie_keyframe(&movie, gb);
+        }
+    }
+
+    if (frame_limit && gpu_frame_count(gb) == frame_limit) {
+        printf("Frame %u hash: %016llX\n", frame_limit, (unsigned long long)gpu_frame_hash(gb));
+    }
 
-        if (!gpu_tick(gb)) {
-            break;
+    if (save_state && !state_save_file(gb, save_state)) {
+        printf("Failed to write save state %s\n", save_state);
+    }
+
+    if (record_movie) {
+        if (!movie_save(&movie, gb, record_movie)) {
+            printf("Failed to write movie %s\n", record_movie);
         }
 
-        joypad_update_io_registers(gb);
+        movie_free(&movie);
+    }
 
-        timer_tick(gb);
+    save_close(gb);
 
-        cycle_counter++;
-        cycle_counter &= 3;
+    if (pacing_stats) {
+        pacer_print_stats(&pacer, stdout);
     }
 
+    print_subsystem_stats(gb);
+    print_opcode_stats(gb);
+    finish_profiler(gb);
+    finish_trace(gb);
+
+    if (runahead_frames) {
+        runahead_print_stats(&runahead, stdout);
+        runahead_free(&runahead);
+    }
+
+    if (rewind_enabled) {
+        rewind_print_stats(&rewind_history, stdout);
+        rewind_free(&rewind_history);
+    }
+
+    display_close();
+    finish_timeline();
+
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,289 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <trace.h>
+#include <gb_memory.h>
+
+// Renders a binary instruction trace written with --trace as text, or
+// compares two and shows where they first diverge.
+// Usage: trace_decode [--from <n>] [--count <n>] <trace>
+//        trace_decode --diff [--context <n>] <trace> <trace>
+
+#define DEFAULT_CONTEXT 5
+#define MAX_CONTEXT 1000
+
+/**
+ * Bytes in each instruction, the CB prefix counting as a 2 byte instruction
+ */
+static const uint8_t opcode_lengths[256] = {
+/*          0  1  2  3  4  5  6  7  8  9  A  B  C  D  E  F */
+/* 0x0- */  1, 3, 1, 1, 1, 1, 2, 1, 3, 1, 1, 1, 1, 1, 2, 1,
+/* 0x1- */  2, 3, 1, 1, 1, 1, 2, 1, 2, 1, 1, 1, 1, 1, 2, 1,
+/* 0x2- */  2, 3, 1, 1, 1, 1, 2, 1, 2, 1, 1, 1, 1, 1, 2, 1,
+/* 0x3- */  2, 3, 1, 1, 1, 1, 2, 1, 2, 1, 1, 1, 1, 1, 2, 1,
+/* 0x4- */  1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+/* 0x5- */  1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+/* 0x6- */  1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+/* 0x7- */  1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+/* 0x8- */  1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+/* 0x9- */  1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+/* 0xA- */  1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+/* 0xB- */  1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+/* 0xC- */  1, 1, 3, 3, 3, 1, 2, 1, 1, 1, 3, 2, 3, 3, 2, 1,
+/* 0xD- */  1, 1, 3, 1, 3, 1, 2, 1, 1, 1, 3, 1, 3, 1, 2, 1,
+/* 0xE- */  2, 1, 1, 1, 1, 1, 2, 1, 2, 1, 3, 1, 1, 1, 2, 1,
+/* 0xF- */  2, 1, 1, 1, 1, 1, 2, 1, 2, 1, 3, 1, 1, 1, 2, 1,
+};
+
+static uint32_t read_u32(const uint8_t *in) {
+    uint32_t value;
+    memcpy(&value, in, sizeof(value));
+    return value;
+}
+
+/**
+ * Open a trace and check its header
+ */
+static FILE* open_trace(const char *path) {
+    FILE *f = fopen(path, "rb");
+
+    if (!f) {
+        printf("Failed to open %s\n", path);
+        return NULL;
+    }
+
+    uint8_t header[TRACE_HEADER_SIZE];
+
+    if (fread(header, 1, TRACE_HEADER_SIZE, f) != TRACE_HEADER_SIZE || memcmp(header, TRACE_MAGIC, 4)) {
+        printf("%s is not a trace\n", path);
+        fclose(f);
+        return NULL;
+    }
+
+    if (read_u32(header + 4) != TRACE_VERSION || read_u32(header + 8) != sizeof(trace_record_t)) {
+        printf("%s is trace version %u with %u byte records, expected version %u with %u\n", path,
+            read_u32(header + 4), read_u32(header + 8), TRACE_VERSION, (uint32_t)sizeof(trace_record_t));
+        fclose(f);
+        return NULL;
+    }
+
+    return f;
+}
+
+static void print_record(uint64_t index, const trace_record_t *record, const char *prefix) {
+    char bytes[12];
+    uint8_t length = opcode_lengths[record->opcode[0]];
+
+    if (length == 1) {
+        snprintf(bytes, sizeof(bytes), "%02X", record->opcode[0]);
+    } else if (length == 2) {
+        snprintf(bytes, sizeof(bytes), "%02X %02X", record->opcode[0], record->opcode[1]);
+    } else {
+        snprintf(bytes, sizeof(bytes), "%02X %02X %02X", record->opcode[0], record->opcode[1], record->opcode[2]);
+    }
+
+    char bank[8];
+
+    if (record->bank == MEM_BANK_BOOT) {
+        snprintf(bank, sizeof(bank), "boot");
+    } else {
+        snprintf(bank, sizeof(bank), "%02X", record->bank);
+    }
+
+    printf("%s%10llu %12llu %4s:%04X  %-8s  A:%02X F:%c%c%c%c BC:%02X%02X DE:%02X%02X HL:%02X%02X SP:%04X IME:%u\n",
+        prefix, (unsigned long long)index, (unsigned long long)record->cycle, bank, record->pc, bytes, record->a,
+        record->f & 0x80 ? 'Z' : '-', record->f & 0x40 ? 'N' : '-', record->f & 0x20 ? 'H' : '-', record->f & 0x10 ? 'C' : '-',
+        record->b, record->c, record->d, record->e, record->h, record->l, record->sp, record->ime);
+}
+
+static void print_header(const char *prefix) {
+    printf("%s%10s %12s %9s  %-8s  registers before the instruction\n", prefix, "index", "cycle", "pc", "bytes");
+}
+
+static int decode(const char *path, uint64_t from, uint64_t count) {
+    FILE *f = open_trace(path);
+
+    if (!f) {
+        return 1;
+    }
+
+    if (fseek(f, TRACE_HEADER_SIZE + from * sizeof(trace_record_t), SEEK_SET)) {
+        printf("Failed to seek to record %llu\n", (unsigned long long)from);
+        fclose(f);
+        return 1;
+    }
+
+    trace_record_t record;
+    uint64_t index = from;
+
+    print_header("");
+
+    while ((!count || index < from + count) && fread(&record, sizeof(record), 1, f) == 1) {
+        print_record(index++, &record, "");
+    }
+
+    fclose(f);
+
+    return 0;
+}
+
+/**
+ * Name the fields two records differ in
+ */
+static void print_differences(const trace_record_t *a, const trace_record_t *b) {
+    printf("Differs in:");
+
+    if (a->cycle != b->cycle) {
+        printf(" cycle (%+lld)", (long long)(b->cycle - a->cycle));
+    }
+
+    if (a->pc != b->pc || a->bank != b->bank) {
+        printf(" pc");
+    }
+
+    if (memcmp(a->opcode, b->opcode, sizeof(a->opcode))) {
+        printf(" bytes");
+    }
+
+    if (a->a != b->a) {
+        printf(" A");
+    }
+
+    if (a->f != b->f) {
+        printf(" F");
+    }
+
+    if (a->b != b->b || a->c != b->c) {
+        printf(" BC");
+    }
+
+    if (a->d != b->d || a->e != b->e) {
+        printf(" DE");
+    }
+
+    if (a->h != b->h || a->l != b->l) {
+        printf(" HL");
+    }
+
+    if (a->sp != b->sp) {
+        printf(" SP");
+    }
+
+    if (a->ime != b->ime) {
+        printf(" IME");
+    }
+
+    printf("\n");
+}
+
+static int diff(const char *path_a, const char *path_b, uint32_t context) {
+    FILE *a = open_trace(path_a);
+    FILE *b = open_trace(path_b);
+
+    if (!a || !b) {
+        return 2;
+    }
+
+    // The last records both agreed on, oldest first from history_start
+    trace_record_t *history = malloc(sizeof(trace_record_t) * (context + 1));
+    uint32_t history_count = 0;
+    uint32_t history_start = 0;
+
+    trace_record_t record_a;
+    trace_record_t record_b;
+    uint64_t index = 0;
+    int result = 0;
+
+    while (1) {
+        int has_a = fread(&record_a, sizeof(record_a), 1, a) == 1;
+        int has_b = fread(&record_b, sizeof(record_b), 1, b) == 1;
+
+        if (!has_a && !has_b) {
+            printf("Traces match, %llu instructions\n", (unsigned long long)index);
+            break;
+        }
+
+        if (has_a != has_b) {
+            printf("Traces match for %llu instructions, then %s ends\n", (unsigned long long)index, has_a ? path_b : path_a);
+            result = 1;
+            break;
+        }
+
+        if (memcmp(&record_a, &record_b, sizeof(trace_record_t))) {
+            printf("Traces diverge at instruction %llu\n", (unsigned long long)index);
+            print_header("  ");
+
+            for (uint32_t i = 0; i < history_count; i++) {
+                print_record(index - history_count + i, &history[(history_start + i) % (context + 1)], "  ");
+            }
+
+            print_record(index, &record_a, "< ");
+            print_record(index, &record_b, "> ");
+            print_differences(&record_a, &record_b);
+
+            result = 1;
+            break;
+        }
+
+        if (context) {
+            history[(history_start + history_count) % (context + 1)] = record_a;
+
+            if (history_count == context) {
+                history_start = (history_start + 1) % (context + 1);
+            } else {
+                history_count++;
+            }
+        }
+
+        index++;
+    }
+
+    free(history);
+    fclose(a);
+    fclose(b);
+
+    return result;
+}
+
+static void print_usage() {
+    printf("Usage: trace_decode [--from <n>] [--count <n>] <trace>\n");
+    printf("       trace_decode --diff [--context <n>] <trace> <trace>\n");
+    printf("  --from <n>      Start at instruction n\n");
+    printf("  --count <n>     Print at most n instructions\n");
+    printf("  --diff          Compare two traces, exiting with 1 if they differ\n");
+    printf("  --context <n>   Instructions shown before the first difference (default %u)\n", DEFAULT_CONTEXT);
+}
+
+int main(int argc, char *argv[]) {
+    uint64_t from = 0;
+    uint64_t count = 0;
+    uint8_t compare = 0;
+    uint32_t context = DEFAULT_CONTEXT;
+
+    const char *paths[2];
+    int path_count = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--from") && i + 1 < argc) {
+            from = strtoull(argv[++i], NULL, 10);
+        } else if (!strcmp(argv[i], "--count") && i + 1 < argc) {
+            count = strtoull(argv[++i], NULL, 10);
+        } else if (!strcmp(argv[i], "--diff")) {
+            compare = 1;
+        } else if (!strcmp(argv[i], "--context") && i + 1 < argc) {
+            context = strtoul(argv[++i], NULL, 10);
+        } else if (argv[i][0] != '-' && path_count < 2) {
+            paths[path_count++] = argv[i];
+        } else {
+            print_usage();
+            return 2;
+        }
+    }
+
+    if (path_count != (compare ? 2 : 1) || context > MAX_CONTEXT) {
+        print_usage();
+        return 2;
+    }
+
+    return compare ? diff(paths[0], paths[1], context) : decode(paths[0], from, count);
+}